@@ -0,0 +1,618 @@
+//
+//  math-eval-alloc-test
+//
+//  allocation counting test suite:
+//  malloc, calloc, realloc and free are interposed
+//  and every way of building an evaluation is checked
+//  to perform without allocating memory once set up
+//
+//  Copyright (c) 2024 Paolo Bertani - Kalei S.r.l.
+//  Licensed under the FreeBSD 2-clause license
+//
+
+
+
+#define _GNU_SOURCE     // RTLD_NEXT
+
+#include "matheval.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+
+#ifndef __GLIBC__
+#include <dlfcn.h>
+#endif
+
+
+
+#define MATH_EVAL_ALLOC_TEST_EXPRESSION "x^y/(x-y)+sin(x)!+max(x,y,1)*avg(y,x)-log(2,x)"
+#define MATH_EVAL_ALLOC_TEST_ITERATIONS 1000
+
+
+
+// An evaluation repeated by `MathEvalAllocTest`,
+// `i` is the number of the iteration
+
+typedef void MathEvalAllocCall( MathEvaluation *eval, int i );
+
+
+
+int main( int argc, char **argv );
+void MathEvalAllocRunTests( void );
+void MathEvalAllocTestSetup( MathEvaluation *eval );
+void MathEvalAllocTest( int lineNumber, const char *name, MathEvaluation *eval, size_t setupAllocations, MathEvalAllocCall *call );
+void MathEvalAllocTestColumns( int lineNumber, const char *name, MathEvaluation *eval );
+void MathEvalAllocTestPerform( MathEvaluation *eval, int i );
+void MathEvalAllocTestFitted( MathEvaluation *eval, int i );
+void MathEvalAllocTestInterval( MathEvaluation *eval, int i );
+void MathEvalAllocTestCompare( MathEvaluation *eval, int i );
+void MathEvalAllocTestDerivatives( MathEvaluation *eval, int i );
+void MathEvalAllocTestGradient( MathEvaluation *eval, int i );
+void *MathEvalAllocTestAlloc( size_t size, void *userData );
+void MathEvalAllocTestFree( void *memory, void *userData );
+
+void *malloc( size_t size );
+void *calloc( size_t count, size_t size );
+void *realloc( void *memory, size_t size );
+void free( void *memory );
+
+
+
+// Allocations (malloc, calloc and realloc calls)
+// and releases made by the process so far
+
+static size_t MathEvalAllocations = 0;
+static size_t MathEvalReleases = 0;
+static bool   MathEvalAllocFailed = false;
+
+
+
+int main( int argc, char **argv )
+{
+    MathEvalAllocRunTests();
+    return MathEvalAllocFailed ? 1 : 0;
+}
+
+
+
+//
+// Interposed allocation functions: count the calls
+// and forward them to the C library
+//
+
+#ifdef __GLIBC__
+
+extern void *__libc_malloc( size_t size );
+extern void *__libc_calloc( size_t count, size_t size );
+extern void *__libc_realloc( void *memory, size_t size );
+extern void  __libc_free( void *memory );
+
+void *malloc( size_t size )
+{
+    __atomic_add_fetch( &MathEvalAllocations, 1, __ATOMIC_RELAXED );
+    return __libc_malloc( size );
+}
+
+void *calloc( size_t count, size_t size )
+{
+    __atomic_add_fetch( &MathEvalAllocations, 1, __ATOMIC_RELAXED );
+    return __libc_calloc( count, size );
+}
+
+void *realloc( void *memory, size_t size )
+{
+    __atomic_add_fetch( &MathEvalAllocations, 1, __ATOMIC_RELAXED );
+    return __libc_realloc( memory, size );
+}
+
+void free( void *memory )
+{
+    __atomic_add_fetch( &MathEvalReleases, memory != NULL, __ATOMIC_RELAXED );
+    __libc_free( memory );
+}
+
+#else
+
+void *malloc( size_t size )
+{
+    static void *( *next )( size_t );
+
+    if( ! next ) next = (void *( * )( size_t )) dlsym( RTLD_NEXT, "malloc" );
+
+    __atomic_add_fetch( &MathEvalAllocations, 1, __ATOMIC_RELAXED );
+    return next( size );
+}
+
+void *calloc( size_t count, size_t size )
+{
+    static void *( *next )( size_t, size_t );
+
+    if( ! next ) next = (void *( * )( size_t, size_t )) dlsym( RTLD_NEXT, "calloc" );
+
+    __atomic_add_fetch( &MathEvalAllocations, 1, __ATOMIC_RELAXED );
+    return next( count, size );
+}
+
+void *realloc( void *memory, size_t size )
+{
+    static void *( *next )( void *, size_t );
+
+    if( ! next ) next = (void *( * )( void *, size_t )) dlsym( RTLD_NEXT, "realloc" );
+
+    __atomic_add_fetch( &MathEvalAllocations, 1, __ATOMIC_RELAXED );
+    return next( memory, size );
+}
+
+void free( void *memory )
+{
+    static void ( *next )( void * );
+
+    if( ! next ) next = (void ( * )( void * )) dlsym( RTLD_NEXT, "free" );
+
+    __atomic_add_fetch( &MathEvalReleases, memory != NULL, __ATOMIC_RELAXED );
+    next( memory );
+}
+
+#endif
+
+
+
+//
+// Execute all tests: each kind of evaluation is built
+// and set up (the allocations needed are reported) then
+// evaluated many times checking that no memory is
+// allocated.
+//
+
+void MathEvalAllocRunTests( void )
+{
+    MathEvaluationAllocator
+                          allocator;
+    MathEvaluationCatalog *catalog;
+    MathEvaluation        *eval,
+                          *evals[ 2 ],
+                          local;
+    MathEvaluationStatus  statuses[ 2 ];
+    MathEvaluationErrorPolicy
+                          policies[ 3 ] = { MathEvaluationStrict, MathEvaluationPropagate, MathEvaluationSaturate };
+    const char            *expressions[ 2 ] = { MATH_EVAL_ALLOC_TEST_EXPRESSION, "x*y" },
+                          *params[ 2 ] = { "x", "y" };
+    const char            *content = "formula = " MATH_EVAL_ALLOC_TEST_EXPRESSION "\n",
+                          *policyNames[ 3 ] = { "strict", "propagate", "saturate" };
+    static unsigned char  buffer[ 8192 ];
+    char                  path[] = "/tmp/matheval-alloc-test-XXXXXX";
+    void                  *image;
+    size_t                count,
+                          size;
+    int                   fd,
+                          i;
+
+    printf( "Allocations during set up (new, parameters, first evaluation):\n\n" );
+
+    // MathEvaluationNew
+
+    count = MathEvalAllocations;
+    eval = MathEvaluationNew( MATH_EVAL_ALLOC_TEST_EXPRESSION );
+    MathEvalAllocTestSetup( eval );
+    MathEvalAllocTest( __LINE__, "new", eval, MathEvalAllocations - count, MathEvalAllocTestPerform );
+
+    // Result cache
+
+    count = MathEvalAllocations;
+    MathEvaluationSetResultCache( eval, 64 );
+    MathEvalAllocTestSetup( eval );
+    MathEvalAllocTest( __LINE__, "result cache", eval, MathEvalAllocations - count, MathEvalAllocTestPerform );
+
+    // MathEvaluationPerformColumns
+
+    MathEvalAllocTestColumns( __LINE__, "columns", eval );
+    MathEvaluationDispose( eval );
+
+    // MathEvaluationInit
+
+    count = MathEvalAllocations;
+    MathEvaluationInit( &local, MATH_EVAL_ALLOC_TEST_EXPRESSION, buffer, sizeof( buffer ) );
+    MathEvaluationSetResultCache( &local, 16 );
+    MathEvalAllocTestSetup( &local );
+    MathEvalAllocTest( __LINE__, "in place", &local, MathEvalAllocations - count, MathEvalAllocTestPerform );
+
+    // MathEvaluationNewWithAllocator
+
+    allocator.alloc = MathEvalAllocTestAlloc;
+    allocator.free = MathEvalAllocTestFree;
+    allocator.userData = NULL;
+
+    count = MathEvalAllocations;
+    eval = MathEvaluationNewWithAllocator( MATH_EVAL_ALLOC_TEST_EXPRESSION, &allocator );
+    MathEvalAllocTestSetup( eval );
+    MathEvalAllocTest( __LINE__, "allocator", eval, MathEvalAllocations - count, MathEvalAllocTestPerform );
+
+    // MathEvaluationReset
+
+    count = MathEvalAllocations;
+    MathEvaluationReset( eval, "x*y+1" );
+    MathEvaluationReset( eval, MATH_EVAL_ALLOC_TEST_EXPRESSION );
+    MathEvalAllocTestSetup( eval );
+    MathEvalAllocTest( __LINE__, "reset", eval, MathEvalAllocations - count, MathEvalAllocTestPerform );
+    MathEvaluationDispose( eval );
+
+    // MathEvaluationAcquire
+
+    MathEvaluationRelease( MathEvaluationAcquire( "x*y" ) );
+
+    count = MathEvalAllocations;
+    eval = MathEvaluationAcquire( MATH_EVAL_ALLOC_TEST_EXPRESSION );
+    MathEvalAllocTestSetup( eval );
+    MathEvalAllocTest( __LINE__, "pool", eval, MathEvalAllocations - count, MathEvalAllocTestPerform );
+
+    // MathEvaluationNewFromImage
+
+    size = MathEvaluationWriteImage( eval, NULL, 0 );
+    image = malloc( size );
+    MathEvaluationWriteImage( eval, image, size );
+    MathEvaluationRelease( eval );
+
+    count = MathEvalAllocations;
+    eval = MathEvaluationNewFromImage( image, size, NULL );
+    MathEvalAllocTestSetup( eval );
+    MathEvalAllocTest( __LINE__, "image", eval, MathEvalAllocations - count, MathEvalAllocTestPerform );
+    MathEvaluationDispose( eval );
+    free( image );
+
+    // MathEvaluationNewBatch
+
+    count = MathEvalAllocations;
+    MathEvaluationNewBatch( expressions, 2, params, 2, 2, evals, statuses );
+    MathEvalAllocTestSetup( evals[ 0 ] );
+    MathEvalAllocTest( __LINE__, "batch", evals[ 0 ], MathEvalAllocations - count, MathEvalAllocTestPerform );
+    MathEvaluationDispose( evals[ 0 ] );
+    MathEvaluationDispose( evals[ 1 ] );
+
+    // MathEvaluationCatalogGet
+
+    fd = mkstemp( path );
+    if( fd < 0 || write( fd, content, strlen( content ) ) != (ssize_t) strlen( content ) )
+    {
+        printf( "Test at line number %d failed\n\ncannot write %s\n\n", __LINE__, path );
+        MathEvalAllocFailed = true;
+    }
+    else
+    {
+        close( fd );
+
+        count = MathEvalAllocations;
+        catalog = MathEvaluationCatalogOpen( path );
+        eval = catalog ? MathEvaluationCatalogGet( catalog, "formula" ) : NULL;
+        if( eval )
+        {
+            MathEvalAllocTestSetup( eval );
+            MathEvalAllocTest( __LINE__, "catalog", eval, MathEvalAllocations - count, MathEvalAllocTestPerform );
+        }
+        else
+        {
+            printf( "Test at line number %d failed\n\ncannot open catalog %s\n\n", __LINE__, path );
+            MathEvalAllocFailed = true;
+        }
+
+        if( catalog ) MathEvaluationCatalogClose( catalog );
+    }
+
+    unlink( path );
+
+    // MathEvaluationSetDeferredChecks
+
+    count = MathEvalAllocations;
+    eval = MathEvaluationNew( MATH_EVAL_ALLOC_TEST_EXPRESSION );
+    MathEvaluationSetDeferredChecks( eval, true );
+    MathEvalAllocTestSetup( eval );
+    MathEvalAllocTest( __LINE__, "deferred", eval, MathEvalAllocations - count, MathEvalAllocTestPerform );
+    MathEvaluationDispose( eval );
+
+    // MathEvaluationSetErrorPolicy
+
+    for( i = 0; i < 3; i++ )
+    {
+        count = MathEvalAllocations;
+        eval = MathEvaluationNew( MATH_EVAL_ALLOC_TEST_EXPRESSION );
+        MathEvaluationSetErrorPolicy( eval, policies[ i ] );
+        MathEvalAllocTestSetup( eval );
+        MathEvalAllocTest( __LINE__, policyNames[ i ], eval, MathEvalAllocations - count, MathEvalAllocTestPerform );
+        MathEvaluationDispose( eval );
+    }
+
+    // MathEvaluationSetApproximation
+
+    count = MathEvalAllocations;
+    eval = MathEvaluationNew( MATH_EVAL_ALLOC_TEST_EXPRESSION );
+    MathEvaluationSetApproximation( eval, 1e-6 );
+    MathEvalAllocTestSetup( eval );
+    MathEvalAllocTest( __LINE__, "approximation", eval, MathEvalAllocations - count, MathEvalAllocTestPerform );
+    MathEvalAllocTestColumns( __LINE__, "approx columns", eval );
+    MathEvaluationDispose( eval );
+
+    // MathEvaluationFit: only the fitted
+    // parameter changes
+
+    count = MathEvalAllocations;
+    eval = MathEvaluationNew( "exp(sin(x*3))*y" );
+    MathEvalAllocTestSetup( eval );
+    if( MathEvaluationFit( eval, "x", 0, 1, 1e-6 ) == MathEvaluationSuccess )
+    {
+        MathEvalAllocTestFitted( eval, 0 );
+        MathEvalAllocTest( __LINE__, "fit", eval, MathEvalAllocations - count, MathEvalAllocTestFitted );
+    }
+    else
+    {
+        printf( "Test at line number %d failed\n\ncannot fit the expression\n\n", __LINE__ );
+        MathEvalAllocFailed = true;
+    }
+    MathEvaluationDispose( eval );
+
+    // MathEvaluationPerformInterval
+
+    count = MathEvalAllocations;
+    eval = MathEvaluationNew( MATH_EVAL_ALLOC_TEST_EXPRESSION );
+    MathEvalAllocTestSetup( eval );
+    MathEvalAllocTestInterval( eval, 0 );
+    MathEvalAllocTest( __LINE__, "interval", eval, MathEvalAllocations - count, MathEvalAllocTestInterval );
+    MathEvaluationDispose( eval );
+
+    // MathEvaluationSetBounds: the values of
+    // the iterations are within the bounds
+
+    count = MathEvalAllocations;
+    eval = MathEvaluationNew( MATH_EVAL_ALLOC_TEST_EXPRESSION );
+    MathEvalAllocTestSetup( eval );
+    MathEvaluationSetBounds( eval, "x", 0, 6 );
+    MathEvaluationSetBounds( eval, "y", 0, 4 );
+    MathEvalAllocTestSetup( eval );
+    MathEvalAllocTest( __LINE__, "bounds", eval, MathEvalAllocations - count, MathEvalAllocTestPerform );
+    MathEvaluationDispose( eval );
+
+    // MathEvaluationCompare
+
+    count = MathEvalAllocations;
+    eval = MathEvaluationNew( MATH_EVAL_ALLOC_TEST_EXPRESSION );
+    MathEvalAllocTestSetup( eval );
+    MathEvalAllocTestCompare( eval, 0 );
+    MathEvalAllocTest( __LINE__, "compare", eval, MathEvalAllocations - count, MathEvalAllocTestCompare );
+    MathEvaluationDispose( eval );
+
+    // MathEvaluationPerformDerivatives
+
+    count = MathEvalAllocations;
+    eval = MathEvaluationNew( MATH_EVAL_ALLOC_TEST_EXPRESSION );
+    MathEvalAllocTestSetup( eval );
+    MathEvalAllocTestDerivatives( eval, 0 );
+    MathEvalAllocTest( __LINE__, "derivatives", eval, MathEvalAllocations - count, MathEvalAllocTestDerivatives );
+    MathEvaluationDispose( eval );
+
+    // MathEvaluationPerformGradient
+
+    count = MathEvalAllocations;
+    eval = MathEvaluationNew( MATH_EVAL_ALLOC_TEST_EXPRESSION );
+    MathEvalAllocTestSetup( eval );
+    MathEvalAllocTestGradient( eval, 0 );
+    MathEvalAllocTest( __LINE__, "gradient", eval, MathEvalAllocations - count, MathEvalAllocTestGradient );
+    MathEvaluationDispose( eval );
+
+    // All tests passed
+
+    if( ! MathEvalAllocFailed )
+    {
+        printf( "\nAll allocation tests passed\n" );
+    }
+}
+
+
+
+//
+// Defines the parameters and performs
+// the evaluation a first time
+//
+
+void MathEvalAllocTestSetup( MathEvaluation *eval )
+{
+    double result;
+
+    MathEvaluationSetParam( eval, "x", 1 );
+    MathEvaluationSetParam( eval, "y", 2 );
+    MathEvaluationPerform( eval, &result );
+}
+
+
+
+//
+// Test function: repeats the evaluation `call` many times
+// (division by zero included) checking that no memory
+// is allocated nor released.
+//
+
+void MathEvalAllocTest( int lineNumber, const char *name, MathEvaluation *eval, size_t setupAllocations, MathEvalAllocCall *call )
+{
+    size_t allocations,
+           releases;
+    int    i;
+
+    printf( "%-14s %4zu\n", name, setupAllocations );
+
+    allocations = MathEvalAllocations;
+    releases = MathEvalReleases;
+
+    for( i = 0; i < MATH_EVAL_ALLOC_TEST_ITERATIONS; i++ )
+    {
+        call( eval, i );
+    }
+
+    allocations = MathEvalAllocations - allocations;
+    releases = MathEvalReleases - releases;
+
+    if( allocations != 0 || releases != 0 )
+    {
+        printf( "\nTest at line number %d failed\n\n", lineNumber );
+        printf( "Evaluation: %s\n\n", name );
+        printf( "Allocations: %zu, releases: %zu in %d evaluations\n\n", allocations, releases, MATH_EVAL_ALLOC_TEST_ITERATIONS );
+        MathEvalAllocFailed = true;
+    }
+}
+
+
+
+//
+// Test function: after the first call column evaluations
+// must not allocate nor release memory
+//
+
+void MathEvalAllocTestColumns( int lineNumber, const char *name, MathEvaluation *eval )
+{
+    const char           *params[ 2 ] = { "x", "y" };
+    const double         *columns[ 2 ];
+    double               *x,
+                         *y,
+                         *results;
+    MathEvaluationStatus statuses[ 1000 ];
+    size_t               allocations,
+                         releases,
+                         count;
+    int                  i;
+
+    x = MathEvaluationAllocColumn( 1000, false );
+    y = MathEvaluationAllocColumn( 1000, false );
+    results = MathEvaluationAllocColumn( 1000, false );
+
+    for( i = 0; i < 1000; i++ )
+    {
+        x[ i ] = i % 7;
+        y[ i ] = i % 5;
+    }
+
+    columns[ 0 ] = x;
+    columns[ 1 ] = y;
+
+    count = MathEvalAllocations;
+    MathEvaluationPerformColumns( eval, params, columns, 2, 1000, results, statuses );
+    printf( "%-14s %4zu\n", name, MathEvalAllocations - count );
+
+    allocations = MathEvalAllocations;
+    releases = MathEvalReleases;
+
+    for( i = 0; i < 100; i++ )
+    {
+        MathEvaluationPerformColumns( eval, params, columns, 2, 1000 - i, results + i, statuses );
+    }
+
+    allocations = MathEvalAllocations - allocations;
+    releases = MathEvalReleases - releases;
+
+    if( allocations != 0 || releases != 0 )
+    {
+        printf( "\nTest at line number %d failed\n\n", lineNumber );
+        printf( "Evaluation: %s\n\n", name );
+        printf( "Allocations: %zu, releases: %zu in 100 column evaluations\n\n", allocations, releases );
+        MathEvalAllocFailed = true;
+    }
+
+    MathEvaluationFreeColumn( x );
+    MathEvaluationFreeColumn( y );
+    MathEvaluationFreeColumn( results );
+}
+
+
+
+//
+// Evaluations repeated by `MathEvalAllocTest`: set the
+// parameters (x = i % 7, y = i % 5) and evaluate.
+// The fitted evaluation changes only x, in 0...1.
+//
+
+void MathEvalAllocTestPerform( MathEvaluation *eval, int i )
+{
+    double result;
+
+    MathEvaluationSetParam( eval, "x", i % 7 );
+    MathEvaluationSetParam( eval, "y", i % 5 );
+    MathEvaluationPerform( eval, &result );
+    MathEvaluationGetResult( eval );
+}
+
+
+
+void MathEvalAllocTestFitted( MathEvaluation *eval, int i )
+{
+    double result;
+
+    MathEvaluationSetParam( eval, "x", ( i % 7 ) / 7.0 );
+    MathEvaluationPerform( eval, &result );
+}
+
+
+
+void MathEvalAllocTestInterval( MathEvaluation *eval, int i )
+{
+    const char *params[ 2 ] = { "x", "y" };
+    double     lows[ 2 ] = { i % 7, i % 5 },
+               highs[ 2 ] = { i % 7 + 0.5, i % 5 + 0.5 },
+               low,
+               high;
+
+    MathEvaluationPerformInterval( eval, params, lows, highs, 2, &low, &high );
+}
+
+
+
+void MathEvalAllocTestCompare( MathEvaluation *eval, int i )
+{
+    bool above;
+
+    MathEvaluationSetParam( eval, "x", i % 7 );
+    MathEvaluationSetParam( eval, "y", i % 5 );
+    MathEvaluationCompare( eval, i % 3, &above );
+}
+
+
+
+void MathEvalAllocTestDerivatives( MathEvaluation *eval, int i )
+{
+    const char *params[ 2 ] = { "x", "y" };
+    double     result,
+               partials[ 2 ];
+
+    MathEvaluationSetParam( eval, "x", i % 7 );
+    MathEvaluationSetParam( eval, "y", i % 5 );
+    MathEvaluationPerformDerivatives( eval, params, 2, &result, partials );
+}
+
+
+
+void MathEvalAllocTestGradient( MathEvaluation *eval, int i )
+{
+    double result,
+           gradient[ 2 ];
+
+    MathEvaluationSetParam( eval, "x", i % 7 );
+    MathEvaluationSetParam( eval, "y", i % 5 );
+    MathEvaluationPerformGradient( eval, &result, gradient, 2 );
+}
+
+
+
+//
+// Allocator callbacks for `MathEvaluationNewWithAllocator`
+//
+
+void *MathEvalAllocTestAlloc( size_t size, void *userData )
+{
+    return malloc( size );
+}
+
+
+
+void MathEvalAllocTestFree( void *memory, void *userData )
+{
+    free( memory );
+}
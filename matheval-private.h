@@ -17,6 +17,7 @@
 #include <stddef.h>
 #include <stdbool.h>
 #include <inttypes.h>
+#include <pthread.h>
 
 
 
@@ -54,61 +55,513 @@ enum MathEvalToken
     MET_rbo,   // round bracket open  (round bracket count increases)
     MET_rbc,   // round bracket close (round bracket count decreases)
     MET_com,   // comma - argument separator inside functions
-    MET_Val    // a number in scientific notation (1 .1 0.1 1.2E-3) or `e` (euler number) or `pi`
+    MET_Val,   // a number in scientific notation (1 .1 0.1 1.2E-3) or `e` (euler number) or `pi`
+    MET_Par    // a parameter
 };
 typedef enum MathEvalToken MathEvalToken;
 
 
 
+// opcodes of the compiled program
+// each opcode pops its operands from the stack and pushes the result
+
+enum MathEvalOpcode
+{
+    MEO_Val,   // push a constant
+    MEO_Par,   // push the value of a parameter
+    MEO_Neg,   // unary minus
+    MEO_Add,   // a + b
+    MEO_Sub,   // a - b
+    MEO_Mul,   // a * b
+    MEO_Div,   // a / b
+    MEO_Pow,   // a ^ b, pow(a,b)
+    MEO_Fac,   // a!, fact(a)
+    MEO_Sin,   // sin(a)
+    MEO_Cos,   // cos(a)
+    MEO_Tan,   // tan(a)
+    MEO_ASi,   // asin(a)
+    MEO_ACo,   // acos(a)
+    MEO_ATa,   // atan(a)
+    MEO_Exp,   // exp(a)
+    MEO_Log,   // log(a)
+    MEO_LgB,   // log(a,b) logarithm of b with base a
+    MEO_Max,   // max(a1, a2...) of `count` operands
+    MEO_Min,   // min(a1, a2...) of `count` operands
+    MEO_Avg    // average(a1, a2...) of `count` operands
+};
+typedef enum MathEvalOpcode MathEvalOpcode;
+
+
+
 // Private structures
 
 struct MathEvalParam
 {
-    char                    name[256];
     size_t                  len;
-    double                  value;
+    uint32_t                slot;       // index of the value in `MathEvaluation.values`
+    double                  min;        // declared bounds of the value,
+    double                  max;        // -inf...inf if none (see `MathEvaluationSetBounds`)
     struct MathEvalParam    *next;
+    char                    name[];     // up to 255 characters, null terminated
 };
 typedef struct MathEvalParam MathEvalParam;
 
 
 
+// a node of a compiled expression, 16 bytes;
+// the program is a contiguous array of nodes in
+// evaluation (post) order so that operands are
+// found on the stack and not referenced by index
+
+struct MathEvalNode
+{
+    uint8_t                 opcode;     // a `MathEvalOpcode`
+    uint8_t                 flags;      // `MATH_EVAL_NODE_SAFE` or 0
+    uint16_t                reserved;
+    uint32_t                position;   // offset in the expression where errors are reported
+    union
+    {
+        double              value;      // the constant of `MEO_Val`
+        uint32_t            slot;       // the parameter slot of `MEO_Par`
+        uint32_t            count;      // number of operands of max, min, average
+    };
+};
+typedef struct MathEvalNode MathEvalNode;
+
+#define MATH_EVAL_NODE_SAFE         1     // the result is always valid for the bounds of the parameters
+
+
+
+// the last argument and result of a call site of
+// sin, cos, exp, log or factorial (see `MathEvalMemoized`)
+
+struct MathEvalMemo
+{
+    uint64_t                argument;   // bits of the argument, so that 0 and -0 differ
+    double                  result;
+};
+typedef struct MathEvalMemo MathEvalMemo;
+
+
+
+// an interval of values, `low` <= `high`
+
+struct MathEvalInterval
+{
+    double                  low;
+    double                  high;
+};
+typedef struct MathEvalInterval MathEvalInterval;
+
+
+
+// a value and a bound of its error: the exact
+// value is within `value` - `radius`...`value` + `radius`
+
+struct MathEvalBall
+{
+    double                  value;
+    double                  radius;
+};
+typedef struct MathEvalBall MathEvalBall;
+
+
+
+// an entry of the result cache: the outcome of
+// the evaluation for the parameters `values`
+
+#define MATH_EVAL_RESULTS_PROBES 4
+
+struct MathEvalResultEntry
+{
+    uint64_t                hash;       // hash of `values`, 0 if the entry is empty
+    double                  result;
+    const char              *error;     // NULL if the evaluation succeeded
+    int64_t                 position;   // where the error occurred
+    double                  values[];   // the parameters by slot
+};
+typedef struct MathEvalResultEntry MathEvalResultEntry;
+
+
+
+// Header of a compiled expression image (see `MathEvaluationWriteImage`).
+// The image contains no pointers: the sections
+// follow the header at the given offsets
+// from the beginning of the image.
+//
+//     header
+//     nodes        `nodesCount` MathEvalNode
+//     slots        `slotsCount` parameter names, each one null terminated
+//     expression   null terminated
+//     padding      up to a multiple of 8 bytes
+
+#define MATH_EVAL_VERSION       "2.2"
+
+#define MATH_EVAL_IMAGE_MAGIC   "MATHEVAL"
+#define MATH_EVAL_IMAGE_VERSION 2
+#define MATH_EVAL_IMAGE_ORDER   0x01020304
+
+struct MathEvalImage
+{
+    char                    magic[8];
+    uint32_t                version;
+    uint32_t                byteOrder;  // `MATH_EVAL_IMAGE_ORDER` in the writer byte order
+    uint32_t                nodeSize;   // sizeof( MathEvalNode ) of the writer
+    uint32_t                nodesCount;
+    uint32_t                slotsCount;
+    uint32_t                stackSize;
+    uint64_t                size;       // size of the whole image
+    uint64_t                nodesOffset;
+    uint64_t                slotsOffset;
+    uint64_t                expressionOffset;
+};
+typedef struct MathEvalImage MathEvalImage;
+
+
+
+// header of a block of memory of an evaluation taken
+// from the caller provided storage, the caller allocator
+// or the arena; 16 bytes so that blocks stay aligned
+
+struct MathEvalBlock
+{
+    size_t size;
+    size_t reserved;
+};
+typedef struct MathEvalBlock MathEvalBlock;
+
+
+
+// size of the first chunk of the arena of an
+// evaluation, following chunks double in size
+
+#define MATH_EVAL_ARENA_SIZE 2048
+
+
+
+// a chunk of the arena of an evaluation,
+// `data` is followed by `size` bytes of which
+// `used` are taken
+
+struct MathEvalChunk
+{
+    struct MathEvalChunk    *next;
+    size_t                  size;
+    size_t                  used;
+    size_t                  reserved;
+    unsigned char           data[];
+};
+typedef struct MathEvalChunk MathEvalChunk;
+
+
+
+// approximated functions (see `MathEvaluationSetApproximation`):
+// terms of the polynomials chosen to meet the error budget
+
+#define MATH_EVAL_APPROX_MIN_TOLERANCE 1e-12
+
+struct MathEvalApproximation
+{
+    double   tolerance;         // error budget, 0 if the exact functions are used
+    uint32_t expTerms;          // degree of the exp polynomial
+    uint32_t logTerms;          // terms of the log series (odd powers)
+    uint32_t powTerms;          // terms of the log series computed by pow
+    uint32_t sinTerms;          // terms of the sin series (odd powers)
+    uint32_t cosTerms;          // terms of the cos series (even powers)
+};
+typedef struct MathEvalApproximation MathEvalApproximation;
+
+
+
+// piecewise Chebyshev approximation of the expression over
+// the domain of a parameter (see `MathEvaluationFit`)
+
+#define MATH_EVAL_FIT_NODES      16     // Chebyshev nodes (coefficients) fitted in each piece
+#define MATH_EVAL_FIT_MAX_PIECES 65536
+
+struct MathEvalFit
+{
+    double   *coefficients;     // `terms` coefficients for each piece, NULL if there is no fit
+    size_t   pieces;
+    uint32_t terms;
+    uint32_t slot;              // slot of the parameter
+    double   min,               // domain of the parameter
+             max,
+             width;             // width of each piece
+};
+typedef struct MathEvalFit MathEvalFit;
+
+
+
 struct MathEvaluation
 {
     const char      *expression;
     MathEvalParam   *params;
+    double          *values;            // values of the parameters by slot
+    size_t          valuesCount;
+    size_t          valuesSize;
     const char      *cursor;
     double          result;
     int64_t         roundBracketsCount;
     const char      *error;
+
+    MathEvalParam   *param;             // parameter fetched by the last call to `MathEvalProcessToken`
+
+    MathEvalNode    *program;           // compiled expression, nodes in evaluation order
+    size_t          programCount;
+    size_t          programSize;
+    bool            compiled;           // false if the expression must be (re)compiled
+    bool            hashed;             // false if `hash` must be computed
+    uint64_t        hash;               // structural hash of the program
+    bool            integer;            // true if the program may be executed with integers
+    bool            bounded;            // true if `MathEvaluationCompare` bounds the result first
+    bool            safe;               // true if the program needs no checks (see `MathEvalAnalyze`)
+    bool            deferred;           // true if floating point exceptions are checked at the end
+    MathEvaluationErrorPolicy
+                    policy;             // how complex or too big results are handled
+    MathEvalApproximation
+                    approximation;      // polynomial approximations of sin, cos, exp, log and pow
+    MathEvalFit     fit;                // approximation of the expression evaluated instead of the program
+    bool            ownsExpression;     // false if expression and program
+    bool            ownsProgram;        // are in a image loaded by `MathEvaluationNewFromImage`
+
+    unsigned char   *results;           // result cache, `resultsSize` entries of `resultsStride` bytes
+    size_t          resultsSize;        // 0 if the cache is disabled, a power of 2 otherwise
+    size_t          resultsStride;
+
+    double          *stack;             // evaluation stack, followed by the memos
+    size_t          stackSize;          // doubles of the stack and the memos
+    MathEvalMemo    *memos;             // the call sites of the program in order
+    size_t          stackDepth;         // stack depth reached by the nodes emitted so far
+    size_t          stackMaxDepth;
+
+    unsigned char   *buffer;            // caller provided storage (see `MathEvaluationInit`), NULL if the heap is used
+    size_t          bufferSize;
+    size_t          bufferUsed;
+    bool            allocated;          // true if the struct itself has been allocated by `MathEvaluationNew`
+
+    MathEvaluationAllocator
+                    allocator;          // `alloc` is NULL if the heap is used
+    MathEvalChunk   *arena;             // chunks of the arena, the most recent first
+
+    unsigned char   *workspace;         // stack of `MathEvaluationPerformColumns`, `workspaceSize` bytes
+    size_t          workspaceSize;
+
+    size_t          paramsSize;         // bytes of the parameters
+    MathEvaluationFootprint
+                    footprint;          // memory added to the totals of the process
 };
 typedef struct MathEvaluation MathEvaluation;
 
 
 
+// factorials in the lookup table (0!...170!)
+
+#define MATH_EVAL_FACTORIALS        171
+
+
+
+// rows evaluated at once by `MathEvaluationPerformColumns`
+// and alignment of its columns
+
+#define MATH_EVAL_COLUMNS_BLOCK     256
+#define MATH_EVAL_COLUMNS_ALIGNMENT 64
+#define MATH_EVAL_COLUMNS_SCRATCH   4     // blocks of values for the approximated functions
+#define MATH_EVAL_HUGE_PAGE_SIZE    ( 2 * 1024 * 1024 )
+
+
+
+// header of a column allocated by `MathEvaluationAllocColumn`,
+// 64 bytes so that values stay aligned
+
+struct MathEvalColumn
+{
+    size_t                  size;       // bytes allocated, header included
+    bool                    mapped;     // true if mapped, false if allocated
+    unsigned char           reserved[ MATH_EVAL_COLUMNS_ALIGNMENT - sizeof( size_t ) - sizeof( bool ) ];
+};
+typedef struct MathEvalColumn MathEvalColumn;
+
+
+
+// the evaluations kept by a thread for
+// `MathEvaluationAcquire`
+
+#define MATH_EVAL_POOL_SIZE 32
+
+struct MathEvalPool
+{
+    size_t                  count;
+    MathEvaluation          *evals[ MATH_EVAL_POOL_SIZE ];
+};
+typedef struct MathEvalPool MathEvalPool;
+
+
+
+// a slice of the expressions compiled by `MathEvaluationNewBatch`,
+// each thread compiles the expressions `first`, `first + step`...
+
+struct MathEvalBatchJob
+{
+    const char              **expressions;
+    size_t                  count;
+    const char              **params;
+    size_t                  paramsCount;
+    MathEvaluation          **evals;
+    MathEvaluationStatus    *statuses;
+    size_t                  first;
+    size_t                  step;
+};
+typedef struct MathEvalBatchJob MathEvalBatchJob;
+
+
+
+// a named formula of a catalog: name and expression
+// point into the mapped file, the evaluation
+// is created the first time the formula is requested
+
+struct MathEvalCatalogEntry
+{
+    const char              *name;
+    size_t                  nameLength;
+    const char              *expression;
+    size_t                  expressionLength;
+    MathEvaluation          *eval;
+};
+typedef struct MathEvalCatalogEntry MathEvalCatalogEntry;
+
+
+
+struct MathEvaluationCatalog
+{
+    const char              *map;       // the catalog file, mapped read-only
+    size_t                  size;
+    MathEvalCatalogEntry    *entries;   // sorted by name
+    size_t                  count;
+    pthread_mutex_t         mutex;      // guards the creation of the evaluations
+};
+typedef struct MathEvaluationCatalog MathEvaluationCatalog;
+
+
+
 // Private functions
 
-double MathEvalProcessAddends        ( MathEvaluation *eval, int64_t breakOnRoundBracketsCount, bool breakOnETEof,
+MathEvaluation *
+       MathEvalNew                   ( const char *expression, size_t length, bool copy,
+                                       const MathEvaluationAllocator *allocator );
+void   MathEvalSetup                 ( MathEvaluation *eval, void *buffer, size_t size );
+bool   MathEvalSetExpression         ( MathEvaluation *eval, const char *expression, size_t length, bool copy );
+void  *MathEvalAlloc                 ( MathEvaluation *eval, size_t size );
+void  *MathEvalRealloc               ( MathEvaluation *eval, void *memory, size_t size );
+void  *MathEvalCalloc                ( MathEvaluation *eval, size_t count, size_t size );
+void   MathEvalFree                  ( MathEvaluation *eval, void *memory );
+void  *MathEvalArenaAlloc            ( MathEvaluation *eval, size_t size );
+void  *MathEvalArenaRealloc          ( MathEvaluation *eval, void *memory, size_t size );
+void   MathEvalArenaFree             ( MathEvaluation *eval );
+void   MathEvalArenaReset            ( MathEvaluation *eval );
+size_t MathEvalArenaUsed             ( MathEvaluation *eval );
+void   MathEvalArenaRewind           ( MathEvaluation *eval, MathEvalChunk *chunk, size_t used );
+void   MathEvalFootprint             ( MathEvaluation *eval, MathEvaluationFootprint *footprint );
+void   MathEvalAccount               ( MathEvaluation *eval, bool disposed );
+MathEvaluationStatus
+       MathEvalCompile               ( MathEvaluation *eval );
+void   MathEvalPoolInit              ( void );
+void   MathEvalPoolDispose           ( void *pool );
+void   MathEvalProcessAddends        ( MathEvaluation *eval, int64_t breakOnRoundBracketsCount, bool breakOnETEof,
                                        bool breakOnETcom, MathEvalToken *tokenThatCausedBreak );
-double MathEvalProcessFactors        ( MathEvaluation *eval, double leftValue, MathEvalToken op, bool isExponent,
-                                       MathEvalToken *leftOp );
-double MathEvalProcessFunction       ( MathEvaluation *eval, MathEvalToken func );
-double MathEvalProcessExponentiation ( MathEvaluation *eval, double base, MathEvalToken *rightOp );
-double MathEvalProcessFactorial      ( MathEvaluation *eval, double value, MathEvalToken *rightOp );
+void   MathEvalProcessFactors        ( MathEvaluation *eval, bool isExponent, MathEvalToken *leftOp );
+void   MathEvalProcessFunction       ( MathEvaluation *eval, MathEvalToken func );
+void   MathEvalProcessExponentiation ( MathEvaluation *eval, MathEvalToken *rightOp );
+void   MathEvalProcessFactorial      ( MathEvaluation *eval, MathEvalToken *rightOp );
 double MathEvalProcessToken          ( MathEvaluation *eval, MathEvalToken *token );
 double MathEvalProcessPlusToken      ( MathEvaluation *eval, MathEvalToken *token );
 double MathEvalProcessValue          ( MathEvaluation *eval );
+bool   MathEvalEmit                  ( MathEvaluation *eval, MathEvalOpcode opcode, uint32_t count, double value,
+                                       uint32_t slot );
+bool   MathEvalHashProgram           ( MathEvaluation *eval );
+int    MathEvalHashCompare           ( const void *hash1, const void *hash2 );
+uint32_t
+       MathEvalOperandsCount         ( const MathEvalNode *node );
+void   MathEvalDropResults           ( MathEvaluation *eval );
+MathEvalResultEntry *
+       MathEvalResultsFind           ( MathEvaluation *eval, bool *found );
+bool   MathEvalPrepareStack          ( MathEvaluation *eval );
+double MathEvalMemoized              ( MathEvalMemo *memo, MathEvalOpcode opcode, double argument );
+double MathEvalRun                   ( MathEvaluation *eval );
+double MathEvalRunError              ( MathEvaluation *eval, MathEvalNode *node, const char *error );
+bool   MathEvalReserveWorkspace      ( MathEvaluation *eval, size_t size );
+bool   MathEvalRunInterval           ( MathEvaluation *eval, const MathEvalInterval *bySlot, MathEvalInterval *result );
+void   MathEvalIntervalArithmetic    ( MathEvalInterval *left, const MathEvalInterval *right, MathEvalOpcode opcode );
+void   MathEvalExtend                ( MathEvalInterval *bounds, double value, double error );
+void   MathEvalWiden                 ( MathEvalInterval *interval, unsigned int ulps );
+bool   MathEvalContains              ( const MathEvalInterval *interval, double phase, double period );
+void   MathEvalIntervalPeriodic      ( MathEvalInterval *interval, MathEvalOpcode opcode );
+const char *
+       MathEvalIntervalStep          ( const MathEvalNode *node, MathEvalInterval *operands );
+bool   MathEvalAnalyze               ( MathEvaluation *eval );
+bool   MathEvalIsBounded             ( MathEvaluation *eval );
+bool   MathEvalRunBounds             ( MathEvaluation *eval, MathEvalInterval *result );
+bool   MathEvalBoundStep             ( const MathEvalNode *node, MathEvalBall *operands );
+void   MathEvalBoundLog              ( MathEvalInterval *interval );
+void   MathEvalBoundExp              ( MathEvalInterval *interval );
+bool   MathEvalRunDerivatives        ( MathEvaluation *eval, const size_t *slots, size_t lanes, double *partials, double *stack,
+                                       double *result, double *derivatives );
+const char *
+       MathEvalDerivativeStep        ( const MathEvalNode *node, double *operands, size_t lanes, double *partials );
+const char *
+       MathEvalPartials              ( const MathEvalNode *node, double *operands, size_t stride, double *partials );
+bool   MathEvalRunGradient           ( MathEvaluation *eval, double *tape, double *stack, double *result, double *gradient );
+const char *
+       MathEvalIntervalPow           ( MathEvalInterval *base, const MathEvalInterval *exponent );
+void   MathEvalIntervalFactorial     ( MathEvalInterval *interval );
+bool   MathEvalRunInteger            ( MathEvaluation *eval, double *result );
+bool   MathEvalIsInteger             ( MathEvaluation *eval );
+bool   MathEvalToInteger             ( double value, int64_t *integer );
+double MathEvalRunUnchecked          ( MathEvaluation *eval, bool *negativeFactorial );
+double MathEvalRunDeferred           ( MathEvaluation *eval );
+bool   MathEvalSaturate              ( MathEvaluation *eval, double *value );
+double MathEvalFactorial             ( double n );
+double MathEvalGamma                 ( double n );
+double MathEvalDigamma               ( double x );
+void   MathEvalApproxExp             ( double *values, size_t count, uint32_t terms, double *scratch );
+void   MathEvalApproxLog             ( double *values, size_t count, uint32_t terms, double *scratch );
+void   MathEvalApproxSin             ( const MathEvalApproximation *approximation, double *values, size_t count, bool cosine,
+                                       double *scratch );
+void   MathEvalApproxPow             ( const MathEvalApproximation *approximation, double *bases, const double *exponents,
+                                       size_t count, double *scratch );
+bool   MathEvalFitPiece              ( MathEvaluation *eval, uint32_t slot, double min, double max, double tolerance,
+                                       double *coefficients );
+double MathEvalChebyshev             ( const double *coefficients, uint32_t terms, double t );
+double MathEvalRunFit                ( MathEvaluation *eval, double x );
+void   MathEvalDropFit               ( MathEvaluation *eval );
+bool   MathEvalRunColumns            ( MathEvaluation *eval, const double **bySlot, size_t first, size_t count,
+                                       double *results, bool aligned );
+MathEvaluationStatus
+       MathEvalFailColumns           ( size_t rows, double *results, MathEvaluationStatus *statuses );
+bool   MathEvalRunFitColumns         ( MathEvaluation *eval, const double *column, size_t first, size_t count, double *results );
+double *MathEvalColumnsStack         ( MathEvaluation *eval );
+double *MathEvalColumnsScratch       ( MathEvaluation *eval );
+unsigned char *
+       MathEvalColumnsFlags          ( MathEvaluation *eval );
+void * MathEvalBatchWorker           ( void *job );
+int    MathEvalCatalogCompare        ( const void *entry1, const void *entry2 );
+MathEvalCatalogEntry *
+       MathEvalCatalogFind           ( MathEvaluationCatalog *catalog, const char *name, size_t length );
+bool   MathEvalImageVerify           ( const MathEvalImage *image, size_t size );
+uint64_t
+       MathEvalHash                  ( uint64_t hash, const void *data, size_t size );
+void   MathEvalCacheInit             ( void );
+bool   MathEvalCachePath             ( MathEvaluation *eval, char *path, size_t size );
+bool   MathEvalCacheLoad             ( MathEvaluation *eval, const char *path );
+void   MathEvalCacheStore            ( MathEvaluation *eval, const char *path );
 void   MathEvalDumpParams            ( MathEvaluation *eval );
+void   MathEvalDumpProgram           ( MathEvaluation *eval );
 
 
 
 // Exception catcher
 
-#if math_eval_catch_fp_exceptions
 #define eexception(n) (isnan(n)||(n)==HUGE_VAL||(n)==INFINITY||(n)==-HUGE_VAL||(n)==-INFINITY)
-#else
-#define eexception(n) (false)
-#endif
 
 
 #endif
@@ -10,18 +10,45 @@
 #include "matheval.h"
 
 #include <math.h>
+#include <float.h>
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
 #include <inttypes.h>
+#include <unistd.h>
+#include <dirent.h>
 
 
 
 int main( int argc, char **argv );
 void MathEvalRunTests( void );
 void MathEvalTest( int lineNumber, MathEvaluationStatus expectedStatus, double expectedResult, char *expression );
+void MathEvalTestBatch( int lineNumber, unsigned int threads );
+void MathEvalTestCatalog( int lineNumber );
+void MathEvalTestImage( int lineNumber, char *expression );
+void MathEvalTestCache( int lineNumber, char *expression );
+void MathEvalTestHash( int lineNumber, bool expectedSame, char *expression1, char *expression2 );
+void MathEvalTestError( int lineNumber, char *expression, char *expectedError, int expectedPosition );
+void MathEvalTestResultCache( int lineNumber, char *expression, size_t entries );
+void MathEvalTestInit( int lineNumber, MathEvaluationStatus expectedStatus, char *expression, size_t size );
+void MathEvalTestAllocator( int lineNumber, char *expression, int maxAllocations );
+void MathEvalTestReset( int lineNumber );
+void MathEvalTestFootprint( int lineNumber, char *expression, size_t entries );
+void MathEvalTestColumns( int lineNumber, char *expression, size_t rows, bool aligned );
+void MathEvalTestDeferred( int lineNumber, char *expression );
+void MathEvalTestApproximation( int lineNumber, char *expression, double tolerance );
+void MathEvalTestPolicy( int lineNumber, MathEvaluationErrorPolicy policy, MathEvaluationStatus expectedStatus, double expectedResult, char *expression );
+void MathEvalTestFit( int lineNumber, MathEvaluationStatus expectedStatus, char *expression, double min, double max, double tolerance );
+void MathEvalTestMemo( int lineNumber, char *expression );
+void MathEvalTestInterval( int lineNumber, MathEvaluationStatus expectedStatus, char *expression, double xLow, double xHigh, double yLow, double yHigh );
+void MathEvalTestBounds( int lineNumber, char *expression, double xMin, double xMax, double yMin, double yMax );
+void MathEvalTestCompare( int lineNumber, char *expression, double threshold );
+void MathEvalTestDerivatives( int lineNumber, MathEvaluationStatus expectedStatus, char *expression, double x, double y );
+void MathEvalTestGradient( int lineNumber, MathEvaluationStatus expectedStatus, char *expression, double x, double y, size_t gradientSize );
+void *MathEvalTestAlloc( size_t size, void *userData );
+void MathEvalTestFree( void *memory, void *userData );
 
 
 
@@ -41,6 +68,8 @@ void MathEvalRunTests( void )
     double b,
            e,
            r;
+    char   *expression;
+    int    i;
 
     // Plus and minus (unary/binary) mixing cases
 
@@ -152,6 +181,21 @@ void MathEvalRunTests( void )
     MathEvalTest( __LINE__, MathEvaluationSuccess, r,       "fact(3.456)");
     MathEvalTest( __LINE__, MathEvaluationSuccess, -24,     "-fact(4)" );
     MathEvalTest( __LINE__, MathEvaluationFailure, 0,       "(-4)!" );      // * factorial of negative number
+    MathEvalTest( __LINE__, MathEvaluationSuccess, 479001600,             "12!" );        // exact (from table)
+    MathEvalTest( __LINE__, MathEvaluationSuccess, 2.43290200817664e+18,  "20!" );
+    MathEvalTest( __LINE__, MathEvaluationSuccess, 7.257415615307999e+306, "170!" );
+    MathEvalTest( __LINE__, MathEvaluationFailure, 0,       "171!" );       // * too big
+
+    // Integer expressions (exact)
+
+    MathEvalTest( __LINE__, MathEvaluationSuccess, 1,                     "(3^39+1)-3^39" );
+    MathEvalTest( __LINE__, MathEvaluationSuccess, 4052555153018976268.0, "3^39+1" );
+    MathEvalTest( __LINE__, MathEvaluationSuccess, 1,                     "20!-(20!-1)" );
+    MathEvalTest( __LINE__, MathEvaluationSuccess, -27,                   "(-3)^3" );
+    MathEvalTest( __LINE__, MathEvaluationSuccess, 1,                     "0^0" );
+    MathEvalTest( __LINE__, MathEvaluationSuccess, 0,                     "(2^62+2^62)-2^63" );    // overflows, computed with doubles
+    MathEvalTest( __LINE__, MathEvaluationSuccess, 0.5,                   "2^-1" );                // computed with doubles
+    MathEvalTest( __LINE__, MathEvaluationSuccess, 5.109094217170944e+19, "21!" );                 // computed with doubles
     MathEvalTest( __LINE__, MathEvaluationFailure, 0,       "!" );          // *
     MathEvalTest( __LINE__, MathEvaluationFailure, 0,       "fact(-4)" );   // * factorial of negative number
     MathEvalTest( __LINE__, MathEvaluationFailure, 0,       "fact()" );     // *
@@ -252,9 +296,8 @@ void MathEvalRunTests( void )
     MathEvalTest( __LINE__, MathEvaluationFailure, 0,   "1/0" );    // * division by zero
     MathEvalTest( __LINE__, MathEvaluationFailure, 0,   "(-1)!" );  // * negative factorial
 
-    // Exceptions catched with eeval_catch_fp_exceptions set to true
+    // Exceptions catched with the strict error policy (default)
 
-    #if eeval_catch_fp_exceptions
     MathEvalTest( __LINE__, MathEvaluationFailure, 0, "(-2)^(-1/2)" );                          // * complex
     MathEvalTest( __LINE__, MathEvaluationFailure, 0, "(-3)^3.5" );                             // * complex
     MathEvalTest( __LINE__, MathEvaluationFailure, 0, "pow(-2,-1/2)");                          // * complex
@@ -266,7 +309,216 @@ void MathEvalRunTests( void )
     MathEvalTest( __LINE__, MathEvaluationFailure, 0, "max(-(9^9^9),9^9^9" );                   // * huge
     MathEvalTest( __LINE__, MathEvaluationFailure, 0, "min(-(9^9^9),9^9^9" );                   // * huge
     MathEvalTest( __LINE__, MathEvaluationFailure, 0, "pow(9,pow(9,9))" );                      // * huge
-    #endif
+
+    // Batch compilation
+
+    MathEvalTestBatch( __LINE__, 1 );
+    MathEvalTestBatch( __LINE__, 3 );
+    MathEvalTestBatch( __LINE__, 0 );   // one thread per CPU
+
+    // Catalog of formulas
+
+    MathEvalTestCatalog( __LINE__ );
+
+    // Compiled images
+
+    MathEvalTestImage( __LINE__, "x*y+avg(x,y,3)/sin(x)" );
+    MathEvalTestImage( __LINE__, "-pow(y,x)+log(2,y)" );
+    MathEvalTestImage( __LINE__, "y/(x-1)" );             // division by zero
+
+    // Structural hash
+
+    MathEvalTestHash( __LINE__, true,  "x + 2*y",               "(y*2)+x" );
+    MathEvalTestHash( __LINE__, true,  "pow(x, 2) * average(1,y)", "avg(y,1)*x^2.0" );
+    MathEvalTestHash( __LINE__, true,  "max(x,1,y)-min(y,x)",   "max(y,x,1) - ((min(x,y)))" );
+    MathEvalTestHash( __LINE__, false, "x-y",                   "y-x" );
+    MathEvalTestHash( __LINE__, false, "x/2",                   "2/x" );
+    MathEvalTestHash( __LINE__, false, "x+y+1",                 "x+1+y" );    // not reassociated
+
+    // With more errors the first one in the expression is reported
+
+    MathEvalTestError( __LINE__, "1/0+log(0-1)",    "division by zero", 4 );
+    MathEvalTestError( __LINE__, "log(0-1)+1/0",    "result is complex or too big", 8 );
+    MathEvalTestError( __LINE__, "(9^9^9)*(0-1)!",  "result is complex or too big", 7 );
+    MathEvalTestError( __LINE__, "max(1/0,(0-1)!)", "division by zero", 8 );
+    MathEvalTestError( __LINE__, "asin(2)*(1/0)",   "result is complex or too big", 7 );
+
+    // Result cache
+
+    MathEvalTestResultCache( __LINE__, "x^y/(x-y)+sin(x)!", 1 );
+    MathEvalTestResultCache( __LINE__, "x^y/(x-y)+sin(x)!", 16 );
+    MathEvalTestResultCache( __LINE__, "x^y/(x-y)+sin(x)!", 1000 );
+
+    // Compile cache
+
+    MathEvalTestCache( __LINE__, "x^3-2*y+max(x,y)" );
+
+    // Caller provided storage
+
+    MathEvalTestInit( __LINE__, MathEvaluationSuccess, "x^y/(x-y)+sin(x)!", 4096 );
+    MathEvalTestInit( __LINE__, MathEvaluationSuccess, "max(x,y,1,2,3)*avg(y,x)-log(2,x)", 4096 );
+    MathEvalTestInit( __LINE__, MathEvaluationFailure, "x^y/(x-y)+sin(x)!", 160 );      // buffer too small
+    MathEvalTestInit( __LINE__, MathEvaluationFailure, "x^y/(x-y)+sin(x)!", 8 );
+
+    // Caller allocator
+
+    MathEvalTestAllocator( __LINE__, "x^y/(x-y)+sin(x)!", 8 );     // struct, arena, values, stack and compile temporaries
+    MathEvalTestAllocator( __LINE__, "max(x,y,1,2,3)*avg(y,x)-log(2,x)+x*x*x*x*y*y*y*y*(x+y)*(x-y)", 8 );
+
+    // Long expressions: 20001 nodes
+
+    expression = malloc( 10000 * 4 + 1 );
+    for( i = 0; i < 10000; i++ )
+    {
+        memcpy( expression + i * 4, i % 2 ? "-0.5" : "+1.5", 4 );
+    }
+    expression[ 10000 * 4 ] = '\0';
+    MathEvalTest( __LINE__, MathEvaluationSuccess, 5000, expression );
+    free( expression );
+
+    // Memory footprint
+
+    MathEvalTestFootprint( __LINE__, "x^y/(x-y)+sin(x)!", 0 );
+    MathEvalTestFootprint( __LINE__, "max(x,y,1,2,3)*avg(y,x)-log(2,x)", 100 );
+
+    // Reset and pool
+
+    MathEvalTestReset( __LINE__ );
+
+    // Column evaluation
+
+    MathEvalTestColumns( __LINE__, "x^y/(x-y)+sin(x)!", 1000, true );
+    MathEvalTestColumns( __LINE__, "x^y/(x-y)+sin(x)!", 1000, false );
+    MathEvalTestColumns( __LINE__, "max(x,y,1,2,3)*avg(y,x)-log(2,x)+z", 300000, true );     // huge pages
+    MathEvalTestColumns( __LINE__, "-x*y+log(y)-(x-2)!", 77, false );
+    MathEvalTestColumns( __LINE__, "x+", 10, false );                                       // syntax error
+    MathEvalTestColumns( __LINE__, "(x*y*10)!+(y*0.37+x*x*20)!", 1000, true );              // table and gamma approximation
+    MathEvalTestColumns( __LINE__, "x^3*7-(x+2)!+x*y", 1000, false );                        // rows with integers
+
+    // Deferred checks
+
+    MathEvalTestDeferred( __LINE__, "x^y/(x-y)+sin(x)!" );
+    MathEvalTestDeferred( __LINE__, "1/(x+1)" );                 // infinite parameter
+    MathEvalTestDeferred( __LINE__, "(x-1)!+max(x,y)" );
+    MathEvalTestDeferred( __LINE__, "log(x)*asin(y)-exp(x*300)" );
+    MathEvalTestDeferred( __LINE__, "log(y,x)+tan(x)/avg(x,y)" );
+    MathEvalTestDeferred( __LINE__, "exp(log(x))" );             // memoized log(0)
+    MathEvalTestDeferred( __LINE__, "1/exp(x)" );                // memoized overflow
+
+    // Approximated functions
+
+    MathEvalTestApproximation( __LINE__, "exp(x)", 1e-6 );
+    MathEvalTestApproximation( __LINE__, "-exp(x*y*40)", 1e-9 );     // overflows
+    MathEvalTestApproximation( __LINE__, "log(y)", 1e-6 );           // log(0)
+    MathEvalTestApproximation( __LINE__, "log(x)", 1e-3 );           // negative numbers
+    MathEvalTestApproximation( __LINE__, "sin(x*10)", 1e-6 );
+    MathEvalTestApproximation( __LINE__, "cos(x*y*1e5)", 1e-6 );     // reduction left to cos
+    MathEvalTestApproximation( __LINE__, "y^(x/3)", 1e-9 );
+    MathEvalTestApproximation( __LINE__, "(x-2)^3", 1e-12 );         // negative bases
+    MathEvalTestApproximation( __LINE__, "log(y,x+4)", 1e-6 );
+
+    // Error policies
+
+    MathEvalTestPolicy( __LINE__, MathEvaluationStrict,    MathEvaluationFailure, 0,         "9^9^9" );
+    MathEvalTestPolicy( __LINE__, MathEvaluationPropagate, MathEvaluationSuccess, INFINITY,  "9^9^9" );
+    MathEvalTestPolicy( __LINE__, MathEvaluationPropagate, MathEvaluationSuccess, -INFINITY, "-1/0" );
+    MathEvalTestPolicy( __LINE__, MathEvaluationPropagate, MathEvaluationSuccess, NAN,       "(-2)^0.5+1" );
+    MathEvalTestPolicy( __LINE__, MathEvaluationPropagate, MathEvaluationSuccess, NAN,       "(-1)!" );
+    MathEvalTestPolicy( __LINE__, MathEvaluationPropagate, MathEvaluationSuccess, 0,         "1/(9^9^9)" );
+    MathEvalTestPolicy( __LINE__, MathEvaluationPropagate, MathEvaluationFailure, 0,         "1/(2" );     // syntax errors are still errors
+    MathEvalTestPolicy( __LINE__, MathEvaluationSaturate,  MathEvaluationSuccess, DBL_MAX,   "9^9^9" );
+    MathEvalTestPolicy( __LINE__, MathEvaluationSaturate,  MathEvaluationSuccess, -DBL_MAX,  "-1/0" );
+    MathEvalTestPolicy( __LINE__, MathEvaluationSaturate,  MathEvaluationSuccess, 0,         "9^9^9-9^9^9" );
+    MathEvalTestPolicy( __LINE__, MathEvaluationSaturate,  MathEvaluationSuccess, 1,         "max(-(9^9^9),1)" );
+    MathEvalTestPolicy( __LINE__, MathEvaluationSaturate,  MathEvaluationFailure, 0,         "0/0" );
+    MathEvalTestPolicy( __LINE__, MathEvaluationSaturate,  MathEvaluationFailure, 0,         "(-2)^0.5" );
+    MathEvalTestPolicy( __LINE__, MathEvaluationSaturate,  MathEvaluationFailure, 0,         "(-1)!" );
+
+    // Fitted expressions
+
+    MathEvalTestFit( __LINE__, MathEvaluationSuccess, "sin(x)*exp(-x/4)", -3, 7, 1e-9 );
+    MathEvalTestFit( __LINE__, MathEvaluationSuccess, "x^3-y*x+1", -2, 2, 1e-12 );        // a polynomial is exact
+    MathEvalTestFit( __LINE__, MathEvaluationSuccess, "log(x)+x^0.5", 0.01, 100, 1e-7 );   // many pieces
+    MathEvalTestFit( __LINE__, MathEvaluationSuccess, "x!/y", 0, 5, 1e-8 );
+    MathEvalTestFit( __LINE__, MathEvaluationSuccess, "exp(sin(x*3))*y", 0, 1, 1e-3 );
+    MathEvalTestFit( __LINE__, MathEvaluationFailure, "1/x", -1, 1, 1e-6 );               // division by zero
+    MathEvalTestFit( __LINE__, MathEvaluationFailure, "log(x)", -1, 1, 1e-6 );
+    MathEvalTestFit( __LINE__, MathEvaluationFailure, "x", 1, 1, 1e-6 );                  // invalid domain
+    MathEvalTestFit( __LINE__, MathEvaluationFailure, "x", 0, 1, 0 );                     // invalid tolerance
+
+    // Memoized functions
+
+    MathEvalTestMemo( __LINE__, "sin(x)*y+cos(x)/y" );
+    MathEvalTestMemo( __LINE__, "exp(x*2)-log(y)+x!" );
+    MathEvalTestMemo( __LINE__, "1/sin(x)+y" );                  // sin(0) and sin(-0) differ
+    MathEvalTestMemo( __LINE__, "sin(x)+sin(y)+sin(x+y)" );
+    MathEvalTestMemo( __LINE__, "log(y-1)+(x-1)!" );             // failures
+    MathEvalTestMemo( __LINE__, "exp(log(x))" );                 // log(0)
+    MathEvalTestMemo( __LINE__, "1/exp(x*1000)" );               // overflows
+
+    // Intervals
+
+    MathEvalTestInterval( __LINE__, MathEvaluationSuccess, "x*y-x/y+x^2", -2, 3, 0.5, 4 );
+    MathEvalTestInterval( __LINE__, MathEvaluationSuccess, "sin(x)+cos(y)", 1, 2, 3, 7 );        // maximum of sin, cos
+    MathEvalTestInterval( __LINE__, MathEvaluationSuccess, "sin(x*y)", -10, 10, 1, 2 );          // more than a period
+    MathEvalTestInterval( __LINE__, MathEvaluationSuccess, "tan(x)*atan(y)", -1.5, 1.5, -9, 9 );
+    MathEvalTestInterval( __LINE__, MathEvaluationSuccess, "x^y", 0, 2, -0, 3 );
+    MathEvalTestInterval( __LINE__, MathEvaluationSuccess, "x^3+(x-1)^2+(y-2)^-2", -2, 2, 3, 4 ); // negative bases
+    MathEvalTestInterval( __LINE__, MathEvaluationSuccess, "x!+y!", 0, 1, 3, 12 );               // minimum of Gamma
+    MathEvalTestInterval( __LINE__, MathEvaluationSuccess, "exp(x)-log(y)+log(y+2,x+4)", -2, 1, 0.1, 9 );
+    MathEvalTestInterval( __LINE__, MathEvaluationSuccess, "asin(x/2)+acos(y/12)", -2, 2, 0, 12 );
+    MathEvalTestInterval( __LINE__, MathEvaluationSuccess, "max(x,y,1)-min(x,-y)+avg(x,y)", -5, 5, -1, 3 );
+    MathEvalTestInterval( __LINE__, MathEvaluationFailure, "1/x", -1, 1, 0, 0 );                 // division by zero
+    MathEvalTestInterval( __LINE__, MathEvaluationFailure, "log(x)", -1, 1, 0, 0 );
+    MathEvalTestInterval( __LINE__, MathEvaluationFailure, "x^0.5", -1, 1, 0, 0 );
+    MathEvalTestInterval( __LINE__, MathEvaluationFailure, "(x-1)!", 0, 2, 0, 0 );
+    MathEvalTestInterval( __LINE__, MathEvaluationFailure, "tan(x)", 1, 2, 0, 0 );                 // pole
+    MathEvalTestInterval( __LINE__, MathEvaluationFailure, "x", 1, 0, 0, 0 );                      // invalid interval
+
+    // Bounds of the parameters
+
+    MathEvalTestBounds( __LINE__, "x!/y+exp(x)*sin(y)", 0, 10, 1, 3 );       // no check is needed
+    MathEvalTestBounds( __LINE__, "1/(x-1)+log(y)", 2, 5, -1, 1 );          // log(y) is still checked
+    MathEvalTestBounds( __LINE__, "(x-y)!+x^y", 0, 4, 0, 4 );               // negative factorials
+    MathEvalTestBounds( __LINE__, "exp(x*y)", -1e3, 1e3, 0, 1 );            // overflows
+    MathEvalTestBounds( __LINE__, "x/y", -1, 1, -1, 1 );                    // division by zero
+
+    // Threshold queries
+
+    MathEvalTestCompare( __LINE__, "x*100+sin(y)-cos(x)", 50 );
+    MathEvalTestCompare( __LINE__, "exp(x)-log(y+4)*x", 2 );
+    MathEvalTestCompare( __LINE__, "(y+4)^x+atan(y)-asin(x/4)", 1 );
+    MathEvalTestCompare( __LINE__, "x^y+tan(x)", 0 );                      // negative bases
+    MathEvalTestCompare( __LINE__, "log(x)+1/sin(y)", -1 );               // failures
+    MathEvalTestCompare( __LINE__, "exp(x*300)", 1e100 );                  // overflows
+    MathEvalTestCompare( __LINE__, "x*y+3", 3 );                           // results equal to the threshold
+    MathEvalTestCompare( __LINE__, "max(x,y,1)/(y-3)+(x+3)!", 4 );
+    MathEvalTestCompare( __LINE__, "x*y+sin(x)", 0.5 );                    // bounds often not enough
+    MathEvalTestCompare( __LINE__, "exp(x)-log(y+4)*x+cos(y)", 2 );
+
+    // Derivatives
+
+    MathEvalTestDerivatives( __LINE__, MathEvaluationSuccess, "x*y-x/y+3*x^2", 1.5, -2 );
+    MathEvalTestDerivatives( __LINE__, MathEvaluationSuccess, "sin(x)*cos(y)+tan(x/3)", 0.7, 2.1 );
+    MathEvalTestDerivatives( __LINE__, MathEvaluationSuccess, "asin(x/2)-acos(y/3)+atan(x*y)", 0.4, -1.2 );
+    MathEvalTestDerivatives( __LINE__, MathEvaluationSuccess, "exp(-x*x)*log(y)+log(x,y)", 1.3, 2.5 );
+    MathEvalTestDerivatives( __LINE__, MathEvaluationSuccess, "x^y+y^2.5-(-x)", 1.7, 0.6 );
+    MathEvalTestDerivatives( __LINE__, MathEvaluationSuccess, "x!+(x*y)!", 2.3, 1.1 );
+    MathEvalTestDerivatives( __LINE__, MathEvaluationSuccess, "3!*x+max(x,y,1)-min(x*2,y)+avg(x,y,x*y)", 0.3, 0.8 );
+    MathEvalTestDerivatives( __LINE__, MathEvaluationSuccess, "0^y+x^2", 0, 2 );               // 0^y and x^2 at 0
+    MathEvalTestDerivatives( __LINE__, MathEvaluationFailure, "x^0.5", 0, 1 );                 // infinite derivative
+    MathEvalTestDerivatives( __LINE__, MathEvaluationFailure, "x/(y-1)", 1, 1 );               // division by zero
+    MathEvalTestDerivatives( __LINE__, MathEvaluationFailure, "(x-3)!", 1, 1 );                // factorial of negative number
+
+    // Gradients
+
+    MathEvalTestGradient( __LINE__, MathEvaluationSuccess, "x*y-x/y+3*x^2", 1.5, -2, 2 );
+    MathEvalTestGradient( __LINE__, MathEvaluationSuccess, "sin(x)*cos(y)+tan(x/3)+atan(x*y)", 0.7, 2.1, 2 );
+    MathEvalTestGradient( __LINE__, MathEvaluationSuccess, "exp(-x*x)*log(y)+log(x,y)+x^y", 1.3, 2.5, 2 );
+    MathEvalTestGradient( __LINE__, MathEvaluationSuccess, "x!*y+max(x,y,1)-min(x*2,y)+avg(x,y,x*y)", 0.3, 0.8, 3 );
+    MathEvalTestGradient( __LINE__, MathEvaluationSuccess, "(x*x*y)^0.5+0^y", 0, 2, 2 );       // 0 partials
+    MathEvalTestGradient( __LINE__, MathEvaluationFailure, "x^0.5", 0, 1, 2 );                 // infinite derivative
+    MathEvalTestGradient( __LINE__, MathEvaluationFailure, "x+y", 0, 1, 1 );                   // gradient too small
 
     // All tests passed
 
@@ -303,4 +555,1436 @@ void MathEvalTest( int lineNumber, MathEvaluationStatus expectedStatus, double e
         printf( "\n" );
     }
     MathEvaluationDispose( matheval );
-}
\ No newline at end of file
+}
+
+
+
+//
+// Test function: compile a set of expressions with `MathEvaluationNewBatch()`
+// and compare statuses and results (parameters x = 2, y = 3) with the expected ones.
+//
+
+void MathEvalTestBatch( int lineNumber, unsigned int threads )
+{
+    const char *expressions[] = { "x+y", "x*(y", "pow(x,y)-1", "z", "max(x,y)*2", "x/(y-3)", "y!" };
+    const char *params[] = { "x", "y" };
+
+    MathEvaluationStatus expectedStatuses[] = { MathEvaluationSuccess, MathEvaluationFailure, MathEvaluationSuccess, MathEvaluationFailure,
+                                                MathEvaluationSuccess, MathEvaluationSuccess, MathEvaluationSuccess };
+    double expectedResults[] = { 5, 0, 7, 0, 6, 0, 6 };
+
+    MathEvaluation       *evals[ 7 ];
+    MathEvaluationStatus statuses[ 7 ],
+                         status;
+    double               result;
+    int                  i;
+
+    status = MathEvaluationNewBatch( expressions, 7, params, 2, threads, evals, statuses );
+    if( status != MathEvaluationFailure )
+    {
+        printf( "Test at line number %d failed\n\n", lineNumber );
+        printf( "Batch status is success but some expressions are invalid\n\n" );
+    }
+
+    for( i = 0; i < 7; i++ )
+    {
+        if( statuses[ i ] != expectedStatuses[ i ] )
+        {
+            printf( "Test at line number %d failed\n\n", lineNumber );
+            printf( "Expression: %s\n\n", expressions[ i ] );
+            printf( "Expected compilation status is: %s\n\n", expectedStatuses[ i ] == MathEvaluationSuccess ? "success" : "failure" );
+        }
+
+        // x / ( y - 3 ) compiles but fails when evaluated
+
+        MathEvaluationSetParam( evals[ i ], "x", 2 );
+        MathEvaluationSetParam( evals[ i ], "y", 3 );
+
+        result = 0;
+        MathEvaluationPerform( evals[ i ], &result );
+        if( result != expectedResults[ i ] )
+        {
+            printf( "Test at line number %d failed\n\n", lineNumber );
+            printf( "Expression: %s\n\n", expressions[ i ] );
+            printf( "Expected result is: %f\n", expectedResults[ i ] );
+            printf( "Test     result is: %f\n\n", result );
+        }
+
+        MathEvaluationDispose( evals[ i ] );
+    }
+}
+
+
+
+//
+// Test function: open a catalog file and evaluate its formulas by name.
+//
+
+void MathEvalTestCatalog( int lineNumber )
+{
+    const char *content =
+        "# test catalog\n"
+        "\n"
+        "square = x^2\n"
+        "  hyp=pow(x^2+y^2, .5)\r\n"
+        "broken = 1+\n"
+        "answer = 42";
+
+    MathEvaluationCatalog *catalog;
+    MathEvaluation        *eval;
+    char                  path[] = "/tmp/matheval-test-XXXXXX";
+    double                result;
+    int                   fd;
+
+    fd = mkstemp( path );
+    if( fd < 0 || write( fd, content, strlen( content ) ) != (ssize_t) strlen( content ) )
+    {
+        printf( "Test at line number %d failed\n\ncannot write %s\n\n", lineNumber, path );
+        return;
+    }
+    close( fd );
+
+    catalog = MathEvaluationCatalogOpen( path );
+    unlink( path );
+
+    if( ! catalog || MathEvaluationCatalogCount( catalog ) != 4 )
+    {
+        printf( "Test at line number %d failed\n\ncatalog not indexed\n\n", lineNumber );
+        return;
+    }
+
+    eval = MathEvaluationCatalogGet( catalog, "hyp" );
+    MathEvaluationSetParam( eval, "x", 3 );
+    MathEvaluationSetParam( eval, "y", 4 );
+    if( eval != MathEvaluationCatalogGet( catalog, "hyp" ) || MathEvaluationPerform( eval, &result ) != MathEvaluationSuccess || result != 5 )
+    {
+        printf( "Test at line number %d failed\n\nformula `hyp` not evaluated\n\n", lineNumber );
+    }
+
+    eval = MathEvaluationCatalogGet( catalog, "answer" );
+    if( MathEvaluationPerform( eval, &result ) != MathEvaluationSuccess || result != 42 )
+    {
+        printf( "Test at line number %d failed\n\nformula `answer` not evaluated\n\n", lineNumber );
+    }
+
+    eval = MathEvaluationCatalogGet( catalog, "broken" );
+    if( MathEvaluationPerform( eval, &result ) != MathEvaluationFailure )
+    {
+        printf( "Test at line number %d failed\n\nformula `broken` evaluated\n\n", lineNumber );
+    }
+
+    if( MathEvaluationCatalogGet( catalog, "missing" ) || MathEvaluationCatalogGet( catalog, "squar" ) )
+    {
+        printf( "Test at line number %d failed\n\nmissing formula found\n\n", lineNumber );
+    }
+
+    MathEvaluationCatalogClose( catalog );
+}
+
+
+
+//
+// Test function: write the image of the expression (parameters x = 1, y = 2),
+// load it back and compare status and result with those of the original.
+//
+
+void MathEvalTestImage( int lineNumber, char *expression )
+{
+    MathEvaluation       *original,
+                         *loaded;
+    MathEvaluationStatus status,
+                         loadedStatus;
+    double               result,
+                         loadedResult;
+    void                 *image;
+    size_t               size,
+                         imageSize;
+
+    original = MathEvaluationNew( expression );
+    MathEvaluationSetParam( original, "x", 1 );
+    MathEvaluationSetParam( original, "y", 2 );
+    status = MathEvaluationPerform( original, &result );
+
+    size = MathEvaluationWriteImage( original, NULL, 0 );
+    image = malloc( size );
+    MathEvaluationWriteImage( original, image, size );
+
+    loaded = MathEvaluationNewFromImage( image, size, &imageSize );
+    if( ! loaded || imageSize != size )
+    {
+        printf( "Test at line number %d failed\n\nExpression: %s\n\nimage not loaded\n\n", lineNumber, expression );
+        return;
+    }
+
+    MathEvaluationSetParam( loaded, "x", 1 );
+    MathEvaluationSetParam( loaded, "y", 2 );
+    loadedStatus = MathEvaluationPerform( loaded, &loadedResult );
+
+    if( loadedStatus != status || loadedResult != result )
+    {
+        printf( "Test at line number %d failed\n\nExpression: %s\n\n", lineNumber, expression );
+        printf( "Expected result is: %f\n", result );
+        printf( "Test     result is: %f\n\n", loadedResult );
+    }
+
+    // a truncated image is rejected
+
+    if( MathEvaluationNewFromImage( image, size - 8, NULL ) )
+    {
+        printf( "Test at line number %d failed\n\nExpression: %s\n\ntruncated image loaded\n\n", lineNumber, expression );
+    }
+
+    MathEvaluationDispose( loaded );
+    MathEvaluationDispose( original );
+    free( image );
+}
+
+
+
+//
+// Test function: compile the expression (parameters x = 1, y = 2) twice
+// with the compile cache enabled, the second time the program is loaded
+// from the cache; compare the results and check the cache file exists.
+//
+
+void MathEvalTestCache( int lineNumber, char *expression )
+{
+    MathEvaluation *eval;
+    char           directory[] = "/tmp/matheval-cache-XXXXXX",
+                   path[ 1024 ];
+    double         results[ 2 ];
+    int            files,
+                   i;
+    DIR            *dir;
+    struct dirent  *entry;
+
+    if( ! mkdtemp( directory ) )
+    {
+        printf( "Test at line number %d failed\n\ncannot create %s\n\n", lineNumber, directory );
+        return;
+    }
+
+    MathEvaluationSetCacheDirectory( directory );
+
+    for( i = 0; i < 2; i++ )
+    {
+        eval = MathEvaluationNew( expression );
+        MathEvaluationSetParam( eval, "x", 1 );
+        MathEvaluationSetParam( eval, "y", 2 );
+        results[ i ] = 0;
+        MathEvaluationPerform( eval, &results[ i ] );
+        MathEvaluationDispose( eval );
+    }
+
+    MathEvaluationSetCacheDirectory( NULL );
+
+    // remove the cache
+
+    files = 0;
+    dir = opendir( directory );
+    while( dir && ( entry = readdir( dir ) ) )
+    {
+        if( entry->d_name[ 0 ] != '.' )
+        {
+            snprintf( path, sizeof( path ), "%s/%s", directory, entry->d_name );
+            unlink( path );
+            files++;
+        }
+    }
+    if( dir ) closedir( dir );
+    rmdir( directory );
+
+    if( files != 1 || results[ 0 ] != -1 || results[ 1 ] != -1 )
+    {
+        printf( "Test at line number %d failed\n\nExpression: %s\n\n", lineNumber, expression );
+        printf( "Cache files: %d\n", files );
+        printf( "Results: %f %f\n\n", results[ 0 ], results[ 1 ] );
+    }
+}
+
+
+
+//
+// Test function: compare the structural hashes of two expressions
+// (parameters x = 3, y = 5), equivalent expressions must have the same
+// hash and the same result.
+//
+
+void MathEvalTestHash( int lineNumber, bool expectedSame, char *expression1, char *expression2 )
+{
+    MathEvaluation *eval1,
+                   *eval2;
+    uint64_t       hash1,
+                   hash2;
+    double         result1,
+                   result2;
+
+    eval1 = MathEvaluationNew( expression1 );
+    eval2 = MathEvaluationNew( expression2 );
+    MathEvaluationSetParam( eval1, "x", 3 );
+    MathEvaluationSetParam( eval1, "y", 5 );
+    MathEvaluationSetParam( eval2, "y", 5 );    // different slots
+    MathEvaluationSetParam( eval2, "x", 3 );
+
+    MathEvaluationGetHash( eval1, &hash1 );
+    MathEvaluationGetHash( eval2, &hash2 );
+    MathEvaluationPerform( eval1, &result1 );
+    MathEvaluationPerform( eval2, &result2 );
+
+    if( ( hash1 == hash2 ) != expectedSame || ( expectedSame && result1 != result2 ) )
+    {
+        printf( "Test at line number %d failed\n\n", lineNumber );
+        printf( "Expressions: %s  %s\n\n", expression1, expression2 );
+        printf( "Expected hashes are: %s\n\n", expectedSame ? "same" : "different" );
+    }
+
+    MathEvaluationDispose( eval1 );
+    MathEvaluationDispose( eval2 );
+}
+
+
+
+//
+// Test function: evaluate an expression with more than one error,
+// the reported error and its position must be those of the first
+// error in the expression.
+//
+
+void MathEvalTestError( int lineNumber, char *expression, char *expectedError, int expectedPosition )
+{
+    MathEvaluation       *matheval;
+    MathEvaluationStatus status;
+    const char           *error;
+    double               result;
+    int                  position;
+
+    matheval = MathEvaluationNew( expression );
+    status = MathEvaluationPerform( matheval, &result );
+    error = MathEvaluationGetError( matheval, &position );
+
+    if( status != MathEvaluationFailure || ! error || strcmp( error, expectedError ) != 0 || position != expectedPosition )
+    {
+        printf( "Test at line number %d failed\n\n", lineNumber );
+        printf( "Expression: %s\n\n", expression );
+        printf( "Expected error is: %s at %d\n", expectedError, expectedPosition );
+        printf( "Test     error is: %s at %d\n\n", error ? error : "none", position );
+    }
+
+    MathEvaluationDispose( matheval );
+}
+
+
+
+//
+// Test function: evaluate the expression for repeated combinations
+// of parameters x and y with and without the result cache, statuses,
+// results and errors must be the same.
+//
+
+void MathEvalTestResultCache( int lineNumber, char *expression, size_t entries )
+{
+    MathEvaluation       *cached,
+                         *uncached;
+    MathEvaluationStatus status,
+                         cachedStatus;
+    double               result,
+                         cachedResult;
+    int                  position,
+                         cachedPosition,
+                         i;
+
+    cached = MathEvaluationNew( expression );
+    uncached = MathEvaluationNew( expression );
+    MathEvaluationSetResultCache( cached, entries );
+
+    for( i = 0; i < 200; i++ )
+    {
+        MathEvaluationSetParam( cached, "x", i % 7 );
+        MathEvaluationSetParam( cached, "y", i % 5 );
+        MathEvaluationSetParam( uncached, "x", i % 7 );
+        MathEvaluationSetParam( uncached, "y", i % 5 );
+
+        status = MathEvaluationPerform( uncached, &result );
+        cachedStatus = MathEvaluationPerform( cached, &cachedResult );
+
+        if( status != cachedStatus || result != cachedResult ||
+            MathEvaluationGetError( uncached, &position ) != MathEvaluationGetError( cached, &cachedPosition ) || position != cachedPosition )
+        {
+            printf( "Test at line number %d failed\n\n", lineNumber );
+            printf( "Expression: %s with x = %d, y = %d\n\n", expression, i % 7, i % 5 );
+            printf( "Expected result is: %f\n", result );
+            printf( "Test     result is: %f\n\n", cachedResult );
+            break;
+        }
+    }
+
+    MathEvaluationDispose( cached );
+    MathEvaluationDispose( uncached );
+}
+
+
+
+//
+// Test function: an evaluation initialized in a local buffer
+// must give the same results of one allocated on the heap,
+// or fail if the buffer is too small.
+//
+
+void MathEvalTestInit( int lineNumber, MathEvaluationStatus expectedStatus, char *expression, size_t size )
+{
+    MathEvaluation       local,
+                         *heap;
+    MathEvaluationStatus status,
+                         localStatus;
+    double               result,
+                         localResult;
+    unsigned char        buffer[ 4096 ];
+    int                  position,
+                         i;
+
+    heap = MathEvaluationNew( expression );
+    localStatus = MathEvaluationInit( &local, expression, buffer, size );
+    MathEvaluationSetResultCache( &local, 4 );
+
+    for( i = 0; i < 20 && localStatus; i++ )
+    {
+        MathEvaluationSetParam( heap, "x", i % 7 );
+        MathEvaluationSetParam( heap, "y", i % 5 );
+        localStatus = MathEvaluationSetParam( &local, "x", i % 7 );
+        if( localStatus ) localStatus = MathEvaluationSetParam( &local, "y", i % 5 );
+        if( ! localStatus ) break;
+
+        status = MathEvaluationPerform( heap, &result );
+        localStatus = MathEvaluationPerform( &local, &localResult );
+
+        if( status != localStatus || ( status && result != localResult ) )
+        {
+            break;
+        }
+
+        localStatus = MathEvaluationSuccess;
+    }
+
+    if( localStatus != expectedStatus || ( expectedStatus == MathEvaluationFailure && strcmp( MathEvaluationGetError( &local, &position ), "cannot allocate memory" ) ) )
+    {
+        printf( "Test at line number %d failed\n\n", lineNumber );
+        printf( "Expression: %s with a buffer of %zu bytes\n\n", expression, size );
+        printf( "Expected status is: %s\n", expectedStatus ? "success" : "failure" );
+        printf( "Test     status is: %s\n\n", localStatus ? "success" : "failure" );
+    }
+
+    MathEvaluationDispose( &local );
+    MathEvaluationDispose( heap );
+}
+
+
+
+//
+// Test function: an evaluation built with a caller allocator
+// must give the same results of one allocated on the heap,
+// take few blocks from the allocator and release them all.
+//
+
+void *MathEvalTestAlloc( size_t size, void *userData )
+{
+    ( (int *) userData )[ 0 ]++;
+    return malloc( size );
+}
+
+
+
+void MathEvalTestFree( void *memory, void *userData )
+{
+    ( (int *) userData )[ 1 ]++;
+    free( memory );
+}
+
+
+
+void MathEvalTestAllocator( int lineNumber, char *expression, int maxAllocations )
+{
+    MathEvaluationAllocator
+                         allocator;
+    MathEvaluation       *custom,
+                         *heap;
+    MathEvaluationStatus status,
+                         customStatus;
+    double               result,
+                         customResult;
+    int                  counts[ 2 ],
+                         i;
+
+    counts[ 0 ] = 0;
+    counts[ 1 ] = 0;
+
+    allocator.alloc = MathEvalTestAlloc;
+    allocator.free = MathEvalTestFree;
+    allocator.userData = counts;
+
+    heap = MathEvaluationNew( expression );
+    custom = MathEvaluationNewWithAllocator( expression, &allocator );
+
+    for( i = 0; i < 20; i++ )
+    {
+        MathEvaluationSetParam( heap, "x", i % 7 );
+        MathEvaluationSetParam( heap, "y", i % 5 );
+        MathEvaluationSetParam( custom, "x", i % 7 );
+        MathEvaluationSetParam( custom, "y", i % 5 );
+
+        status = MathEvaluationPerform( heap, &result );
+        customStatus = MathEvaluationPerform( custom, &customResult );
+
+        if( status != customStatus || ( status && result != customResult ) )
+        {
+            printf( "Test at line number %d failed\n\n", lineNumber );
+            printf( "Expression: %s with x = %d, y = %d\n\n", expression, i % 7, i % 5 );
+            printf( "Expected result is: %f\n", result );
+            printf( "Test     result is: %f\n\n", customResult );
+            break;
+        }
+    }
+
+    MathEvaluationDispose( custom );
+    MathEvaluationDispose( heap );
+
+    if( counts[ 0 ] > maxAllocations || counts[ 0 ] != counts[ 1 ] )
+    {
+        printf( "Test at line number %d failed\n\n", lineNumber );
+        printf( "Expression: %s\n\n", expression );
+        printf( "Allocations: %d (at most %d expected), releases: %d\n\n", counts[ 0 ], maxAllocations, counts[ 1 ] );
+    }
+}
+
+
+
+//
+// Test function: evaluations reset (or taken from the pool)
+// with other expressions must give the same results of new
+// ones and, once warmed up, must not allocate memory.
+//
+
+void MathEvalTestReset( int lineNumber )
+{
+    MathEvaluationAllocator
+                         allocator;
+    MathEvaluation       *reused,
+                         *pooled,
+                         *heap;
+    MathEvaluationStatus status,
+                         reusedStatus,
+                         pooledStatus;
+    double               result,
+                         reusedResult,
+                         pooledResult;
+    int                  counts[ 2 ],
+                         allocations,
+                         i;
+    char                 *expressions[] = { "x^y/(x-y)+sin(x)!", "max(x,y,1,2,3)*avg(y,x)-log(2,x)", "x", "(x+y)*(x-y)/7" };
+
+    counts[ 0 ] = 0;
+    counts[ 1 ] = 0;
+
+    allocator.alloc = MathEvalTestAlloc;
+    allocator.free = MathEvalTestFree;
+    allocator.userData = counts;
+
+    reused = MathEvaluationNewWithAllocator( "1", &allocator );
+    allocations = 0;
+
+    for( i = 0; i < 40; i++ )
+    {
+        if( i == 8 )
+        {
+            allocations = counts[ 0 ];
+        }
+
+        heap = MathEvaluationNew( expressions[ i % 4 ] );
+        pooled = MathEvaluationAcquire( expressions[ i % 4 ] );
+        MathEvaluationReset( reused, expressions[ i % 4 ] );
+
+        MathEvaluationSetParam( heap, "x", i % 7 );
+        MathEvaluationSetParam( heap, "y", i % 5 );
+        MathEvaluationSetParam( pooled, "x", i % 7 );
+        MathEvaluationSetParam( pooled, "y", i % 5 );
+        MathEvaluationSetParam( reused, "x", i % 7 );
+        MathEvaluationSetParam( reused, "y", i % 5 );
+
+        status = MathEvaluationPerform( heap, &result );
+        pooledStatus = MathEvaluationPerform( pooled, &pooledResult );
+        reusedStatus = MathEvaluationPerform( reused, &reusedResult );
+
+        MathEvaluationDispose( heap );
+        MathEvaluationRelease( pooled );
+
+        if( status != pooledStatus || status != reusedStatus || ( status && ( result != pooledResult || result != reusedResult ) ) )
+        {
+            printf( "Test at line number %d failed\n\n", lineNumber );
+            printf( "Expression: %s with x = %d, y = %d\n\n", expressions[ i % 4 ], i % 7, i % 5 );
+            printf( "Expected result is: %f\n", result );
+            printf( "Test     result is: %f (reset), %f (pool)\n\n", reusedResult, pooledResult );
+            break;
+        }
+    }
+
+    MathEvaluationDispose( reused );
+
+    if( counts[ 0 ] != allocations || counts[ 0 ] != counts[ 1 ] )
+    {
+        printf( "Test at line number %d failed\n\n", lineNumber );
+        printf( "Allocations after warm up: %d, releases: %d\n\n", counts[ 0 ] - allocations, counts[ 1 ] );
+    }
+}
+
+
+
+//
+// Test function: the footprint of an evaluation must add up
+// and be reflected in the totals of the process.
+//
+
+void MathEvalTestFootprint( int lineNumber, char *expression, size_t entries )
+{
+    MathEvaluationFootprint
+                   before,
+                   after,
+                   footprint,
+                   disposed,
+                   emptied,
+                   current;
+    MathEvaluation *matheval;
+    double         result;
+    bool           failed;
+    int            change;
+
+    MathEvaluationGetTotalFootprint( &before );
+
+    matheval = MathEvaluationNew( expression );
+    MathEvaluationSetResultCache( matheval, entries );
+    MathEvaluationSetParam( matheval, "x", 2 );
+    MathEvaluationSetParam( matheval, "y", 3 );
+    MathEvaluationPerform( matheval, &result );
+
+    MathEvaluationGetFootprint( matheval, &footprint );
+    MathEvaluationGetTotalFootprint( &after );
+
+    MathEvaluationDispose( matheval );
+    MathEvaluationGetTotalFootprint( &disposed );
+
+    // emptying the result cache (results computed
+    // with another policy, other functions or the
+    // program instead of a fit) updates the totals
+
+    failed = false;
+
+    for( change = 0; change < 3; change++ )
+    {
+        matheval = MathEvaluationNew( expression );
+        MathEvaluationSetResultCache( matheval, entries );
+        MathEvaluationSetParam( matheval, "x", 2 );
+        MathEvaluationSetParam( matheval, "y", 3 );
+        MathEvaluationPerform( matheval, &result );
+
+        if( change == 0 )
+        {
+            MathEvaluationSetErrorPolicy( matheval, MathEvaluationPropagate );
+        }
+        else if( change == 1 )
+        {
+            MathEvaluationSetApproximation( matheval, 1e-6 );
+        }
+        else
+        {
+            MathEvaluationFit( matheval, "x", 0.5, 1.5, 1e-6 );
+        }
+
+        MathEvaluationGetFootprint( matheval, &emptied );
+        MathEvaluationGetTotalFootprint( &current );
+
+        MathEvaluationDispose( matheval );
+
+        failed = failed || emptied.results != 0 || current.results != before.results || current.total != before.total + emptied.total;
+    }
+
+    failed = failed ||
+             footprint.count != 1 ||
+             footprint.expression != strlen( expression ) + 1 ||
+             footprint.params == 0 || footprint.program == 0 || footprint.values == 0 || footprint.stack == 0 ||
+             ( footprint.results == 0 ) != ( entries == 0 ) ||
+             footprint.total != footprint.expression + footprint.params + footprint.program + footprint.values +
+                                footprint.stack + footprint.results + footprint.other ||
+             after.count != before.count + 1 || after.total != before.total + footprint.total ||
+             after.program != before.program + footprint.program ||
+             disposed.count != before.count || disposed.total != before.total;
+
+    if( failed )
+    {
+        printf( "Test at line number %d failed\n\n", lineNumber );
+        printf( "Expression: %s\n\n", expression );
+        printf( "Footprint: %zu bytes, totals before: %zu, after: %zu, after dispose: %zu\n\n",
+                footprint.total, before.total, after.total, disposed.total );
+    }
+}
+
+
+
+//
+// Test function: results and statuses of a column evaluation
+// must be the same of the evaluations one row at a time
+// (factorials of non integer numbers are approximated).
+// Parameter z has no column.
+//
+
+void MathEvalTestColumns( int lineNumber, char *expression, size_t rows, bool aligned )
+{
+    MathEvaluation       *matheval;
+    MathEvaluationStatus status,
+                         *statuses;
+    const char           *params[ 2 ] = { "x", "y" };
+    const double         *columns[ 2 ];
+    double               *x,
+                         *y,
+                         *results,
+                         *memory,
+                         result;
+    size_t               row;
+
+    memory = NULL;
+
+    if( aligned )
+    {
+        x = MathEvaluationAllocColumn( rows, true );
+        y = MathEvaluationAllocColumn( rows, true );
+        results = MathEvaluationAllocColumn( rows, true );
+    }
+    else
+    {
+        memory = malloc( ( rows * 3 + 1 ) * sizeof( double ) );
+        x = memory + 1;
+        y = x + rows;
+        results = y + rows;
+    }
+
+    statuses = malloc( rows * sizeof( MathEvaluationStatus ) );
+
+    for( row = 0; row < rows; row++ )
+    {
+        x[ row ] = (double)( row % 11 ) - 3;
+        y[ row ] = (double)( row % 7 ) * 0.5;
+    }
+
+    columns[ 0 ] = x;
+    columns[ 1 ] = y;
+
+    matheval = MathEvaluationNew( expression );
+    MathEvaluationSetParam( matheval, "z", 0.25 );
+    MathEvaluationPerformColumns( matheval, params, columns, 2, rows, results, statuses );
+
+    for( row = 0; row < rows; row++ )
+    {
+        MathEvaluationSetParam( matheval, "x", x[ row ] );
+        MathEvaluationSetParam( matheval, "y", y[ row ] );
+        status = MathEvaluationPerform( matheval, &result );
+
+        if( status != statuses[ row ] || ( memcmp( &result, &results[ row ], sizeof( double ) ) != 0 && fabs( result - results[ row ] ) > fabs( result ) * 1e-12 ) )
+        {
+            printf( "Test at line number %d failed\n\n", lineNumber );
+            printf( "Expression: %s with x = %f, y = %f (row %zu)\n\n", expression, x[ row ], y[ row ], row );
+            printf( "Expected result is: %f (%s)\n", result, status ? "success" : "failure" );
+            printf( "Test     result is: %f (%s)\n\n", results[ row ], statuses[ row ] ? "success" : "failure" );
+            break;
+        }
+    }
+
+    MathEvaluationDispose( matheval );
+
+    if( aligned )
+    {
+        MathEvaluationFreeColumn( x );
+        MathEvaluationFreeColumn( y );
+        MathEvaluationFreeColumn( results );
+    }
+
+    free( memory );
+    free( statuses );
+}
+
+
+
+//
+// Test function: evaluations with deferred checks must give
+// the same results, errors and error positions of those
+// with checks after each operation.
+//
+
+void MathEvalTestDeferred( int lineNumber, char *expression )
+{
+    MathEvaluation       *checked,
+                         *deferred;
+    MathEvaluationStatus status,
+                         deferredStatus;
+    double               values[] = { -3, -1, -0.5, 0, 0.5, 1, 2, 7, 171, 1e300, INFINITY, -INFINITY, NAN },
+                         result,
+                         deferredResult;
+    const char           *error,
+                         *deferredError;
+    int                  position,
+                         deferredPosition;
+    size_t               count,
+                         i,
+                         j;
+
+    checked = MathEvaluationNew( expression );
+    deferred = MathEvaluationNew( expression );
+    MathEvaluationSetDeferredChecks( deferred, true );
+
+    count = sizeof( values ) / sizeof( double );
+
+    for( i = 0; i < count * count; i++ )
+    {
+        MathEvaluationSetParam( checked, "x", values[ i % count ] );
+        MathEvaluationSetParam( checked, "y", values[ i / count ] );
+        MathEvaluationSetParam( deferred, "x", values[ i % count ] );
+        MathEvaluationSetParam( deferred, "y", values[ i / count ] );
+
+        // the second evaluation of the same values
+        // finds the calls memoized
+
+        for( j = 0; j < 2; j++ )
+        {
+            status = MathEvaluationPerform( checked, &result );
+            deferredStatus = MathEvaluationPerform( deferred, &deferredResult );
+
+            error = MathEvaluationGetError( checked, &position );
+            deferredError = MathEvaluationGetError( deferred, &deferredPosition );
+
+            if( status != deferredStatus || result != deferredResult || strcmp( error, deferredError ) != 0 || position != deferredPosition )
+            {
+                printf( "Test at line number %d failed\n\n", lineNumber );
+                printf( "Expression: %s with x = %f, y = %f\n\n", expression, values[ i % count ], values[ i / count ] );
+                printf( "Expected result is: %f (%s at %d)\n", result, error, position );
+                printf( "Test     result is: %f (%s at %d)\n\n", deferredResult, deferredError, deferredPosition );
+                i = count * count;
+                break;
+            }
+        }
+    }
+
+    MathEvaluationDispose( checked );
+    MathEvaluationDispose( deferred );
+}
+
+
+
+//
+// Test function: compare expected status and result (NaN
+// matches NaN) of an evaluation with the given error policy,
+// with `MathEvaluationPerform()` and with
+// `MathEvaluationPerformColumns()`.
+//
+
+void MathEvalTestPolicy( int lineNumber, MathEvaluationErrorPolicy policy, MathEvaluationStatus expectedStatus, double expectedResult, char *expression )
+{
+    MathEvaluation       *matheval;
+    MathEvaluationStatus status,
+                         columnsStatus;
+    double               result,
+                         columnsResult;
+
+    matheval = MathEvaluationNew( expression );
+    MathEvaluationSetErrorPolicy( matheval, policy );
+
+    status = MathEvaluationPerform( matheval, &result );
+    MathEvaluationPerformColumns( matheval, NULL, NULL, 0, 1, &columnsResult, &columnsStatus );
+
+    if( ( status == expectedStatus && columnsStatus == expectedStatus ) &&
+        ( ( result == expectedResult && columnsResult == expectedResult ) || ( isnan( expectedResult ) && isnan( result ) && isnan( columnsResult ) ) ) )
+    {
+        MathEvaluationDispose( matheval );
+        return;
+    }
+
+    printf( "Test at line number %d failed\n\n", lineNumber );
+    printf( "Expression: %s\n\n", expression );
+    printf( "Expected status is: %s\n", expectedStatus == MathEvaluationSuccess ? "success" : "failure" );
+    printf( "Test     status is: %s (columns: %s)\n\n", status == MathEvaluationSuccess ? "success" : "failure",
+                                                       columnsStatus == MathEvaluationSuccess ? "success" : "failure" );
+    printf( "Expected result is: %f\n", expectedResult );
+    printf( "Test     result is: %f (columns: %f)\n\n", result, columnsResult );
+
+    MathEvaluationDispose( matheval );
+}
+
+
+
+//
+// Test function: results of a column evaluation with approximated
+// functions must be within `tolerance` (relative, absolute for
+// results smaller than 1) of the exact ones, statuses the same.
+//
+
+void MathEvalTestApproximation( int lineNumber, char *expression, double tolerance )
+{
+    MathEvaluation       *approximated,
+                         *exact;
+    MathEvaluationStatus approximatedStatuses[ 1000 ],
+                         statuses[ 1000 ];
+    const char           *params[ 2 ] = { "x", "y" };
+    const double         *columns[ 2 ];
+    double               x[ 1000 ],
+                         y[ 1000 ],
+                         approximatedResults[ 1000 ],
+                         results[ 1000 ];
+    size_t               row;
+
+    for( row = 0; row < 1000; row++ )
+    {
+        x[ row ] = (double)( row % 101 ) * 0.1 - 3;
+        y[ row ] = (double)( row % 7 ) * 0.5;
+    }
+
+    columns[ 0 ] = x;
+    columns[ 1 ] = y;
+
+    approximated = MathEvaluationNew( expression );
+    exact = MathEvaluationNew( expression );
+    MathEvaluationSetApproximation( approximated, tolerance );
+
+    MathEvaluationPerformColumns( approximated, params, columns, 2, 1000, approximatedResults, approximatedStatuses );
+    MathEvaluationPerformColumns( exact, params, columns, 2, 1000, results, statuses );
+
+    for( row = 0; row < 1000; row++ )
+    {
+        if( statuses[ row ] != approximatedStatuses[ row ] ||
+            fabs( results[ row ] - approximatedResults[ row ] ) > tolerance * fmax( 1, fabs( results[ row ] ) ) )
+        {
+            printf( "Test at line number %d failed\n\n", lineNumber );
+            printf( "Expression: %s with x = %f, y = %f (row %zu)\n\n", expression, x[ row ], y[ row ], row );
+            printf( "Expected result is: %.17g (%s)\n", results[ row ], statuses[ row ] ? "success" : "failure" );
+            printf( "Test     result is: %.17g (%s)\n\n", approximatedResults[ row ], approximatedStatuses[ row ] ? "success" : "failure" );
+            break;
+        }
+    }
+
+    MathEvaluationDispose( approximated );
+    MathEvaluationDispose( exact );
+}
+
+
+
+//
+// Test function: fits the expression over [min, max] of x (with y = 0.5)
+// and compares the fitted results, inside and outside the domain,
+// scalar and by columns, with those of the program.
+// Once y changes the fit is dropped, and so are the results it left
+// in the result cache: the results must be those of the program.
+//
+
+void MathEvalTestFit( int lineNumber, MathEvaluationStatus expectedStatus, char *expression, double min, double max, double tolerance )
+{
+    MathEvaluation       *fitted,
+                         *exact;
+    MathEvaluationStatus status,
+                         fittedStatuses[ 1000 ],
+                         statuses[ 1000 ];
+    const char           *params[ 1 ] = { "x" };
+    const double         *columns[ 1 ];
+    double               x[ 1000 ],
+                         fittedResults[ 1000 ],
+                         results[ 1000 ],
+                         result,
+                         exactResult;
+    size_t               row;
+
+    for( row = 0; row < 1000; row++ )
+    {
+        x[ row ] = min - 1 + ( max - min + 2 ) * (double) row / 999;
+    }
+
+    columns[ 0 ] = x;
+
+    fitted = MathEvaluationNew( expression );
+    exact = MathEvaluationNew( expression );
+    MathEvaluationSetParam( fitted, "x", 0 );
+    MathEvaluationSetParam( fitted, "y", 0.5 );
+    MathEvaluationSetParam( exact, "x", 0 );
+    MathEvaluationSetParam( exact, "y", 0.5 );
+    MathEvaluationSetResultCache( fitted, 64 );
+
+    status = MathEvaluationFit( fitted, "x", min, max, tolerance );
+
+    if( status != expectedStatus )
+    {
+        printf( "Test at line number %d failed\n\n", lineNumber );
+        printf( "Expression: %s fitted over [%f, %f]\n\n", expression, min, max );
+        printf( "Expected status is: %s\n", expectedStatus == MathEvaluationSuccess ? "success" : "failure" );
+        printf( "Test     status is: %s\n\n", status == MathEvaluationSuccess ? "success" : "failure" );
+    }
+    else if( status == MathEvaluationSuccess )
+    {
+        MathEvaluationPerformColumns( fitted, params, columns, 1, 1000, fittedResults, fittedStatuses );
+        MathEvaluationPerformColumns( exact, params, columns, 1, 1000, results, statuses );
+
+        for( row = 0; row < 1000; row++ )
+        {
+            MathEvaluationSetParam( fitted, "x", x[ row ] );
+            MathEvaluationPerform( fitted, &result );
+
+            if( statuses[ row ] != fittedStatuses[ row ] ||
+                ( statuses[ row ] == MathEvaluationSuccess &&
+                  ( fabs( results[ row ] - fittedResults[ row ] ) > tolerance * fmax( 1, fabs( results[ row ] ) ) ||
+                    result != fittedResults[ row ] ) ) )
+            {
+                printf( "Test at line number %d failed\n\n", lineNumber );
+                printf( "Expression: %s fitted over [%f, %f] with x = %f (row %zu)\n\n", expression, min, max, x[ row ], row );
+                printf( "Expected result is: %.17g (%s)\n", results[ row ], statuses[ row ] ? "success" : "failure" );
+                printf( "Test     result is: %.17g (%s), scalar %.17g\n\n", fittedResults[ row ], fittedStatuses[ row ] ? "success" : "failure", result );
+                break;
+            }
+        }
+
+        MathEvaluationSetParam( fitted, "x", x[ 500 ] );
+        MathEvaluationPerform( fitted, &result );
+
+        MathEvaluationSetParam( fitted, "y", 1.5 );
+        MathEvaluationSetParam( fitted, "y", 0.5 );
+        MathEvaluationSetParam( exact, "x", x[ 500 ] );
+
+        status = MathEvaluationPerform( fitted, &result );
+
+        if( status != MathEvaluationPerform( exact, &exactResult ) || result != exactResult )
+        {
+            printf( "Test at line number %d failed\n\n", lineNumber );
+            printf( "Expression: %s with x = %f after the fit is dropped\n\n", expression, x[ 500 ] );
+            printf( "Expected result is: %.17g\n", exactResult );
+            printf( "Test     result is: %.17g\n\n", result );
+        }
+    }
+
+    MathEvaluationDispose( fitted );
+    MathEvaluationDispose( exact );
+}
+
+
+
+//
+// Test function: evaluates the expression again and again changing
+// one parameter at a time (memoized calls see the same arguments),
+// twice for each value and also with deferred checks, and compares
+// the results with those of new evaluations.
+//
+
+void MathEvalTestMemo( int lineNumber, char *expression )
+{
+    MathEvaluation       *memoized[ 2 ],
+                         *matheval;
+    MathEvaluationStatus status,
+                         memoizedStatus;
+    double               x[ 3 ] = { 0.0, -0.0, 1.5 },
+                         result,
+                         memoizedResult;
+    int                  i,
+                         j;
+
+    memoized[ 0 ] = MathEvaluationNew( expression );
+    memoized[ 1 ] = MathEvaluationNew( expression );
+    MathEvaluationSetDeferredChecks( memoized[ 1 ], true );
+
+    for( i = 0; i < 60 * 4; i++ )
+    {
+        matheval = MathEvaluationNew( expression );
+        MathEvaluationSetParam( matheval, "x", x[ ( i / 16 ) % 3 ] );
+        MathEvaluationSetParam( matheval, "y", ( i / 4 ) % 4 );
+
+        status = MathEvaluationPerform( matheval, &result );
+
+        MathEvaluationDispose( matheval );
+
+        // the first two evaluate the values, then
+        // the same values are evaluated again
+
+        j = i % 2;
+
+        if( i % 4 < 2 )
+        {
+            MathEvaluationSetParam( memoized[ j ], "x", x[ ( i / 16 ) % 3 ] );
+            MathEvaluationSetParam( memoized[ j ], "y", ( i / 4 ) % 4 );
+        }
+
+        memoizedStatus = MathEvaluationPerform( memoized[ j ], &memoizedResult );
+
+        if( status != memoizedStatus || ( status == MathEvaluationSuccess && result != memoizedResult ) )
+        {
+            printf( "Test at line number %d failed\n\n", lineNumber );
+            printf( "Expression: %s with x = %f, y = %d%s\n\n", expression, x[ ( i / 16 ) % 3 ], ( i / 4 ) % 4, j ? " (deferred checks)" : "" );
+            printf( "Expected result is: %f (%s)\n", result, status == MathEvaluationSuccess ? "success" : "failure" );
+            printf( "Test     result is: %f (%s)\n\n", memoizedResult, memoizedStatus == MathEvaluationSuccess ? "success" : "failure" );
+            break;
+        }
+    }
+
+    MathEvaluationDispose( memoized[ 0 ] );
+    MathEvaluationDispose( memoized[ 1 ] );
+}
+
+
+
+//
+// Test function: evaluates the expression for the intervals of x and y,
+// then checks that the results of the values on a grid over the
+// intervals are in the interval of the result.
+//
+
+void MathEvalTestInterval( int lineNumber, MathEvaluationStatus expectedStatus, char *expression, double xLow, double xHigh, double yLow, double yHigh )
+{
+    MathEvaluation       *matheval;
+    MathEvaluationStatus status;
+    const char           *params[ 2 ] = { "x", "y" };
+    double               lows[ 2 ],
+                         highs[ 2 ],
+                         low,
+                         high,
+                         x,
+                         y,
+                         result;
+    int                  i,
+                         j;
+
+    lows[ 0 ] = xLow;
+    highs[ 0 ] = xHigh;
+    lows[ 1 ] = yLow;
+    highs[ 1 ] = yHigh;
+
+    matheval = MathEvaluationNew( expression );
+
+    status = MathEvaluationPerformInterval( matheval, params, lows, highs, 2, &low, &high );
+
+    if( status != expectedStatus )
+    {
+        printf( "Test at line number %d failed\n\n", lineNumber );
+        printf( "Expression: %s with x = %f...%f, y = %f...%f\n\n", expression, xLow, xHigh, yLow, yHigh );
+        printf( "Expected status is: %s\n", expectedStatus == MathEvaluationSuccess ? "success" : "failure" );
+        printf( "Test     status is: %s\n\n", status == MathEvaluationSuccess ? "success" : "failure" );
+    }
+    else if( status == MathEvaluationSuccess )
+    {
+        for( i = 0; i <= 100; i++ )
+        {
+            for( j = 0; j <= 20; j++ )
+            {
+                x = xLow + ( xHigh - xLow ) * i / 100;
+                y = yLow + ( yHigh - yLow ) * j / 20;
+
+                MathEvaluationSetParam( matheval, "x", x );
+                MathEvaluationSetParam( matheval, "y", y );
+
+                if( MathEvaluationPerform( matheval, &result ) != MathEvaluationSuccess || result < low || result > high )
+                {
+                    printf( "Test at line number %d failed\n\n", lineNumber );
+                    printf( "Expression: %s with x = %f, y = %f\n\n", expression, x, y );
+                    printf( "Expected result is in: %.17g...%.17g\n", low, high );
+                    printf( "Test     result is: %.17g\n\n", result );
+                    i = 100;
+                    break;
+                }
+            }
+        }
+    }
+
+    MathEvaluationDispose( matheval );
+}
+
+
+
+//
+// Test function: declares the bounds of x and y then compares the
+// results (single and by columns) of values on a grid within the bounds
+// with those of an evaluation without bounds; values out of the bounds
+// must be refused.
+//
+
+void MathEvalTestBounds( int lineNumber, char *expression, double xMin, double xMax, double yMin, double yMax )
+{
+    MathEvaluation       *bounded,
+                         *unbounded;
+    MathEvaluationStatus status,
+                         boundedStatus,
+                         statuses[ 231 ],
+                         boundedStatuses[ 231 ];
+    const char           *params[ 2 ] = { "x", "y" };
+    const double         *columns[ 2 ];
+    double               x[ 231 ],
+                         y[ 231 ],
+                         results[ 231 ],
+                         boundedResults[ 231 ],
+                         result,
+                         boundedResult;
+    bool                 failed;
+    int                  row;
+
+    bounded = MathEvaluationNew( expression );
+    unbounded = MathEvaluationNew( expression );
+
+    MathEvaluationSetParam( bounded, "x", xMin );
+    MathEvaluationSetParam( bounded, "y", yMin );
+    MathEvaluationSetBounds( bounded, "x", xMin, xMax );
+    MathEvaluationSetBounds( bounded, "y", yMin, yMax );
+    MathEvaluationSetParam( unbounded, "x", xMin );
+    MathEvaluationSetParam( unbounded, "y", yMin );
+
+    failed = false;
+
+    for( row = 0; row < 231; row++ )
+    {
+        x[ row ] = xMin + ( xMax - xMin ) * ( row % 21 ) / 20;
+        y[ row ] = yMin + ( yMax - yMin ) * ( row / 21 ) / 10;
+
+        MathEvaluationSetParam( bounded, "x", x[ row ] );
+        MathEvaluationSetParam( bounded, "y", y[ row ] );
+        MathEvaluationSetParam( unbounded, "x", x[ row ] );
+        MathEvaluationSetParam( unbounded, "y", y[ row ] );
+
+        status = MathEvaluationPerform( unbounded, &result );
+        boundedStatus = MathEvaluationPerform( bounded, &boundedResult );
+
+        if( status != boundedStatus || result != boundedResult )
+        {
+            printf( "Test at line number %d failed\n\n", lineNumber );
+            printf( "Expression: %s with x = %f, y = %f\n\n", expression, x[ row ], y[ row ] );
+            printf( "Expected result is: %f (%s)\n", result, status ? "success" : "failure" );
+            printf( "Test     result is: %f (%s)\n\n", boundedResult, boundedStatus ? "success" : "failure" );
+            failed = true;
+            break;
+        }
+    }
+
+    columns[ 0 ] = x;
+    columns[ 1 ] = y;
+
+    if( ! failed )
+    {
+        MathEvaluationPerformColumns( unbounded, params, columns, 2, 231, results, statuses );
+        MathEvaluationPerformColumns( bounded, params, columns, 2, 231, boundedResults, boundedStatuses );
+
+        for( row = 0; row < 231; row++ )
+        {
+            if( statuses[ row ] != boundedStatuses[ row ] || results[ row ] != boundedResults[ row ] )
+            {
+                printf( "Test at line number %d failed\n\n", lineNumber );
+                printf( "Expression: %s with x = %f, y = %f (columns)\n\n", expression, x[ row ], y[ row ] );
+                printf( "Expected result is: %f (%s)\n", results[ row ], statuses[ row ] ? "success" : "failure" );
+                printf( "Test     result is: %f (%s)\n\n", boundedResults[ row ], boundedStatuses[ row ] ? "success" : "failure" );
+                failed = true;
+                break;
+            }
+        }
+    }
+
+    // out of the bounds
+
+    x[ 230 ] = xMax * 2 + 1;
+
+    if( ! failed &&
+        ( MathEvaluationSetParam( bounded, "x", xMin - 1 ) != MathEvaluationFailure ||
+          MathEvaluationSetParam( bounded, "y", yMax + 1 ) != MathEvaluationFailure ||
+          MathEvaluationPerformColumns( bounded, params, columns, 2, 231, boundedResults, boundedStatuses ) != MathEvaluationFailure ) )
+    {
+        printf( "Test at line number %d failed\n\n", lineNumber );
+        printf( "Expression: %s, values out of the bounds are accepted\n\n", expression );
+    }
+
+    MathEvaluationDispose( bounded );
+    MathEvaluationDispose( unbounded );
+}
+
+
+
+//
+// Test function: compares the outcome of the threshold query with
+// the result of the evaluation for values of x and y on a grid.
+//
+
+void MathEvalTestCompare( int lineNumber, char *expression, double threshold )
+{
+    MathEvaluation       *matheval;
+    MathEvaluationStatus status,
+                         compareStatus;
+    double               x,
+                         y,
+                         result;
+    bool                 above;
+    int                  i,
+                         j;
+
+    matheval = MathEvaluationNew( expression );
+
+    for( i = 0; i <= 40; i++ )
+    {
+        for( j = 0; j <= 20; j++ )
+        {
+            x = i * 0.1 - 2;
+            y = j * 0.25 - 2.5;
+
+            MathEvaluationSetParam( matheval, "x", x );
+            MathEvaluationSetParam( matheval, "y", y );
+
+            compareStatus = MathEvaluationCompare( matheval, threshold, &above );
+            status = MathEvaluationPerform( matheval, &result );
+
+            if( status != compareStatus || ( status == MathEvaluationSuccess && above != ( result > threshold ) ) )
+            {
+                printf( "Test at line number %d failed\n\n", lineNumber );
+                printf( "Expression: %s > %f with x = %f, y = %f\n\n", expression, threshold, x, y );
+                printf( "Expected result is: %s (%s)\n", result > threshold ? "true" : "false", status ? "success" : "failure" );
+                printf( "Test     result is: %s (%s)\n\n", above ? "true" : "false", compareStatus ? "success" : "failure" );
+                i = 40;
+                break;
+            }
+        }
+    }
+
+    MathEvaluationDispose( matheval );
+}
+
+
+
+void MathEvalTestDerivatives( int lineNumber, MathEvaluationStatus expectedStatus, char *expression, double x, double y )
+{
+    MathEvaluation       *matheval;
+    MathEvaluationStatus status;
+    const char           *params[] = { "x", "y" };
+    double               partials[ 2 ],
+                         values[ 2 ],
+                         result,
+                         expected,
+                         upper,
+                         lower,
+                         step,
+                         difference;
+    int                  i;
+
+    matheval = MathEvaluationNew( expression );
+    MathEvaluationSetParam( matheval, "x", x );
+    MathEvaluationSetParam( matheval, "y", y );
+
+    status = MathEvaluationPerformDerivatives( matheval, params, 2, &result, partials );
+
+    if( status != expectedStatus )
+    {
+        printf( "Test at line number %d failed\n\n", lineNumber );
+        printf( "Expression: %s with x = %f, y = %f\n\n", expression, x, y );
+        printf( "Expected status is: %s\n", expectedStatus ? "success" : "failure" );
+        printf( "Test     status is: %s\n\n", status ? "success" : "failure" );
+        MathEvaluationDispose( matheval );
+        return;
+    }
+
+    if( status == MathEvaluationFailure )
+    {
+        MathEvaluationDispose( matheval );
+        return;
+    }
+
+    MathEvaluationPerform( matheval, &expected );
+
+    if( result != expected )
+    {
+        printf( "Test at line number %d failed\n\n", lineNumber );
+        printf( "Expression: %s with x = %f, y = %f\n\n", expression, x, y );
+        printf( "Expected result is: %.17g\n", expected );
+        printf( "Test     result is: %.17g\n\n", result );
+    }
+
+    // the partial derivatives against central differences
+
+    values[ 0 ] = x;
+    values[ 1 ] = y;
+
+    for( i = 0; i < 2; i++ )
+    {
+        step = 1e-6 * ( 1 + fabs( values[ i ] ) );
+
+        MathEvaluationSetParam( matheval, params[ i ], values[ i ] + step );
+        MathEvaluationPerform( matheval, &upper );
+        MathEvaluationSetParam( matheval, params[ i ], values[ i ] - step );
+        MathEvaluationPerform( matheval, &lower );
+        MathEvaluationSetParam( matheval, params[ i ], values[ i ] );
+
+        difference = ( upper - lower ) / ( 2 * step );
+
+        if( ! ( fabs( partials[ i ] - difference ) <= 1e-6 * ( 1 + fabs( difference ) ) ) )
+        {
+            printf( "Test at line number %d failed\n\n", lineNumber );
+            printf( "Expression: %s with x = %f, y = %f\n\n", expression, x, y );
+            printf( "Expected derivative by %s is: %.17g\n", params[ i ], difference );
+            printf( "Test     derivative by %s is: %.17g\n\n", params[ i ], partials[ i ] );
+        }
+    }
+
+    MathEvaluationDispose( matheval );
+}
+
+
+
+void MathEvalTestGradient( int lineNumber, MathEvaluationStatus expectedStatus, char *expression, double x, double y, size_t gradientSize )
+{
+    MathEvaluation       *matheval;
+    MathEvaluationStatus status;
+    const char           *params[] = { "x", "y" };
+    double               gradient[ 3 ],
+                         partials[ 2 ],
+                         result,
+                         expected;
+    int                  i,
+                         j;
+
+    matheval = MathEvaluationNew( expression );
+    MathEvaluationSetParam( matheval, "x", x );
+    MathEvaluationSetParam( matheval, "y", y );
+
+    // the same tape is used twice
+
+    for( j = 0; j < 2; j++ )
+    {
+        status = MathEvaluationPerformGradient( matheval, &result, gradient, gradientSize );
+
+        if( status != expectedStatus )
+        {
+            printf( "Test at line number %d failed\n\n", lineNumber );
+            printf( "Expression: %s with x = %f, y = %f\n\n", expression, x, y );
+            printf( "Expected status is: %s\n", expectedStatus ? "success" : "failure" );
+            printf( "Test     status is: %s\n\n", status ? "success" : "failure" );
+            break;
+        }
+
+        if( status == MathEvaluationFailure )
+        {
+            break;
+        }
+
+        // forward mode gives the same derivatives
+
+        MathEvaluationPerformDerivatives( matheval, params, 2, &expected, partials );
+
+        if( result != expected || fabs( gradient[ 0 ] - partials[ 0 ] ) > 1e-12 * ( 1 + fabs( partials[ 0 ] ) ) ||
+            fabs( gradient[ 1 ] - partials[ 1 ] ) > 1e-12 * ( 1 + fabs( partials[ 1 ] ) ) )
+        {
+            printf( "Test at line number %d failed\n\n", lineNumber );
+            printf( "Expression: %s with x = %f, y = %f\n\n", expression, x, y );
+            printf( "Expected result is: %.17g, gradient %.17g %.17g\n", expected, partials[ 0 ], partials[ 1 ] );
+            printf( "Test     result is: %.17g, gradient %.17g %.17g\n\n", result, gradient[ 0 ], gradient[ 1 ] );
+            break;
+        }
+
+        for( i = 2; i < (int) gradientSize; i++ )
+        {
+            if( gradient[ i ] != 0 )
+            {
+                printf( "Test at line number %d failed\n\n", lineNumber );
+                printf( "Expression: %s, the gradient beyond the parameters is not 0\n\n", expression );
+                break;
+            }
+        }
+    }
+
+    MathEvaluationDispose( matheval );
+}
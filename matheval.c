@@ -46,6 +46,8 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "matheval.h"
 
 #include <math.h>
+#include <fenv.h>
+#include <float.h>
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
@@ -53,6 +55,109 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <signal.h>
 #include <stdbool.h>
 #include <inttypes.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+
+
+// the directory of the compile cache (NULL if disabled)
+// initialized from the `MATHEVAL_CACHE_DIR` environment variable
+
+static char           *MathEvalCacheDirectory = NULL;
+static pthread_once_t  MathEvalCacheOnce = PTHREAD_ONCE_INIT;
+
+
+
+// the key of the per thread pool of evaluations
+// (see `MathEvaluationAcquire`)
+
+static pthread_key_t   MathEvalPoolKey;
+static pthread_once_t  MathEvalPoolOnce = PTHREAD_ONCE_INIT;
+
+
+
+// the memory used by all the evaluations of
+// the process (see `MathEvaluationGetTotalFootprint`)
+
+static MathEvaluationFootprint
+                       MathEvalTotalFootprint;
+static pthread_mutex_t MathEvalTotalFootprintMutex = PTHREAD_MUTEX_INITIALIZER;
+
+
+
+// n! for n = 0...170 (greater factorials overflow), exact
+// values rounded to the nearest double
+
+static const double    MathEvalFactorials[ MATH_EVAL_FACTORIALS ] =
+{
+    1,                        1,                        2,                        6,
+    24,                       120,                      720,                      5040,
+    40320,                    362880,                   3628800,                  39916800,
+    479001600,                6227020800,               87178291200,              1307674368000,
+    20922789888000,           355687428096000,          6402373705728000,         1.21645100408832e+17,
+    2.43290200817664e+18,     5.109094217170944e+19,    1.1240007277776077e+21,   2.585201673888498e+22,
+    6.204484017332394e+23,    1.5511210043330986e+25,   4.0329146112660565e+26,   1.0888869450418352e+28,
+    3.0488834461171387e+29,   8.841761993739702e+30,    2.6525285981219107e+32,   8.222838654177922e+33,
+    2.631308369336935e+35,    8.683317618811886e+36,    2.9523279903960416e+38,   1.0333147966386145e+40,
+    3.7199332678990125e+41,   1.3763753091226346e+43,   5.230226174666011e+44,    2.0397882081197444e+46,
+    8.159152832478977e+47,    3.345252661316381e+49,    1.40500611775288e+51,     6.041526306337383e+52,
+    2.658271574788449e+54,    1.1962222086548019e+56,   5.502622159812089e+57,    2.5862324151116818e+59,
+    1.2413915592536073e+61,   6.082818640342675e+62,    3.0414093201713376e+64,   1.5511187532873822e+66,
+    8.065817517094388e+67,    4.2748832840600255e+69,   2.308436973392414e+71,    1.2696403353658276e+73,
+    7.109985878048635e+74,    4.0526919504877214e+76,   2.3505613312828785e+78,   1.3868311854568984e+80,
+    8.32098711274139e+81,     5.075802138772248e+83,    3.146997326038794e+85,    1.98260831540444e+87,
+    1.2688693218588417e+89,   8.247650592082472e+90,    5.443449390774431e+92,    3.647111091818868e+94,
+    2.4800355424368305e+96,   1.711224524281413e+98,    1.1978571669969892e+100,  8.504785885678623e+101,
+    6.1234458376886085e+103,  4.4701154615126844e+105,  3.307885441519386e+107,   2.48091408113954e+109,
+    1.8854947016660504e+111,  1.4518309202828587e+113,  1.1324281178206297e+115,  8.946182130782976e+116,
+    7.156945704626381e+118,   5.797126020747368e+120,   4.753643337012842e+122,   3.945523969720659e+124,
+    3.314240134565353e+126,   2.81710411438055e+128,    2.4227095383672734e+130,  2.107757298379528e+132,
+    1.8548264225739844e+134,  1.650795516090846e+136,   1.4857159644817615e+138,  1.352001527678403e+140,
+    1.2438414054641308e+142,  1.1567725070816416e+144,  1.087366156656743e+146,   1.032997848823906e+148,
+    9.916779348709496e+149,   9.619275968248212e+151,   9.426890448883248e+153,   9.332621544394415e+155,
+    9.332621544394415e+157,   9.42594775983836e+159,    9.614466715035127e+161,   9.90290071648618e+163,
+    1.0299016745145628e+166,  1.081396758240291e+168,   1.1462805637347084e+170,  1.226520203196138e+172,
+    1.324641819451829e+174,   1.4438595832024937e+176,  1.588245541522743e+178,   1.7629525510902446e+180,
+    1.974506857221074e+182,   2.2311927486598138e+184,  2.5435597334721877e+186,  2.925093693493016e+188,
+    3.393108684451898e+190,   3.969937160808721e+192,   4.684525849754291e+194,   5.574585761207606e+196,
+    6.689502913449127e+198,   8.094298525273444e+200,   9.875044200833601e+202,   1.214630436702533e+205,
+    1.506141741511141e+207,   1.882677176888926e+209,   2.372173242880047e+211,   3.0126600184576594e+213,
+    3.856204823625804e+215,   4.974504222477287e+217,   6.466855489220474e+219,   8.47158069087882e+221,
+    1.1182486511960043e+224,  1.4872707060906857e+226,  1.9929427461615188e+228,  2.6904727073180504e+230,
+    3.659042881952549e+232,   5.012888748274992e+234,   6.917786472619489e+236,   9.615723196941089e+238,
+    1.3462012475717526e+241,  1.898143759076171e+243,   2.695364137888163e+245,   3.854370717180073e+247,
+    5.5502938327393044e+249,  8.047926057471992e+251,   1.1749972043909107e+254,  1.727245890454639e+256,
+    2.5563239178728654e+258,  3.80892263763057e+260,    5.713383956445855e+262,   8.62720977423324e+264,
+    1.3113358856834524e+267,  2.0063439050956823e+269,  3.0897696138473508e+271,  4.789142901463394e+273,
+    7.471062926282894e+275,   1.1729568794264145e+278,  1.853271869493735e+280,   2.9467022724950384e+282,
+    4.7147236359920616e+284,  7.590705053947219e+286,   1.2296942187394494e+289,  2.0044015765453026e+291,
+    3.287218585534296e+293,   5.423910666131589e+295,   9.003691705778438e+297,   1.503616514864999e+300,
+    2.5260757449731984e+302,  4.269068009004705e+304,   7.257415615307999e+306
+};
+
+
+
+// coefficients of the series of the approximated functions:
+// 1/n! for n = 0...20 and 1/n for odd n = 1...31
+
+static const double    MathEvalInverseFactorials[ 21 ] =
+{
+    1.0 / 1,                 1.0 / 1,                 1.0 / 2,                 1.0 / 6,
+    1.0 / 24,                1.0 / 120,               1.0 / 720,               1.0 / 5040,
+    1.0 / 40320,             1.0 / 362880,            1.0 / 3628800,           1.0 / 39916800,
+    1.0 / 479001600,         1.0 / 6227020800,        1.0 / 87178291200,       1.0 / 1307674368000,
+    1.0 / 20922789888000,    1.0 / 355687428096000,   1.0 / 6402373705728000,  1.0 / 121645100408832000,
+    1.0 / 2432902008176640000
+};
+
+static const double    MathEvalInverseOdds[ 16 ] =
+{
+    1.0 / 1,  1.0 / 3,  1.0 / 5,  1.0 / 7,  1.0 / 9,  1.0 / 11, 1.0 / 13, 1.0 / 15,
+    1.0 / 17, 1.0 / 19, 1.0 / 21, 1.0 / 23, 1.0 / 25, 1.0 / 27, 1.0 / 29, 1.0 / 31
+};
 
 
 
@@ -77,57 +182,316 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 MathEvaluation* MathEvaluationNew( const char *expression )
 {
-    MathEvaluation *matheval;
+    return MathEvalNew( expression, strlen( expression ), true, NULL );
+}
 
-    matheval = malloc( sizeof( MathEvaluation ) );
 
-    if( ! matheval )
+
+//
+// Like `MathEvaluationNew` but all the memory of the
+// evaluation is obtained from `allocator`, whose
+// `alloc` and `free` callbacks receive its `userData`.
+// The allocator is copied.
+//
+// The compiler builds the expression copy, the
+// parameters and the program in an arena made of a few
+// large blocks that `MathEvaluationDispose` releases
+// all at once.
+//
+
+MathEvaluation* MathEvaluationNewWithAllocator( const char *expression, const MathEvaluationAllocator *allocator )
+{
+    if( ! allocator || ! allocator->alloc || ! allocator->free )
     {
-        return matheval;
+        return NULL;
     }
 
-    matheval->expression = malloc( strlen( expression ) + 1 );
+    return MathEvalNew( expression, strlen( expression ), true, allocator );
+}
+
 
-    if( ! matheval->expression )
+
+
+//
+// Initializes a MathEvaluation in memory provided by
+// the caller: `eval` may be a local variable and all
+// the memory needed by the evaluation (a copy of the
+// expression, parameters, compiled program and stack,
+// result cache) is taken from the `size` bytes at
+// `buffer`.
+// The heap is never used, when `buffer` is exhausted
+// the function that needed memory fails.
+//
+// `eval` and `buffer` must outlive the evaluation;
+// `MathEvaluationDispose` can be called but is not
+// required.
+//
+
+MathEvaluationStatus MathEvaluationInit( MathEvaluation *matheval, const char *expression, void *buffer, size_t size )
+{
+    MathEvalSetup( matheval, buffer, size );
+
+    if( ! buffer )
     {
-        free( matheval );
-        return NULL;
+        matheval->error = "missing buffer";
+        return MathEvaluationFailure;
+    }
+
+    if( ! MathEvalSetExpression( matheval, expression, strlen( expression ), true ) )
+    {
+        matheval->error = "cannot allocate memory";
+        return MathEvaluationFailure;
+    }
+
+    MathEvalAccount( matheval, false );
+
+    return MathEvaluationSuccess;
+}
+
+
+
+//
+// Disposes MathEvaluation structure
+// freeing memory
+//
+
+void MathEvaluationDispose( MathEvaluation *matheval )
+{
+    MathEvaluationAllocator
+            allocator;
+
+    MathEvalAccount( matheval, true );
+
+    // expression, parameters and program
+    // are in the arena
+
+    MathEvalFree( matheval, matheval->values );
+    MathEvalFree( matheval, matheval->results );
+    MathEvalFree( matheval, matheval->stack );
+    MathEvalFree( matheval, matheval->workspace );
+    MathEvalFree( matheval, matheval->fit.coefficients );
+
+    MathEvalArenaFree( matheval );
+
+    if( matheval->allocated )
+    {
+        allocator = matheval->allocator;
+
+        if( allocator.free )
+        {
+            allocator.free( matheval, allocator.userData );
+        }
+        else
+        {
+            free( matheval );
+        }
+    }
+}
+
+
+
+
+//
+// Replaces the expression of an evaluation and brings
+// it back to the state of a new one (no parameters,
+// not compiled, result cache disabled) keeping its
+// memory: the arena, the values and the stack are
+// reused so that usually nothing is allocated.
+//
+// Returns a status of success or failure (cannot
+// allocate memory).
+//
+
+MathEvaluationStatus MathEvaluationReset( MathEvaluation *matheval, const char *expression )
+{
+    MathEvalFree( matheval, matheval->results );
+    matheval->results = NULL;
+    matheval->resultsSize = 0;
+    matheval->resultsStride = 0;
+
+    // in caller provided storage everything
+    // is taken again from the beginning
+
+    if( matheval->buffer )
+    {
+        matheval->values = NULL;
+        matheval->valuesSize = 0;
+        matheval->stack = NULL;
+        matheval->stackSize = 0;
+        matheval->memos = NULL;
+        matheval->workspace = NULL;
+        matheval->workspaceSize = 0;
     }
 
-    strcpy( (char *)matheval->expression, expression );
+    MathEvalArenaReset( matheval );
 
     matheval->params = NULL;
+    matheval->paramsSize = 0;
+    matheval->valuesCount = 0;
     matheval->cursor = NULL;
     matheval->result = 0.0;
     matheval->roundBracketsCount = 0;
     matheval->error = "";
 
+    matheval->param = NULL;
+    matheval->program = NULL;
+    matheval->programCount = 0;
+    matheval->programSize = 0;
+    matheval->ownsProgram = true;
+    matheval->compiled = false;
+    matheval->hashed = false;
+    matheval->hash = 0;
+    matheval->integer = false;
+    matheval->bounded = false;
+    matheval->safe = false;
+    matheval->deferred = false;
+    matheval->policy = MathEvaluationStrict;
+    matheval->approximation.tolerance = 0;
+
+    MathEvalDropFit( matheval );
+    matheval->stackDepth = 0;
+    matheval->stackMaxDepth = 0;
+
+    if( ! MathEvalSetExpression( matheval, expression, strlen( expression ), true ) )
+    {
+        matheval->expression = "";
+        matheval->error = "cannot allocate memory";
+        MathEvalAccount( matheval, false );
+        return MathEvaluationFailure;
+    }
+
+    MathEvalAccount( matheval, false );
+
+    return MathEvaluationSuccess;
+}
+
+
+
+//
+// Returns an evaluation of `expression` taken from a
+// pool of the calling thread (reset with
+// `MathEvaluationReset`) or, if the pool is empty, a
+// new one.
+// The evaluation must be given back with
+// `MathEvaluationRelease` (or freed with
+// `MathEvaluationDispose`).
+// Returns NULL in case of failure.
+//
+
+MathEvaluation* MathEvaluationAcquire( const char *expression )
+{
+    MathEvalPool   *pool;
+    MathEvaluation *matheval;
+
+    pthread_once( &MathEvalPoolOnce, MathEvalPoolInit );
+
+    pool = pthread_getspecific( MathEvalPoolKey );
+
+    if( ! pool || pool->count == 0 )
+    {
+        return MathEvaluationNew( expression );
+    }
+
+    matheval = pool->evals[ --pool->count ];
+
+    if( ! MathEvaluationReset( matheval, expression ) )
+    {
+        MathEvaluationDispose( matheval );
+        return NULL;
+    }
+
     return matheval;
 }
 
 
 
 //
-// Disposes MathEvaluation structure
-// freeing memory
+// Gives an evaluation back to the pool of the calling
+// thread; it is disposed if the pool is full or it
+// has not been allocated by `MathEvaluationNew`
+// (or `MathEvaluationAcquire`).
+// Pooled evaluations are disposed when the
+// thread exits.
 //
 
-void MathEvaluationDispose( MathEvaluation *matheval )
+void MathEvaluationRelease( MathEvaluation *matheval )
 {
-    MathEvalParam *param,
-                  *next;
+    MathEvalPool *pool;
 
-    param = matheval->params;
-    while( param != NULL )
+    if( ! matheval->allocated || matheval->allocator.alloc )
+    {
+        MathEvaluationDispose( matheval );
+        return;
+    }
+
+    pthread_once( &MathEvalPoolOnce, MathEvalPoolInit );
+
+    pool = pthread_getspecific( MathEvalPoolKey );
+
+    if( ! pool )
+    {
+        pool = malloc( sizeof( MathEvalPool ) );
+        if( ! pool || pthread_setspecific( MathEvalPoolKey, pool ) != 0 )
+        {
+            free( pool );
+            MathEvaluationDispose( matheval );
+            return;
+        }
+
+        pool->count = 0;
+    }
+
+    if( pool->count == MATH_EVAL_POOL_SIZE )
     {
-        next = param->next;
-        free( param );
-        param = next;
+        MathEvaluationDispose( matheval );
+        return;
     }
 
-    free( (void *) matheval->expression );
+    pool->evals[ pool->count++ ] = matheval;
+}
+
+
+
+
+//
+// Fills `footprint` with the bytes of memory used by
+// the evaluation, by category:
+//
+// expression   the copy of the expression
+// params       the parameters
+// program      the compiled expression
+// values       the values of the parameters
+// stack        the evaluation stack
+// results      the result cache
+// other        the MathEvaluation structure, allocation
+//              headers and free space of the arena
+// total        the sum of the above
+//
+// Expressions and programs of images are not counted.
+// `count` is set to 1.
+//
+
+void MathEvaluationGetFootprint( MathEvaluation *matheval, MathEvaluationFootprint *footprint )
+{
+    MathEvalFootprint( matheval, footprint );
+}
+
 
-    free( matheval );
+
+//
+// Fills `footprint` with the bytes of memory used by
+// all the evaluations of the process (not yet disposed),
+// by category (see `MathEvaluationGetFootprint`);
+// `count` is set to the number of evaluations.
+// Evaluations initialized with `MathEvaluationInit`
+// are not included.
+//
+
+void MathEvaluationGetTotalFootprint( MathEvaluationFootprint *footprint )
+{
+    pthread_mutex_lock( &MathEvalTotalFootprintMutex );
+    *footprint = MathEvalTotalFootprint;
+    pthread_mutex_unlock( &MathEvalTotalFootprintMutex );
 }
 
 
@@ -185,7 +549,9 @@ MathEvaluationStatus MathEvaluationSetParam(
                   *current;
 
     unsigned long i;
-    size_t len;
+    size_t len,
+           size;
+    double *values;
     char c;
 
     const char *reserved[] =
@@ -278,7 +644,24 @@ MathEvaluationStatus MathEvaluationSetParam(
     {
         if( strcmp( param->name, name ) == 0 )
         {
-            param->value = value;
+            // checks may have been dropped for
+            // the declared bounds
+
+            if( ( param->min != -INFINITY || param->max != INFINITY ) && ! ( value >= param->min && value <= param->max ) )
+            {
+                matheval->error = "value out of bounds";
+                return MathEvaluationFailure;
+            }
+
+            // the fit holds for the values of
+            // the other parameters
+
+            if( matheval->fit.coefficients && param->slot != matheval->fit.slot && matheval->values[ param->slot ] != value )
+            {
+                MathEvalDropFit( matheval );
+            }
+
+            matheval->values[ param->slot ] = value;
             return MathEvaluationSuccess;
         }
 
@@ -287,20 +670,49 @@ MathEvaluationStatus MathEvaluationSetParam(
 
     param = NULL;
 
+    // make room for the value
+
+    if( matheval->valuesCount == matheval->valuesSize )
+    {
+        size = matheval->valuesSize ? matheval->valuesSize * 2 : 4;
+
+        values = MathEvalRealloc( matheval, matheval->values, size * sizeof( double ) );
+        if( ! values )
+        {
+            matheval->error= "cannot allocate memory";
+            return MathEvaluationFailure;
+        }
+
+        matheval->values = values;
+        matheval->valuesSize = size;
+    }
+
     // alloc and init param, name is copied
 
-    param = ( MathEvalParam * ) calloc( 1, sizeof( MathEvalParam ) );
+    param = ( MathEvalParam * ) MathEvalArenaAlloc( matheval, sizeof( MathEvalParam ) + len + 1 );
     if( ! param )
     {
         matheval->error= "cannot allocate memory";
         return MathEvaluationFailure;
     }
 
-    strcpy( (char *) param->name, name );
+    memcpy( param->name, name, len + 1 );
     param->len = len;
-    param->value = value;
+    param->slot = (uint32_t) matheval->valuesCount++;
+    param->min = -INFINITY;
+    param->max = INFINITY;
     param->next = NULL;
 
+    matheval->values[ param->slot ] = value;
+    matheval->paramsSize += sizeof( MathEvalParam ) + len + 1;
+
+    MathEvalAccount( matheval, false );
+
+    // a new parameter may change how the expression
+    // is tokenized so the expression is compiled again
+
+    matheval->compiled = false;
+
     // put param in list on top or before param with shorter name
 
     if( matheval->params == NULL )
@@ -343,874 +755,6865 @@ MathEvaluationStatus MathEvaluationSetParam(
 
 
 
-// Evaluates an expression.
-// The function returns a status of success or failure
-// The result is in `*result`
+// Declares the bounds `min`...`max` of the values of the
+// parameter `name` (-inf...inf for none): the checks that
+// cannot fail for any value in the bounds (division by
+// zero, factorial of a negative number, too big results)
+// are dropped when the expression is compiled.
+// Setting a value out of the bounds then fails, also in
+// column evaluations.
+// Returns a status of success or failure (unknown
+// parameter, invalid bounds, current value out of them).
 
-MathEvaluationStatus MathEvaluationPerform(
-    MathEvaluation *matheval,   // the MathEvaluation structure
-    double         *result )    // RETURN: the result of the evaluation
+MathEvaluationStatus MathEvaluationSetBounds(
+    MathEvaluation *matheval,
+    const char     *name,
+    double         min,
+    double         max )
 {
-    matheval->cursor = matheval->expression;
-    matheval->roundBracketsCount = 0;
-    matheval->result = 0;
-    matheval->error = NULL;
+    MathEvalParam *param;
 
-    matheval->result = MathEvalProcessAddends( matheval, -1, true, false, NULL );
+    for( param = matheval->params; param && strcmp( param->name, name ) != 0; param = param->next );
 
-    *result = matheval->result;
+    if( ! param )
+    {
+        matheval->error = "unknown parameter";
+        return MathEvaluationFailure;
+    }
 
-    if( matheval->error )
+    if( ! ( min <= max ) )
     {
-        *result = 0;
+        matheval->error = "invalid bounds";
         return MathEvaluationFailure;
     }
-    else
+
+    if( ( min != -INFINITY || max != INFINITY ) && ! ( matheval->values[ param->slot ] >= min && matheval->values[ param->slot ] <= max ) )
     {
-        matheval->error = "";
-        return MathEvaluationSuccess;
+        matheval->error = "value out of bounds";
+        return MathEvaluationFailure;
     }
-}
 
+    param->min = min;
+    param->max = max;
 
+    // the checks are dropped when compiling
 
-// Utility function to print the error after an
-// evaluation failed.
-// Prints the error description, the expression
-// and a caret under the expression approximately
-// where the error occurred.
+    matheval->compiled = false;
 
-void MathEvaluationPrintError( MathEvaluation *matheval )
-{
-    if( matheval->error && strlen( matheval->error ) > 0 )
-    {
-        fprintf( stderr, "%s\n", matheval->error );
-        if( matheval->cursor != NULL )
-        {
-            fprintf( stderr, "%s\n", matheval->expression );
-            fprintf( stderr, "%*c^\n", (int)( matheval->cursor - matheval->expression ), ' ' );
-        }
-    }
+    return MathEvaluationSuccess;
 }
 
 
 
-// Debug utility function to dump params
-// that have been set (if any)
+// Compiles the expression into a program that is
+// executed by `MathEvaluationPerform`.
+// Parameters must be set before: a name that is
+// not a parameter is an error.
+// The function returns a status of success or failure,
+// in case of failure the error is available with
+// `MathEvaluationGetError`.
+// Calling this function is optional: the expression
+// is compiled by `MathEvaluationPerform` if needed.
+// If the compile cache is enabled the program is
+// loaded from the cache or stored into it.
 
-void MathEvalDumpParams( MathEvaluation *matheval )
+MathEvaluationStatus MathEvaluationCompile( MathEvaluation *matheval )
 {
-    MathEvalParam *p = matheval->params;
-    int count = 1;
-    while( p != NULL )
-    {
-        printf( "%d: %s = %f  ->  0x%lx\n", count, p->name, p->value, (unsigned long) p );
-        p = p->next;
-        count++;
-        if(count>10) break;
-    }
-    printf( "\n---\n\n" );
-
-}
-
+    MathEvaluationStatus status;
 
+    status = MathEvalCompile( matheval );
 
+    MathEvalAccount( matheval, false );
 
-// *********************
-// * PRIVATE FUNCTIONS *
-// *********************
+    return status;
+}
 
 
 
-// Evaluates a single value or expression A0 or
-// sequence of 2 or more addends:
-// A1 - A2 [ + A3 [ - A4 ... ] ]
-// Addends can be a single values or expressions with
-// higher precedence. In the second case the expression is evaluated first.
-// "breakOn" parameters define cases where the function must exit.
+// Compiles the expression (see `MathEvaluationCompile`)
 
-double MathEvalProcessAddends(
-    MathEvaluation *matheval,
-    int64_t         breakOnRoundBracketsCount, // If open brackets count goes down to this count then exit;
-    bool            breakOnETEof,              // exit if the end of the string '\0' is met;
-    bool            breakOnETcom,              // exit if a comma is met;
-    MathEvalToken  *tokenThatCausedBreak )     // if pointer is not null the token/symbol that caused the function to exit.
+MathEvaluationStatus MathEvalCompile( MathEvaluation *matheval )
 {
-    MathEvalToken
-           leftOp,
-           rightOp;
+    char   path[ 4096 ];
+    bool   cached;
 
-    double value,
-           result;
+    matheval->cursor = matheval->expression;
+    matheval->roundBracketsCount = 0;
+    matheval->error = NULL;
+    matheval->compiled = false;
+    matheval->programCount = 0;
+    matheval->stackDepth = 0;
+    matheval->stackMaxDepth = 0;
 
+    // a program loaded from an image is never modified
 
-    // Let's pretend we already computed
-    // 0 + ...
+    if( ! matheval->ownsProgram )
+    {
+        matheval->program = NULL;
+        matheval->programSize = 0;
+        matheval->ownsProgram = true;
+    }
 
-    result = 0;
-    rightOp = MET_Sum;
+    cached = MathEvalCachePath( matheval, path, sizeof( path ) ) && MathEvalCacheLoad( matheval, path );
 
-    do
+    if( ! cached )
     {
-        leftOp = rightOp;
+        MathEvalProcessAddends( matheval, -1, true, false, NULL );
 
-        // [ Each addend A is treated as a (potential and higher-precedence)
-        //   multiplication and evaluated as 1 * A with the function below ]
-        value = MathEvalProcessFactors( matheval, 1, MET_Mul, false, &rightOp );
-        if( matheval->error ) return 0;
+        if( matheval->error )
+        {
+            return MathEvaluationFailure;
+        }
+    }
 
-        result = leftOp == MET_Sum ? ( result + value ) : ( result - value );
+    // the structural hash is computed on request
 
-        // ...and go on as long there are sums ands subs.
-    }
-    while( rightOp == MET_Sum || rightOp == MET_Sub );
-
-    // A round close bracket:
-    // check for negative count.
+    matheval->hashed = false;
 
-    if( rightOp == MET_rbc )
+    if( ! MathEvalPrepareStack( matheval ) )
     {
-        matheval->roundBracketsCount--;
-        if( matheval->roundBracketsCount < 0 )
-        {
-            matheval->error = "unexpected close round bracket";
-            return 0;
-        }
+        matheval->error = "cannot allocate memory";
+        return MathEvaluationFailure;
     }
 
-    // Returns the token that caused the function to exit
+    // cached results belong to the previous program
+    // and parameters
 
-    if( tokenThatCausedBreak )
-    {
-        *tokenThatCausedBreak = rightOp;
-    }
+    MathEvalDropResults( matheval );
 
-    // Check if must exit
+    MathEvalDropFit( matheval );
 
-    if( ( matheval->roundBracketsCount == breakOnRoundBracketsCount ) || ( breakOnETEof && rightOp == MET_Eof ) || ( breakOnETcom && rightOp == MET_com ) )
+    if( ! MathEvalAnalyze( matheval ) )
     {
-        if( eexception(result) )
-        {
-            matheval->error = "result is complex or too big";
-            return 0;
-        }
-
-        return result;
+        return MathEvaluationFailure;
     }
 
-    // If not it's an error.
+    matheval->integer = MathEvalIsInteger( matheval );
+    matheval->bounded = MathEvalIsBounded( matheval );
+    matheval->compiled = true;
+    matheval->error = "";
 
-    switch( rightOp )
+    if( ! cached && path[ 0 ] )
     {
-        case MET_Eof:
-            matheval->error = "unexpected end of expression";
-            break;
-
-        case MET_rbc:
-            matheval->error = "unexpected close round bracket";
-            break;
-
-        case MET_com:
-            matheval->error = "unexpeced comma";
-            break;
-
-        default:
-            matheval->error = "unexpeced symbol";
-            break;
+        MathEvalCacheStore( matheval, path );
     }
 
-    return 0;
+    return MathEvaluationSuccess;
 }
 
 
 
-// Evaluates a sequence of 1 or more multiplies or divisions
-// F1 [ * F2  [ / F3 [ * F4 ... ] ] ]
-// Where Fn is a value or a higher precedence expression.
+// Evaluates an expression.
+// The function returns a status of success or failure
+// The result is in `*result`
 
-double MathEvalProcessFactors(
-    MathEvaluation *matheval,
-    double          leftValue, // The value (already fetched) on the left to be multiplied(divided);
-    MathEvalToken   op,        // is it multiply or divide;
-    bool            isExponent,// is an exponent being evaluated ?
-    MathEvalToken  *leftOp )  // RETURN: factors are over, this is the next operator (token).
+MathEvaluationStatus MathEvaluationPerform(
+    MathEvaluation *matheval,   // the MathEvaluation structure
+    double         *result )    // RETURN: the result of the evaluation
 {
-    MathEvalToken
-           token,
-           nextOp;
+    MathEvalResultEntry *entry;
+    bool                found,
+                        negativeFactorial;
 
-    double rightValue;
-    double sign;
+    matheval->result = 0;
+    matheval->error = NULL;
 
-    do
+    if( ! matheval->compiled )
     {
-        rightValue = MathEvalProcessToken( matheval, &token );
-        if( matheval->error ) return 0;
+        MathEvaluationCompile( matheval );
+        if( ! matheval->compiled )
+        {
+            *result = 0;
+            return MathEvaluationFailure;
+        }
 
-        // Unary minus or plus ?
-        // store the sign and get the next token
+        matheval->error = NULL;
+    }
 
-        if( token == MET_Sub )
+    // the result cache is looked up first
+
+    entry = matheval->resultsSize ? MathEvalResultsFind( matheval, &found ) : NULL;
+
+    if( entry && found )
+    {
+        matheval->result = entry->result;
+        matheval->error = entry->error;
+        if( entry->error )
         {
-            sign = -1;
-            rightValue = MathEvalProcessToken( matheval, &token );
-            if( matheval->error ) return 0;
+            matheval->cursor = matheval->expression + entry->position;
         }
-        else if( token == MET_Sum )
+    }
+    else
+    {
+        // the fit is evaluated within its domain, integer
+        // programs are executed with integers unless a
+        // value does not fit, safe programs (and those
+        // whose errors propagate) without checks
+
+        if( matheval->fit.coefficients &&
+            matheval->values[ matheval->fit.slot ] >= matheval->fit.min &&
+            matheval->values[ matheval->fit.slot ] <= matheval->fit.max )
         {
-            sign = 1;
-            rightValue = MathEvalProcessToken( matheval, &token );
-            if( matheval->error ) return 0;
+            matheval->result = MathEvalRunFit( matheval, matheval->values[ matheval->fit.slot ] );
         }
-        else
+        else if( matheval->integer && MathEvalRunInteger( matheval, &matheval->result ) )
         {
-            sign = 1;
+            matheval->error = NULL;
         }
-
-        // Open round bracket?
-        // The expression between brackets is evaluated.
-
-        if( token == MET_rbo )
+        else if( matheval->policy == MathEvaluationPropagate || matheval->safe )
         {
-            matheval->roundBracketsCount++;
-
-            rightValue = MathEvalProcessAddends( matheval, matheval->roundBracketsCount - 1, false, false, NULL );
-            if( matheval->error ) return 0;
-
-            token = MET_Val;
+            matheval->result = MathEvalRunUnchecked( matheval, &negativeFactorial );
         }
-
-        // A function ?
-
-        if( token == MET_Cos || token == MET_Sin || token == MET_Tan || token == MET_ASi || token == MET_ACo || token == MET_ATa || token == MET_Fac || token == MET_Log || token == MET_Exp || token == MET_Pow || token == MET_Max || token == MET_Min || token == MET_Avg )
+        else
         {
-            rightValue = MathEvalProcessFunction( matheval, token );
-            if( matheval->error ) return 0;
-
-            token = MET_Val;
+            matheval->result = matheval->deferred ? MathEvalRunDeferred( matheval ) : MathEvalRun( matheval );
         }
 
-        // Excluded previous cases then
-        // the token must be a number.
-
-        if( token != MET_Val )
+        if( entry )
         {
-            matheval->error = "expected value";
-            return 0;
+            entry->result = matheval->result;
+            entry->error = matheval->error;
+            entry->position = matheval->error ? (int64_t)( matheval->cursor - matheval->expression ) : 0;
         }
+    }
 
-        // Get beforehand the next token
-        // to see if it's an exponential or factorial operator
+    *result = matheval->result;
 
-        MathEvalProcessToken( matheval, &nextOp );
-        if( matheval->error ) return 0;
+    if( matheval->error )
+    {
+        *result = 0;
+        return MathEvaluationFailure;
+    }
+    else
+    {
+        matheval->error = "";
+        return MathEvaluationSuccess;
+    }
+}
 
-        // Unary minus precedence (highest/lowest) affects this section of code
 
-        if( nextOp == MET_Fct )
+
+
+// Evaluates the expression for `rows` rows of
+// parameter values given as columns: `columns[i]`
+// holds the values of the parameter `params[i]`.
+// Parameters without a column keep their value, those
+// not yet defined are defined (as with
+// `MathEvaluationSetParam`).
+// `results[row]` receives the result of each row (0 if
+// the evaluation failed) and, if `statuses` is not NULL,
+// `statuses[row]` the outcome.
+// Rows are evaluated in blocks, one node at a time for
+// the whole block; columns and results aligned to 64 bytes
+// (see `MathEvaluationAllocColumn`) take a faster path.
+// The function returns a status of success if all the
+// rows have been evaluated, otherwise the error of the
+// first row that failed is reported.
+
+MathEvaluationStatus MathEvaluationPerformColumns(
+    MathEvaluation       *matheval,
+    const char           **params,      // parameter names
+    const double         **columns,     // a column of `rows` values for each parameter
+    size_t               paramsCount,
+    size_t               rows,
+    double               *results,      // RETURN: `rows` results
+    MathEvaluationStatus *statuses )    // RETURN: `rows` statuses (may be NULL)
+{
+    MathEvalParam  *param;
+    const double   **bySlot;
+    double         *saved;
+    const char     *error;
+    int64_t        position;
+    size_t         size,
+                   first,
+                   count,
+                   row,
+                   i;
+    bool           aligned,
+                   fitted,
+                   failed,
+                   negativeFactorial;
+
+    // parameters are defined before compiling as
+    // a new parameter makes the program obsolete
+
+    for( i = 0; i < paramsCount; i++ )
+    {
+        for( param = matheval->params; param && strcmp( param->name, params[ i ] ) != 0; param = param->next );
+
+        if( ! param && ! MathEvaluationSetParam( matheval, params[ i ], 0 ) )
         {
-            rightValue = MathEvalProcessFactorial( matheval, rightValue, &nextOp );
-            if( matheval->error ) return 0;
+            return MathEvalFailColumns( rows, results, statuses );
         }
+    }
 
-        if( nextOp == MET_Exc )
+    if( ! matheval->compiled )
+    {
+        MathEvaluationCompile( matheval );
+        if( ! matheval->compiled )
         {
-            rightValue = MathEvalProcessExponentiation( matheval, rightValue, &nextOp );
-            if( matheval->error ) return 0;
+            return MathEvalFailColumns( rows, results, statuses );
         }
+    }
 
-        // multiplication/division is finally
-        // calculated
+    // checks may have been dropped for the
+    // declared bounds
 
-        if( op == MET_Mul )
-        {
-            leftValue = leftValue * rightValue * sign;
-        }
-        else
+    for( i = 0; i < paramsCount; i++ )
+    {
+        for( param = matheval->params; strcmp( param->name, params[ i ] ) != 0; param = param->next );
+
+        if( param->min == -INFINITY && param->max == INFINITY )
         {
-            if( rightValue == 0 )
-            {
-                matheval->error = "division by zero";
-                return 0;
-            }
-            leftValue = leftValue / rightValue * sign;
+            continue;
         }
 
-        if( eexception( leftValue ) )
+        for( row = 0; row < rows && columns[ i ][ row ] >= param->min && columns[ i ][ row ] <= param->max; row++ );
+
+        if( row < rows )
         {
-            matheval->error = "result is too big";
-            return 0;
+            matheval->error = "value out of bounds";
+            return MathEvalFailColumns( rows, results, statuses );
         }
+    }
 
-        // The next operator has already been fetched.
+    // the workspace holds the stack (a block of values
+    // for each level), the scratch blocks of the approximated
+    // functions, the flags of the rows that failed, the
+    // values of the parameters and the columns by
+    // parameter slot
 
-        op = nextOp;
+    size = MATH_EVAL_COLUMNS_ALIGNMENT +
+           ( matheval->stackMaxDepth + MATH_EVAL_COLUMNS_SCRATCH ) * MATH_EVAL_COLUMNS_BLOCK * sizeof( double ) +
+           MATH_EVAL_COLUMNS_BLOCK +
+           matheval->valuesCount * ( sizeof( double ) + sizeof( const double * ) );
 
-        // Go on as long multiply or division operators are met...
-        // ...unless an exponent is evaluated
-        // (because exponentiation ^ operator have higher precedence)
+    if( ! MathEvalReserveWorkspace( matheval, size ) )
+    {
+        return MathEvalFailColumns( rows, results, statuses );
     }
-    while( ( op == MET_Mul || op == MET_Div ) && ! isExponent );
-
-    *leftOp = op;
-
-    return leftValue;
-}
 
+    saved = (double *)( MathEvalColumnsFlags( matheval ) + MATH_EVAL_COLUMNS_BLOCK );
+    bySlot = (const double **)( saved + matheval->valuesCount );
 
+    for( i = 0; i < matheval->valuesCount; i++ )
+    {
+        bySlot[ i ] = NULL;
+    }
 
-// Evaluates the expession(s) (comma separated if multiple)
-// inside the round brackets then computes the function
-// specified by the token `func`.
+    aligned = ( (uintptr_t) results % MATH_EVAL_COLUMNS_ALIGNMENT ) == 0;
 
-double MathEvalProcessFunction( MathEvaluation *matheval, MathEvalToken func )
-{
-    double   result,
-             result2;
+    // the fit is used if only its parameter has a column
 
-    uint16_t count;
+    fitted = matheval->fit.coefficients && paramsCount > 0;
 
-    MathEvalToken
-             tokenThatCausedBreak,
-             token;
+    for( i = 0; i < paramsCount; i++ )
+    {
+        for( param = matheval->params; strcmp( param->name, params[ i ] ) != 0; param = param->next );
 
-    // Eat an open round bracket and count it
+        bySlot[ param->slot ] = columns[ i ];
+        aligned = aligned && ( (uintptr_t) columns[ i ] % MATH_EVAL_COLUMNS_ALIGNMENT ) == 0;
+        fitted = fitted && param->slot == matheval->fit.slot;
+    }
 
-    MathEvalProcessToken( matheval, &token );
-    if( matheval->error ) return 0;
+    // rows are evaluated in blocks, the rows of a block
+    // that may have failed are evaluated again one by one
+    // to get the error (unless infinities and NaNs propagate
+    // or the program cannot fail), with the fit those out
+    // of its domain
 
-    if( token != MET_rbo )
+    if( matheval->valuesCount )
     {
-        matheval->error = "expected open round bracket after function name";
-        return 0;
+        memcpy( saved, matheval->values, matheval->valuesCount * sizeof( double ) );
     }
 
-    matheval->roundBracketsCount++;
+    failed = false;
+    error = NULL;
+    position = 0;
 
-    switch( func )
+    for( first = 0; first < rows; first += count )
     {
-        case MET_Sin:
-            result = MathEvalProcessAddends( matheval, matheval->roundBracketsCount - 1, false, false, NULL );
-            if( matheval->error ) return 0;
-            result = sin( result );
-            break;
-
-        case MET_Cos:
-            result = MathEvalProcessAddends( matheval, matheval->roundBracketsCount - 1, false, false, NULL );
-            if( matheval->error ) return 0;
-            result = cos( result );
-            break;
-
-        case MET_Tan:
-            result = MathEvalProcessAddends( matheval, matheval->roundBracketsCount - 1, false, false, NULL );
-            if( matheval->error ) return 0;
-            result = tan( result );
-            break;
-
-        case MET_ASi:
-            result = MathEvalProcessAddends( matheval, matheval->roundBracketsCount - 1, false, false, NULL );
-            if( matheval->error ) return 0;
-            result = asin( result );
-            break;
+        count = rows - first < MATH_EVAL_COLUMNS_BLOCK ? rows - first : MATH_EVAL_COLUMNS_BLOCK;
 
-        case MET_ACo:
-            result = MathEvalProcessAddends( matheval, matheval->roundBracketsCount - 1, false, false, NULL );
-            if( matheval->error ) return 0;
-            result = acos( result );
-            break;
+        if( fitted ? ! MathEvalRunFitColumns( matheval, bySlot[ matheval->fit.slot ], first, count, results + first ) :
+                     ! MathEvalRunColumns( matheval, bySlot, first, count, results + first, aligned ) ||
+                     matheval->policy == MathEvaluationPropagate || matheval->safe )
+        {
+            if( statuses )
+            {
+                for( row = first; row < first + count; row++ )
+                {
+                    statuses[ row ] = MathEvaluationSuccess;
+                }
+            }
 
-        case MET_ATa:
-            result = MathEvalProcessAddends( matheval, matheval->roundBracketsCount - 1, false, false, NULL );
-            if( matheval->error ) return 0;
-            result = atan( result );
-            break;
+            continue;
+        }
 
-        case MET_Fac:
-            result = MathEvalProcessAddends( matheval, matheval->roundBracketsCount - 1, false, false, NULL );
-            if( matheval->error ) return 0;
-            if( result < 0 )
+        for( row = first; row < first + count; row++ )
+        {
+            if( statuses )
             {
-                matheval->error = "attempt to mathevaluate factorial of negative number";
+                statuses[ row ] = MathEvaluationSuccess;
             }
-            else
+
+            if( ! MathEvalColumnsFlags( matheval )[ row - first ] )
             {
-                result = tgamma( 1 + result );
+                continue;
             }
-            break;
 
-        case MET_Exp:
-            result = MathEvalProcessAddends( matheval, matheval->roundBracketsCount - 1, false, false, NULL );
-            if( matheval->error ) return 0;
-            result = exp( result );
-            break;
+            for( i = 0; i < matheval->valuesCount; i++ )
+            {
+                matheval->values[ i ] = bySlot[ i ] ? bySlot[ i ][ row ] : saved[ i ];
+            }
 
-        case MET_Pow:
-            result = MathEvalProcessAddends( matheval, -1, false, true, NULL );
-            if( matheval->error ) return 0;
-            result2 = MathEvalProcessAddends( matheval, matheval->roundBracketsCount - 1, false, false, NULL );
-            if( matheval->error ) return 0;
-            result = pow( result, result2 );
-            break;
+            matheval->error = NULL;
 
-        case MET_Log:
-            result = MathEvalProcessAddends( matheval, matheval->roundBracketsCount - 1, false, true, &tokenThatCausedBreak );
-            if( matheval->error ) return 0;
-            if( tokenThatCausedBreak == MET_rbc )
+            if( matheval->policy == MathEvaluationPropagate )
             {
-                // log(n) with one parameter
-                result = log( result );
+                results[ row ] = MathEvalRunUnchecked( matheval, &negativeFactorial );
             }
             else
             {
-                result2 = MathEvalProcessAddends( matheval, matheval->roundBracketsCount - 1, false, false, NULL );
-                if( matheval->error ) return 0;
-                result = log( result2 ) / log( result );
+                results[ row ] = MathEvalRun( matheval );
             }
-            break;
 
-        case MET_Max:
-            result = MathEvalProcessAddends( matheval, matheval->roundBracketsCount - 1, false, true, &tokenThatCausedBreak );
-            if( matheval->error ) return 0;
-            while( tokenThatCausedBreak == MET_com )
+            if( matheval->error )
             {
-                result2 = MathEvalProcessAddends( matheval, matheval->roundBracketsCount - 1, false, true, &tokenThatCausedBreak );
-                if( matheval->error ) return 0;
+                results[ row ] = 0;
 
-                if( result2 > result )
+                if( statuses )
                 {
-                    result = result2;
+                    statuses[ row ] = MathEvaluationFailure;
                 }
-            }
-            break;
 
-        case MET_Min:
-            result = MathEvalProcessAddends( matheval, matheval->roundBracketsCount - 1, false, true, &tokenThatCausedBreak );
-            if( matheval->error ) return 0;
-            while( tokenThatCausedBreak == MET_com )
-            {
-                result2 = MathEvalProcessAddends( matheval, matheval->roundBracketsCount - 1, false, true, &tokenThatCausedBreak );
-                if( matheval->error ) return 0;
-
-                if( result2 < result )
+                if( ! failed )
                 {
-                    result = result2;
+                    failed = true;
+                    error = matheval->error;
+                    position = (int64_t)( matheval->cursor - matheval->expression );
                 }
             }
-            break;
-
-        case MET_Avg:
-            result = MathEvalProcessAddends( matheval, matheval->roundBracketsCount - 1, false, true, &tokenThatCausedBreak );
-            if( matheval->error ) return 0;
-            count = 1;
-            while( tokenThatCausedBreak == MET_com )
-            {
-                result2 = MathEvalProcessAddends( matheval, matheval->roundBracketsCount - 1, false, true, &tokenThatCausedBreak );
-                if( matheval->error ) return 0;
-
-                result += result2;
-                count++;
-            }
-            result = result / (double)count;
-            break;
+        }
+    }
 
-        default:
-            result = 0;
-            break;
+    if( matheval->valuesCount )
+    {
+        memcpy( matheval->values, saved, matheval->valuesCount * sizeof( double ) );
     }
 
-    if( eexception( result ) )
+    if( failed )
     {
-        matheval->error = "result is complex or too big";
-        return 0;
+        matheval->error = error;
+        matheval->cursor = matheval->expression + position;
+        return MathEvaluationFailure;
     }
 
-    return result;
+    matheval->error = "";
+    return MathEvaluationSuccess;
 }
 
 
 
-// Evaluates an exponentiation.
+// Evaluates the expression for all the values of the
+// parameters `params[i]` in the intervals `lows[i]`...`highs[i]`
+// (the other parameters keep their value) and returns in
+// `low`...`high` an interval that surely contains all
+// the results: the bounds are rounded outwards.
+// The function fails if the expression may fail for
+// some values in the intervals (errors are those of the
+// `MathEvaluationStrict` policy whatever the policy).
 
-double MathEvalProcessExponentiation( MathEvaluation *matheval,
-                                      double          base,     // The base has already been fetched;
-                                      MathEvalToken  *rightOp ) // RETURN: the token (operator) that follows.
+MathEvaluationStatus MathEvaluationPerformInterval(
+    MathEvaluation *matheval,
+    const char     **params,    // parameter names
+    const double   *lows,       // the interval of each parameter
+    const double   *highs,
+    size_t         paramsCount,
+    double         *low,        // RETURN: the interval of the result
+    double         *high )
 {
-    double exponent,
-           result;
+    MathEvalParam    *param;
+    MathEvalInterval *bySlot,
+                     result;
+    size_t           i;
 
-    exponent = MathEvalProcessFactors( matheval, 1, MET_Mul, true, rightOp );
-    if( matheval->error ) return 0;
+    *low = 0;
+    *high = 0;
 
-    result = pow( base, exponent );
-    if( eexception( result ) )
+    for( i = 0; i < paramsCount; i++ )
     {
-        matheval->error = "result is complex or too big";
-        return 0;
-    }
-
-    return result;
-}
+        if( ! ( lows[ i ] <= highs[ i ] ) )
+        {
+            matheval->error = "invalid interval";
+            return MathEvaluationFailure;
+        }
 
+        for( param = matheval->params; param && strcmp( param->name, params[ i ] ) != 0; param = param->next );
 
+        if( ! param && ! MathEvaluationSetParam( matheval, params[ i ], lows[ i ] ) )
+        {
+            return MathEvaluationFailure;
+        }
+    }
 
-// Evaluates a factorial using the Gamma function.
+    if( ! matheval->compiled )
+    {
+        MathEvaluationCompile( matheval );
+        if( ! matheval->compiled )
+        {
+            return MathEvaluationFailure;
+        }
+    }
 
-double MathEvalProcessFactorial( MathEvaluation *matheval,
-                                 double          value,     // The value to compute has already been fetched;
-                                 MathEvalToken  *rightOp )  // RETURN: the token (operator) that follows.
-{
-    double result;
+    // the workspace holds the intervals of the
+    // parameters by slot then the stack
 
-    if( value < 0 )
+    if( ! MathEvalReserveWorkspace( matheval, ( matheval->valuesCount + matheval->stackMaxDepth ) * sizeof( MathEvalInterval ) ) )
     {
-        matheval->error = "attempt to mathevaluate factorial of negative number";
-        *rightOp = MET_Err;
-        return 0;
+        return MathEvaluationFailure;
     }
 
-    result = tgamma( value + 1 );
+    bySlot = (MathEvalInterval *) matheval->workspace;
 
-    if( eexception( result ) )
+    for( i = 0; i < matheval->valuesCount; i++ )
     {
-        matheval->error = "result is complex or too big";
-        return 0;
+        bySlot[ i ].low = matheval->values[ i ];
+        bySlot[ i ].high = matheval->values[ i ];
     }
 
-    MathEvalProcessToken( matheval, rightOp );
-    if( matheval->error ) return 0;
+    for( i = 0; i < paramsCount; i++ )
+    {
+        for( param = matheval->params; strcmp( param->name, params[ i ] ) != 0; param = param->next );
 
-    return result;
-}
+        bySlot[ param->slot ].low = lows[ i ];
+        bySlot[ param->slot ].high = highs[ i ];
+    }
 
+    matheval->error = NULL;
 
+    if( ! MathEvalRunInterval( matheval, bySlot, &result ) )
+    {
+        return MathEvaluationFailure;
+    }
 
-// Parses the next token and advances the cursor.
-// The function returns a number if the token is a value a const. or a param.
+    // as a sum of addends the result is never -0
+
+    *low = result.low + 0;
+    *high = result.high + 0;
+
+    matheval->error = "";
+    return MathEvaluationSuccess;
+}
+
+
+
+// Returns in `above` whether the result of the expression
+// is greater than `threshold`, evaluating the expression
+// only if needed: bounds of the result are computed first
+// replacing sin, cos, exp, log, pow... with cheap bounds
+// (see `MathEvalRunBounds`), often they are enough to tell.
+// Without sin, cos or inverse trigonometric functions the
+// bounds cost about as much as the evaluation, that is
+// done straight away (see `MathEvalIsBounded`).
+// The function returns the status of the evaluation: it
+// fails where `MathEvaluationPerform` fails.
+
+MathEvaluationStatus MathEvaluationCompare(
+    MathEvaluation *matheval,
+    double         threshold,
+    bool           *above )     // RETURN: true if the result is greater than `threshold`
+{
+    MathEvalInterval bounds;
+    double           result;
+
+    *above = false;
+
+    if( ! matheval->compiled )
+    {
+        MathEvaluationCompile( matheval );
+        if( ! matheval->compiled )
+        {
+            return MathEvaluationFailure;
+        }
+    }
+
+    // the fit and integer programs are
+    // cheaper than the bounds
+
+    if( matheval->bounded && ! matheval->fit.coefficients && ! matheval->integer &&
+        MathEvalReserveWorkspace( matheval, matheval->stackMaxDepth * sizeof( MathEvalInterval ) ) &&
+        MathEvalRunBounds( matheval, &bounds ) &&
+        ( bounds.low > threshold || bounds.high <= threshold ) )
+    {
+        *above = bounds.low > threshold;
+
+        matheval->error = "";
+        return MathEvaluationSuccess;
+    }
+
+    if( MathEvaluationPerform( matheval, &result ) == MathEvaluationFailure )
+    {
+        return MathEvaluationFailure;
+    }
+
+    *above = result > threshold;
+
+    return MathEvaluationSuccess;
+}
+
+
+
+// Evaluates the expression and, in the same pass, the
+// partial derivatives of the result with respect to the
+// parameters `params` (forward mode differentiation):
+// each value of the program carries its derivatives, one
+// per parameter, computed by the rule of each operation.
+// The derivative of the factorial uses the digamma
+// function, max and min follow the chosen operand.
+// Errors are those of the `MathEvaluationStrict` policy
+// whatever the policy; the function fails also where
+// a derivative is not finite (for example x^0.5 for x = 0).
+
+MathEvaluationStatus MathEvaluationPerformDerivatives(
+    MathEvaluation *matheval,
+    const char     **params,    // parameter names
+    size_t         paramsCount,
+    double         *result,     // RETURN: the result of the evaluation
+    double         *partials )  // RETURN: the partial derivative for each parameter
+{
+    MathEvalParam *param;
+    MathEvalNode  *node;
+    double        *nodePartials,
+                  *stack;
+    size_t        *slots,
+                  most,
+                  i;
+
+    *result = 0;
+
+    for( i = 0; i < paramsCount; i++ )
+    {
+        partials[ i ] = 0;
+    }
+
+    if( ! matheval->compiled )
+    {
+        MathEvaluationCompile( matheval );
+        if( ! matheval->compiled )
+        {
+            return MathEvaluationFailure;
+        }
+    }
+
+    // the workspace holds the partials of a node (as
+    // many as its operands), the stack (a value and
+    // its derivatives) then the slots of the parameters
+
+    for( node = matheval->program, most = 0; node < matheval->program + matheval->programCount; node++ )
+    {
+        most = MathEvalOperandsCount( node ) > most ? MathEvalOperandsCount( node ) : most;
+    }
+
+    if( paramsCount > ( SIZE_MAX / sizeof( double ) - most - 1 ) / ( matheval->stackMaxDepth + 1 ) - 1 ||
+        ! MathEvalReserveWorkspace( matheval, ( most + matheval->stackMaxDepth * ( paramsCount + 1 ) ) * sizeof( double ) + paramsCount * sizeof( size_t ) ) )
+    {
+        matheval->error = "cannot allocate memory";
+        return MathEvaluationFailure;
+    }
+
+    nodePartials = (double *) matheval->workspace;
+    stack = nodePartials + most;
+    slots = (size_t *)( stack + matheval->stackMaxDepth * ( paramsCount + 1 ) );
+
+    for( i = 0; i < paramsCount; i++ )
+    {
+        for( param = matheval->params; param && strcmp( param->name, params[ i ] ) != 0; param = param->next );
+
+        if( ! param )
+        {
+            matheval->error = "unknown parameter";
+            return MathEvaluationFailure;
+        }
+
+        slots[ i ] = param->slot;
+    }
+
+    matheval->error = NULL;
+
+    if( ! MathEvalRunDerivatives( matheval, slots, paramsCount, nodePartials, stack, result, partials ) )
+    {
+        return MathEvaluationFailure;
+    }
+
+    matheval->error = "";
+    return MathEvaluationSuccess;
+}
+
+
+
+// Evaluates the expression and the gradient of the
+// result, its partial derivatives with respect to all
+// the parameters (`gradient[i]` for the parameter of
+// slot i, in order of definition), with a cost that does
+// not depend on their number (reverse mode differentiation):
+// the evaluation records on a tape the partial derivatives
+// of each node, a backward sweep accumulates them from
+// the result down to the parameters (see `MathEvalRunGradient`).
+// The tape lives in the workspace, reused by the calls.
+// Errors are those of `MathEvaluationPerformDerivatives`.
+
+MathEvaluationStatus MathEvaluationPerformGradient(
+    MathEvaluation *matheval,
+    double         *result,         // RETURN: the result of the evaluation
+    double         *gradient,       // RETURN: the partial derivative for each parameter
+    size_t         gradientSize )   // the entries of `gradient`, at least the parameters
+{
+    MathEvalNode *node,
+                 *end;
+    size_t       tapeSize,
+                 i;
+
+    *result = 0;
+
+    for( i = 0; i < gradientSize; i++ )
+    {
+        gradient[ i ] = 0;
+    }
+
+    if( ! matheval->compiled )
+    {
+        MathEvaluationCompile( matheval );
+        if( ! matheval->compiled )
+        {
+            return MathEvaluationFailure;
+        }
+    }
+
+    if( gradientSize < matheval->valuesCount )
+    {
+        matheval->error = "gradient too small";
+        return MathEvaluationFailure;
+    }
+
+    // the workspace holds the tape (the partials
+    // of the nodes) then the stack
+
+    end = matheval->program + matheval->programCount;
+
+    for( node = matheval->program, tapeSize = 0; node < end; node++ )
+    {
+        tapeSize += node->opcode == MEO_Val || node->opcode == MEO_Par ? 0 : MathEvalOperandsCount( node );
+    }
+
+    if( ! MathEvalReserveWorkspace( matheval, ( tapeSize + matheval->stackMaxDepth ) * sizeof( double ) ) )
+    {
+        return MathEvaluationFailure;
+    }
+
+    matheval->error = NULL;
+
+    if( ! MathEvalRunGradient( matheval, (double *) matheval->workspace, (double *) matheval->workspace + tapeSize, result, gradient ) )
+    {
+        return MathEvaluationFailure;
+    }
+
+    matheval->error = "";
+    return MathEvaluationSuccess;
+}
+
+
+
+// Allocates a column of `rows` values aligned to 64 bytes
+// for `MathEvaluationPerformColumns`; if `hugePages` is true
+// big columns are backed, when possible, by transparent
+// huge pages to reduce TLB misses.
+// The column must be freed with `MathEvaluationFreeColumn`.
+// Returns NULL in case of failure.
+
+double *MathEvaluationAllocColumn( size_t rows, bool hugePages )
+{
+    MathEvalColumn *column;
+    void           *memory;
+    size_t         size;
+
+    if( rows > ( SIZE_MAX - sizeof( MathEvalColumn ) - MATH_EVAL_HUGE_PAGE_SIZE ) / sizeof( double ) )
+    {
+        return NULL;
+    }
+
+    size = sizeof( MathEvalColumn ) + rows * sizeof( double );
+
+    if( hugePages && size >= MATH_EVAL_HUGE_PAGE_SIZE )
+    {
+        size = ( size + MATH_EVAL_HUGE_PAGE_SIZE - 1 ) & ~(size_t)( MATH_EVAL_HUGE_PAGE_SIZE - 1 );
+
+        memory = mmap( NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+        if( memory != MAP_FAILED )
+        {
+#ifdef MADV_HUGEPAGE
+            madvise( memory, size, MADV_HUGEPAGE );
+#endif
+            column = memory;
+            column->size = size;
+            column->mapped = true;
+
+            return (double *)( column + 1 );
+        }
+    }
+
+    if( posix_memalign( &memory, MATH_EVAL_COLUMNS_ALIGNMENT, size ) != 0 )
+    {
+        return NULL;
+    }
+
+    column = memory;
+    column->size = size;
+    column->mapped = false;
+
+    return (double *)( column + 1 );
+}
+
+
+
+// Frees a column allocated with `MathEvaluationAllocColumn`
+
+void MathEvaluationFreeColumn( double *values )
+{
+    MathEvalColumn *column;
+
+    if( ! values )
+    {
+        return;
+    }
+
+    column = (MathEvalColumn *) values - 1;
+
+    if( column->mapped )
+    {
+        munmap( column, column->size );
+    }
+    else
+    {
+        free( column );
+    }
+}
+
+
+
+// Enables a cache of the last results by parameter values:
+// `MathEvaluationPerform` looks the values of the parameters
+// up in the cache and skips the evaluation if they have
+// been already evaluated.
+// The cache holds up to `entries` results (rounded up to a
+// power of 2): when full the new results replace the old ones.
+// 0 disables the cache.
+// The cache is emptied when the expression is compiled again
+// (for example after a new parameter is defined).
+// The function returns a status of success or failure.
+
+MathEvaluationStatus MathEvaluationSetResultCache( MathEvaluation *matheval, size_t entries )
+{
+    size_t size;
+
+    MathEvalDropResults( matheval );
+    matheval->resultsSize = 0;
+
+    if( entries == 0 )
+    {
+        return MathEvaluationSuccess;
+    }
+
+    if( entries > ( (size_t) 1 << 40 ) )
+    {
+        matheval->error = "result cache is too big";
+        return MathEvaluationFailure;
+    }
+
+    for( size = MATH_EVAL_RESULTS_PROBES; size < entries; size *= 2 );
+
+    matheval->resultsSize = size;
+
+    return MathEvaluationSuccess;
+}
+
+
+
+
+// Enables or disables deferred checks: instead of checking
+// the result of each operation the evaluation runs
+// unchecked and floating point exceptions are tested once
+// at the end; only when an exception occurred the evaluation
+// is repeated with checks to find the error.
+// Results and errors are the same, evaluations that
+// succeed are faster.
+
+void MathEvaluationSetDeferredChecks( MathEvaluation *matheval, bool deferred )
+{
+    matheval->deferred = deferred;
+}
+
+
+
+
+// Sets how complex or too big results are handled:
+// `MathEvaluationStrict` (default) makes them errors;
+// `MathEvaluationPropagate` evaluates without any check,
+// infinities and NaNs propagate to the result and the
+// evaluation always succeeds (also the factorial of a
+// negative number is NaN);
+// `MathEvaluationSaturate` clamps results too big to
+// +/-DBL_MAX (also on division of a non zero number by
+// zero) while complex results are still errors.
+
+void MathEvaluationSetErrorPolicy( MathEvaluation *matheval, MathEvaluationErrorPolicy policy )
+{
+    matheval->policy = policy;
+
+    // cached results may have been computed
+    // with another policy
+
+    MathEvalDropResults( matheval );
+}
+
+
+
+
+// Enables the approximated (faster) sin, cos, exp, log
+// and pow in column evaluations: polynomials with as many
+// terms as needed so that the error of each function stays
+// within `tolerance`, relative to the result (absolute if
+// the result is smaller than 1), computed for the whole
+// block without branches.
+// Single evaluations keep the exact functions, faster
+// than the approximated ones one value at a time.
+// A tolerance of 0 (default) or below 1e-12 selects
+// the exact functions.
+// The function returns a status of success or failure.
+
+MathEvaluationStatus MathEvaluationSetApproximation( MathEvaluation *matheval, double tolerance )
+{
+    MathEvalApproximation *approximation;
+    double                budget;
+    uint32_t              n;
+
+    if( ! ( tolerance >= 0 ) )
+    {
+        matheval->error = "invalid tolerance";
+        return MathEvaluationFailure;
+    }
+
+    approximation = &matheval->approximation;
+    approximation->tolerance = tolerance < MATH_EVAL_APPROX_MIN_TOLERANCE ? 0 : tolerance;
+
+    // the truncation error of each series over the range
+    // left by the argument reduction (see the functions)
+    // is kept within a quarter of the budget, rounding
+    // errors take the rest
+
+    budget = approximation->tolerance / 4;
+
+    for( n = 1; n < 20 && 2 * pow( 0.3466, n + 1 ) * MathEvalInverseFactorials[ n + 1 ] > budget; n++ );
+    approximation->expTerms = n;
+
+    // log(b) / log(a) adds the errors of two logarithms,
+    // in pow the error of the logarithm is multiplied
+    // by the exponent of the result (at most ~745)
+
+    for( n = 1; n < 16 && 2 * pow( 0.1716, 2 * n ) * MathEvalInverseOdds[ n ] > budget / 2; n++ );
+    approximation->logTerms = n;
+
+    for( n = 1; n < 16 && 2 * pow( 0.1716, 2 * n ) * MathEvalInverseOdds[ n ] > budget / 1024; n++ );
+    approximation->powTerms = n;
+
+    for( n = 1; n < 10 && pow( M_PI_4, 2 * n ) * MathEvalInverseFactorials[ 2 * n + 1 ] > budget; n++ );
+    approximation->sinTerms = n;
+
+    for( n = 1; n < 10 && 1.5 * pow( M_PI_4, 2 * n ) * MathEvalInverseFactorials[ 2 * n ] > budget; n++ );
+    approximation->cosTerms = n;
+
+    // cached results may have been computed
+    // with other functions
+
+    MathEvalDropResults( matheval );
+
+    return MathEvaluationSuccess;
+}
+
+
+
+
+// Fits a piecewise Chebyshev approximation of the whole
+// expression over the domain [min, max] of the parameter
+// `param`, within `tolerance` (relative to the result,
+// absolute if the result is smaller than 1): values of
+// the parameter in the domain are evaluated with the
+// approximation (a polynomial) instead of the program.
+// The domain is split in as many equal pieces as needed.
+// The values of the other parameters are those at the
+// time of the call: when one of them changes (or the
+// expression is compiled again) the fit is dropped.
+// A NULL `param` drops the fit.
+// The function returns a status of success or failure
+// (the expression fails in the domain or the tolerance
+// cannot be reached).
+
+MathEvaluationStatus MathEvaluationFit(
+    MathEvaluation *matheval,
+    const char     *name,       // the parameter
+    double         min,         // its domain
+    double         max,
+    double         tolerance )
+{
+    MathEvalParam *param;
+    double        *coefficients,
+                  saved,
+                  width,
+                  tail;
+    size_t        pieces,
+                  piece;
+    uint32_t      terms,
+                  needed,
+                  j;
+
+    MathEvalDropFit( matheval );
+
+    if( ! name )
+    {
+        return MathEvaluationSuccess;
+    }
+
+    if( ! ( min < max ) || ! isfinite( min ) || ! isfinite( max ) )
+    {
+        matheval->error = "invalid domain";
+        return MathEvaluationFailure;
+    }
+
+    if( ! ( tolerance >= MATH_EVAL_APPROX_MIN_TOLERANCE ) )
+    {
+        matheval->error = "invalid tolerance";
+        return MathEvaluationFailure;
+    }
+
+    for( param = matheval->params; param && strcmp( param->name, name ) != 0; param = param->next );
+
+    if( ! param )
+    {
+        matheval->error = "unknown parameter";
+        return MathEvaluationFailure;
+    }
+
+    if( min < param->min || max > param->max )
+    {
+        matheval->error = "value out of bounds";
+        return MathEvaluationFailure;
+    }
+
+    if( ! matheval->compiled )
+    {
+        MathEvaluationCompile( matheval );
+        if( ! matheval->compiled )
+        {
+            return MathEvaluationFailure;
+        }
+    }
+
+    // the pieces are doubled until all of them are within
+    // the tolerance; an error of the expression ends the fit
+
+    saved = matheval->values[ param->slot ];
+    matheval->error = NULL;
+    coefficients = NULL;
+
+    for( pieces = 1; pieces <= MATH_EVAL_FIT_MAX_PIECES; pieces *= 2 )
+    {
+        coefficients = MathEvalAlloc( matheval, pieces * MATH_EVAL_FIT_NODES * sizeof( double ) );
+        if( ! coefficients )
+        {
+            matheval->error = "cannot allocate memory";
+            break;
+        }
+
+        width = ( max - min ) / (double) pieces;
+
+        for( piece = 0; piece < pieces; piece++ )
+        {
+            if( ! MathEvalFitPiece( matheval, param->slot, min + (double) piece * width, min + (double)( piece + 1 ) * width,
+                                    tolerance, coefficients + piece * MATH_EVAL_FIT_NODES ) )
+            {
+                break;
+            }
+        }
+
+        if( piece == pieces || matheval->error )
+        {
+            break;
+        }
+
+        MathEvalFree( matheval, coefficients );
+        coefficients = NULL;
+    }
+
+    matheval->values[ param->slot ] = saved;
+
+    if( ! coefficients || matheval->error )
+    {
+        MathEvalFree( matheval, coefficients );
+
+        if( ! matheval->error )
+        {
+            matheval->error = "tolerance cannot be reached";
+        }
+
+        return MathEvaluationFailure;
+    }
+
+    // the coefficients (decreasing) that do not add
+    // up to half the tolerance in any piece are
+    // dropped
+
+    terms = 1;
+
+    for( piece = 0; piece < pieces; piece++ )
+    {
+        tail = 0;
+        for( needed = MATH_EVAL_FIT_NODES; needed > 1; needed-- )
+        {
+            tail += fabs( coefficients[ piece * MATH_EVAL_FIT_NODES + needed - 1 ] );
+            if( tail > tolerance / 2 )
+            {
+                break;
+            }
+        }
+
+        terms = needed > terms ? needed : terms;
+    }
+
+    for( piece = 0; piece < pieces; piece++ )
+    {
+        for( j = 0; j < terms; j++ )
+        {
+            coefficients[ piece * terms + j ] = coefficients[ piece * MATH_EVAL_FIT_NODES + j ];
+        }
+    }
+
+    matheval->fit.coefficients = coefficients;
+    matheval->fit.pieces = pieces;
+    matheval->fit.terms = terms;
+    matheval->fit.slot = param->slot;
+    matheval->fit.min = min;
+    matheval->fit.max = max;
+    matheval->fit.width = width;
+
+    // cached results have been computed
+    // with the program
+
+    MathEvalDropResults( matheval );
+
+    MathEvalAccount( matheval, false );
+
+    matheval->error = "";
+
+    return MathEvaluationSuccess;
+}
+
+
+
+// Returns in `*hash` the 64 bit structural hash of
+// the compiled expression (compiling it if needed).
+// Expressions that differ only for whitespace, redundant
+// round brackets, aliases (`avg` and `average`, `pow(b,n)`
+// and `b^n`...), how numbers are written and the order of
+// the operands of `+`, `*`, `max` and `min` have the same
+// program and hash.
+// The function returns a status of success or failure.
+
+MathEvaluationStatus MathEvaluationGetHash(
+    MathEvaluation *matheval,
+    uint64_t       *hash )      // RETURN: the hash
+{
+    *hash = 0;
+
+    if( ! matheval->compiled && MathEvaluationCompile( matheval ) == MathEvaluationFailure )
+    {
+        return MathEvaluationFailure;
+    }
+
+    if( ! matheval->hashed && ! MathEvalHashProgram( matheval ) )
+    {
+        matheval->error = "cannot allocate memory";
+        return MathEvaluationFailure;
+    }
+
+    *hash = matheval->hash;
+
+    return MathEvaluationSuccess;
+}
+
+
+
+// Creates and compiles `count` expressions in parallel
+// using `threads` threads (0 means one per online CPU).
+// `params` is an optional array of `paramsCount` parameter
+// names that are set to 0 in every evaluation before
+// compiling, so that expressions referring to them are valid.
+// `evals[i]` receives the new `MathEvaluation` for
+// `expressions[i]` (NULL if memory allocation failed)
+// and `statuses[i]` the outcome of its compilation; the
+// error of a failed compilation is available with
+// `MathEvaluationGetError`.
+// Evaluations are returned even if compilation failed
+// and must be freed with `MathEvaluationDispose`.
+// The function returns `MathEvaluationSuccess` if all the
+// expressions have been compiled.
+
+MathEvaluationStatus MathEvaluationNewBatch(
+    const char           **expressions,
+    size_t                 count,
+    const char           **params,
+    size_t                 paramsCount,
+    unsigned int           threads,
+    MathEvaluation       **evals,         // RETURN: the evaluations
+    MathEvaluationStatus  *statuses )     // RETURN: the status of each compilation
+{
+    MathEvalBatchJob *jobs;
+    pthread_t        *workers;
+    bool             *started;
+    long             online;
+    size_t           i;
+
+    if( threads == 0 )
+    {
+        online = sysconf( _SC_NPROCESSORS_ONLN );
+        threads = online > 0 ? (unsigned int) online : 1;
+    }
+
+    if( threads > count )
+    {
+        threads = count > 0 ? (unsigned int) count : 1;
+    }
+
+    jobs = malloc( threads * sizeof( MathEvalBatchJob ) );
+    workers = malloc( threads * sizeof( pthread_t ) );
+    started = malloc( threads * sizeof( bool ) );
+
+    if( ! jobs || ! workers || ! started )
+    {
+        free( jobs );
+        free( workers );
+        free( started );
+        for( i = 0; i < count; i++ )
+        {
+            evals[ i ] = NULL;
+            statuses[ i ] = MathEvaluationFailure;
+        }
+        return MathEvaluationFailure;
+    }
+
+    for( i = 0; i < threads; i++ )
+    {
+        jobs[ i ].expressions = expressions;
+        jobs[ i ].count = count;
+        jobs[ i ].params = params;
+        jobs[ i ].paramsCount = paramsCount;
+        jobs[ i ].evals = evals;
+        jobs[ i ].statuses = statuses;
+        jobs[ i ].first = i;
+        jobs[ i ].step = threads;
+    }
+
+    // the first slice is compiled by the calling thread,
+    // slices whose thread cannot be started too
+
+    for( i = 1; i < threads; i++ )
+    {
+        started[ i ] = pthread_create( &workers[ i ], NULL, MathEvalBatchWorker, &jobs[ i ] ) == 0;
+    }
+
+    MathEvalBatchWorker( &jobs[ 0 ] );
+
+    for( i = 1; i < threads; i++ )
+    {
+        if( started[ i ] )
+        {
+            pthread_join( workers[ i ], NULL );
+        }
+        else
+        {
+            MathEvalBatchWorker( &jobs[ i ] );
+        }
+    }
+
+    free( jobs );
+    free( workers );
+    free( started );
+
+    for( i = 0; i < count; i++ )
+    {
+        if( statuses[ i ] == MathEvaluationFailure )
+        {
+            return MathEvaluationFailure;
+        }
+    }
+
+    return MathEvaluationSuccess;
+}
+
+
+
+// Writes the compiled expression as an image that
+// can be stored and loaded back, even by another process,
+// with `MathEvaluationNewFromImage`.
+// The image contains the program, the names of the
+// parameters (not their values) and the expression;
+// it has no pointers so it can be memory mapped.
+// Its size is a multiple of 8 bytes so images can be
+// concatenated in a single file.
+// The expression is compiled if needed.
+// Returns the size of the image, which is written only
+// if `size` is big enough, or 0 if the expression cannot
+// be compiled.
+
+size_t MathEvaluationWriteImage(
+    MathEvaluation *matheval,
+    void           *buffer,   // RETURN: the image, may be NULL to get the size
+    size_t          size )    // size of the buffer
+{
+    MathEvalImage *image;
+    MathEvalParam *param;
+    char          *names;
+    size_t        slotsSize,
+                  expressionSize,
+                  total,
+                  i;
+    uint32_t      slot;
+
+    if( ! matheval->compiled && MathEvaluationCompile( matheval ) == MathEvaluationFailure )
+    {
+        return 0;
+    }
+
+    slotsSize = 0;
+    for( param = matheval->params; param != NULL; param = param->next )
+    {
+        slotsSize += param->len + 1;
+    }
+
+    expressionSize = strlen( matheval->expression ) + 1;
+
+    total = sizeof( MathEvalImage ) + matheval->programCount * sizeof( MathEvalNode ) + slotsSize + expressionSize;
+    total = ( total + 7 ) & ~(size_t) 7;
+
+    if( buffer == NULL || size < total )
+    {
+        return total;
+    }
+
+    memset( buffer, 0, total );
+
+    image = buffer;
+    memcpy( image->magic, MATH_EVAL_IMAGE_MAGIC, sizeof( image->magic ) );
+    image->version = MATH_EVAL_IMAGE_VERSION;
+    image->byteOrder = MATH_EVAL_IMAGE_ORDER;
+    image->nodeSize = sizeof( MathEvalNode );
+    image->nodesCount = (uint32_t) matheval->programCount;
+    image->slotsCount = (uint32_t) matheval->valuesCount;
+    image->stackSize = (uint32_t) matheval->stackMaxDepth;
+    image->size = total;
+    image->nodesOffset = sizeof( MathEvalImage );
+    image->slotsOffset = image->nodesOffset + matheval->programCount * sizeof( MathEvalNode );
+    image->expressionOffset = image->slotsOffset + slotsSize;
+
+    memcpy( (char *) image + image->nodesOffset, matheval->program, matheval->programCount * sizeof( MathEvalNode ) );
+
+    // the checks are dropped for the bounds of this
+    // evaluation, not of those that load the image
+
+    for( i = 0; i < matheval->programCount; i++ )
+    {
+        ( (MathEvalNode *)( (char *) image + image->nodesOffset ) )[ i ].flags = 0;
+    }
+
+    // names in slot order
+
+    names = (char *) image + image->slotsOffset;
+    for( slot = 0; slot < image->slotsCount; slot++ )
+    {
+        for( param = matheval->params; param->slot != slot; param = param->next );
+
+        memcpy( names, param->name, param->len + 1 );
+        names += param->len + 1;
+    }
+
+    memcpy( (char *) image + image->expressionOffset, matheval->expression, expressionSize );
+
+    return total;
+}
+
+
+
+// Returns a new `MathEvaluation` for the image written by
+// `MathEvaluationWriteImage` or NULL if the image is not valid
+// or memory cannot be allocated.
+// The image is not copied nor parsed: program and expression
+// are used in place so the image (for example a memory mapped file)
+// must be 8 bytes aligned and must outlive the evaluation.
+// The parameters of the image are defined with value 0.
+// If `imageSize` is not NULL it receives the size of the image,
+// that is the offset of the next image if they are concatenated.
+// The MathEvaluation returned must be freed with
+// `MathEvaluationDispose`.
+
+MathEvaluation *MathEvaluationNewFromImage(
+    const void *buffer,     // the image
+    size_t      size,       // bytes available at `buffer`
+    size_t     *imageSize ) // RETURN: the size of the image
+{
+    const MathEvalImage *image;
+    MathEvaluation      *matheval;
+    const char          *name;
+    uint32_t            slot;
+
+    image = buffer;
+
+    if( ! MathEvalImageVerify( image, size ) )
+    {
+        return NULL;
+    }
+
+    matheval = MathEvalNew( (const char *) image + image->expressionOffset, 0, false, NULL );
+    if( ! matheval )
+    {
+        return NULL;
+    }
+
+    name = (const char *) image + image->slotsOffset;
+    for( slot = 0; slot < image->slotsCount; slot++ )
+    {
+        if( MathEvaluationSetParam( matheval, name, 0 ) == MathEvaluationFailure || matheval->valuesCount != slot + 1 )
+        {
+            MathEvaluationDispose( matheval );
+            return NULL;
+        }
+
+        name += strlen( name ) + 1;
+    }
+
+    matheval->stackMaxDepth = image->stackSize;
+
+    matheval->program = (MathEvalNode *)( (const char *) image + image->nodesOffset );
+    matheval->programCount = image->nodesCount;
+    matheval->programSize = 0;
+    matheval->ownsProgram = false;
+
+    if( ! MathEvalPrepareStack( matheval ) )
+    {
+        MathEvaluationDispose( matheval );
+        return NULL;
+    }
+
+    matheval->integer = MathEvalIsInteger( matheval );
+    matheval->bounded = MathEvalIsBounded( matheval );
+    matheval->safe = false;
+    matheval->compiled = true;
+    matheval->hashed = false;
+
+    MathEvalAccount( matheval, false );
+
+    if( imageSize )
+    {
+        *imageSize = (size_t) image->size;
+    }
+
+    return matheval;
+}
+
+
+
+// Enables the compile cache: compiled expressions are
+// stored as images (see `MathEvaluationWriteImage`) in the
+// directory `path`, keyed by a hash of the library version,
+// the expression and the names of the parameters, and
+// loaded back instead of compiling the same expression again,
+// also by other processes.
+// `NULL` disables the cache.
+// If this function is not called the cache directory is
+// taken from the `MATHEVAL_CACHE_DIR` environment variable.
+// The directory must exist; the cache is best-effort:
+// a file that cannot be read or written is ignored.
+// Not thread-safe: call it before compiling expressions.
+
+MathEvaluationStatus MathEvaluationSetCacheDirectory( const char *path )
+{
+    char *directory;
+
+    pthread_once( &MathEvalCacheOnce, MathEvalCacheInit );
+
+    directory = NULL;
+    if( path )
+    {
+        directory = malloc( strlen( path ) + 1 );
+        if( ! directory )
+        {
+            return MathEvaluationFailure;
+        }
+        strcpy( directory, path );
+    }
+
+    free( MathEvalCacheDirectory );
+    MathEvalCacheDirectory = directory;
+
+    return MathEvaluationSuccess;
+}
+
+
+
+// Opens a catalog of named formulas.
+// The file is made of lines in the form:
+//
+//     name = expression
+//
+// empty lines and lines beginning with `#` are ignored.
+// The file is mapped in memory and only an index
+// of the formulas is built: each formula is compiled
+// the first time it is evaluated.
+// Returns NULL if the file cannot be read, a line is
+// malformed or a name is defined twice.
+// The catalog must be closed with
+// `MathEvaluationCatalogClose`.
+
+MathEvaluationCatalog *MathEvaluationCatalogOpen( const char *path )
+{
+    MathEvaluationCatalog *catalog;
+    MathEvalCatalogEntry  *entry;
+    struct stat           info;
+    const char            *line,
+                          *next,
+                          *end,
+                          *equal,
+                          *name,
+                          *nameEnd;
+    size_t                lines,
+                          i;
+    int                   fd;
+
+    fd = open( path, O_RDONLY );
+    if( fd < 0 )
+    {
+        return NULL;
+    }
+
+    if( fstat( fd, &info ) != 0 || ! ( catalog = calloc( 1, sizeof( MathEvaluationCatalog ) ) ) )
+    {
+        close( fd );
+        return NULL;
+    }
+
+    pthread_mutex_init( &catalog->mutex, NULL );
+
+    catalog->size = (size_t) info.st_size;
+    catalog->map = catalog->size > 0 ? mmap( NULL, catalog->size, PROT_READ, MAP_PRIVATE, fd, 0 ) : NULL;
+    close( fd );
+
+    if( catalog->map == MAP_FAILED )
+    {
+        catalog->map = NULL;
+        MathEvaluationCatalogClose( catalog );
+        return NULL;
+    }
+
+    end = catalog->map + catalog->size;
+
+    // one entry at most per line
+
+    lines = 1;
+    for( line = catalog->map; line < end && ( line = memchr( line, '\n', end - line ) ); line++ )
+    {
+        lines++;
+    }
+
+    catalog->entries = malloc( lines * sizeof( MathEvalCatalogEntry ) );
+    if( ! catalog->entries )
+    {
+        MathEvaluationCatalogClose( catalog );
+        return NULL;
+    }
+
+    // index the formulas
+
+    for( line = catalog->map; line < end; line = next + 1 )
+    {
+        next = memchr( line, '\n', end - line );
+        if( ! next )
+        {
+            next = end;
+        }
+
+        name = line;
+        while( name < next && ( *name == ' ' || *name == '\t' || *name == '\r' ) )
+        {
+            name++;
+        }
+
+        if( name == next || *name == '#' )
+        {
+            continue;
+        }
+
+        equal = memchr( name, '=', next - name );
+        if( ! equal )
+        {
+            MathEvaluationCatalogClose( catalog );
+            return NULL;
+        }
+
+        nameEnd = equal;
+        while( nameEnd > name && ( nameEnd[ -1 ] == ' ' || nameEnd[ -1 ] == '\t' ) )
+        {
+            nameEnd--;
+        }
+
+        if( nameEnd == name )
+        {
+            MathEvaluationCatalogClose( catalog );
+            return NULL;
+        }
+
+        entry = &catalog->entries[ catalog->count++ ];
+        entry->name = name;
+        entry->nameLength = nameEnd - name;
+        entry->expression = equal + 1;
+        entry->expressionLength = next - ( equal + 1 );
+        entry->eval = NULL;
+    }
+
+    qsort( catalog->entries, catalog->count, sizeof( MathEvalCatalogEntry ), MathEvalCatalogCompare );
+
+    for( i = 1; i < catalog->count; i++ )
+    {
+        if( MathEvalCatalogCompare( &catalog->entries[ i - 1 ], &catalog->entries[ i ] ) == 0 )
+        {
+            MathEvaluationCatalogClose( catalog );
+            return NULL;
+        }
+    }
+
+    return catalog;
+}
+
+
+
+// Closes a catalog disposing the evaluations
+// that have been created
+
+void MathEvaluationCatalogClose( MathEvaluationCatalog *catalog )
+{
+    size_t i;
+
+    for( i = 0; i < catalog->count; i++ )
+    {
+        if( catalog->entries[ i ].eval )
+        {
+            MathEvaluationDispose( catalog->entries[ i ].eval );
+        }
+    }
+
+    pthread_mutex_destroy( &catalog->mutex );
+
+    if( catalog->map )
+    {
+        munmap( (void *) catalog->map, catalog->size );
+    }
+
+    free( catalog->entries );
+    free( catalog );
+}
+
+
+
+// Returns the number of formulas in a catalog
+
+size_t MathEvaluationCatalogCount( MathEvaluationCatalog *catalog )
+{
+    return catalog->count;
+}
+
+
+
+// Returns the evaluation of the formula `name`
+// or NULL if the formula does not exist or memory
+// cannot be allocated.
+// The evaluation is created on the first request
+// and compiled on its first evaluation.
+// The evaluation belongs to the catalog and must not be
+// disposed; it can be requested from several threads but
+// it must not be evaluated concurrently.
+
+MathEvaluation *MathEvaluationCatalogGet( MathEvaluationCatalog *catalog, const char *name )
+{
+    MathEvalCatalogEntry *entry;
+    MathEvaluation       *matheval;
+
+    entry = MathEvalCatalogFind( catalog, name, strlen( name ) );
+    if( ! entry )
+    {
+        return NULL;
+    }
+
+    pthread_mutex_lock( &catalog->mutex );
+
+    if( ! entry->eval )
+    {
+        entry->eval = MathEvalNew( entry->expression, entry->expressionLength, true, NULL );
+    }
+
+    matheval = entry->eval;
+
+    pthread_mutex_unlock( &catalog->mutex );
+
+    return matheval;
+}
+
+
+
+// Utility function to print the error after an
+// evaluation failed.
+// Prints the error description, the expression
+// and a caret under the expression approximately
+// where the error occurred.
+
+void MathEvaluationPrintError( MathEvaluation *matheval )
+{
+    if( matheval->error && strlen( matheval->error ) > 0 )
+    {
+        fprintf( stderr, "%s\n", matheval->error );
+        if( matheval->cursor != NULL )
+        {
+            fprintf( stderr, "%s\n", matheval->expression );
+            fprintf( stderr, "%*c^\n", (int)( matheval->cursor - matheval->expression ), ' ' );
+        }
+    }
+}
+
+
+
+// Debug utility function to dump params
+// that have been set (if any)
+
+void MathEvalDumpParams( MathEvaluation *matheval )
+{
+    MathEvalParam *p = matheval->params;
+    int count = 1;
+    while( p != NULL )
+    {
+        printf( "%d: %s = %f  ->  0x%lx\n", count, p->name, matheval->values[ p->slot ], (unsigned long) p );
+        p = p->next;
+        count++;
+        if(count>10) break;
+    }
+    printf( "\n---\n\n" );
+
+}
+
+
+
+// Debug utility function to dump the
+// compiled program (if any)
+
+void MathEvalDumpProgram( MathEvaluation *matheval )
+{
+    const char *names[] =
+    {
+        "val", "par", "neg", "add", "sub", "mul", "div", "pow", "fac", "sin", "cos",
+        "tan", "asin", "acos", "atan", "exp", "log", "logb", "max", "min", "avg"
+    };
+    MathEvalNode *node;
+    MathEvalParam *param;
+    size_t i;
+
+    for( i = 0; i < matheval->programCount; i++ )
+    {
+        node = &matheval->program[ i ];
+        printf( "%4zu: %-4s", i, names[ node->opcode ] );
+        if( node->opcode == MEO_Val ) printf( " %g", node->value );
+        if( node->opcode == MEO_Par )
+        {
+            for( param = matheval->params; param && param->slot != node->slot; param = param->next );
+            printf( " %s", param ? param->name : "?" );
+        }
+        if( node->opcode == MEO_Max || node->opcode == MEO_Min || node->opcode == MEO_Avg ) printf( " %" PRIu32, node->count );
+        printf( "   @%" PRIu32 "\n", node->position );
+    }
+    printf( "\n---\n\n" );
+}
+
+
+
+
+// *********************
+// * PRIVATE FUNCTIONS *
+// *********************
+
+
+
+// Allocates and initializes a `MathEvaluation`
+// copying the first `length` characters of
+// `expression`.
+// If `allocator` is not NULL it is used for all the
+// memory of the evaluation.
+// If `copy` is false then `expression` must be null
+// terminated and is used as is: it must outlive the
+// evaluation.
+
+MathEvaluation* MathEvalNew( const char *expression, size_t length, bool copy, const MathEvaluationAllocator *allocator )
+{
+    MathEvaluation *matheval;
+
+    if( allocator )
+    {
+        matheval = allocator->alloc( sizeof( MathEvaluation ), allocator->userData );
+    }
+    else
+    {
+        matheval = malloc( sizeof( MathEvaluation ) );
+    }
+
+    if( ! matheval )
+    {
+        return matheval;
+    }
+
+    MathEvalSetup( matheval, NULL, 0 );
+    matheval->allocated = true;
+
+    if( allocator )
+    {
+        matheval->allocator = *allocator;
+    }
+
+    if( ! MathEvalSetExpression( matheval, expression, length, copy ) )
+    {
+        MathEvaluationDispose( matheval );
+        return NULL;
+    }
+
+    MathEvalAccount( matheval, false );
+
+    return matheval;
+}
+
+
+
+// Initializes the fields of a `MathEvaluation`.
+// If `buffer` is not NULL all the memory of the
+// evaluation is taken from the `size` bytes
+// at `buffer`.
+
+void MathEvalSetup( MathEvaluation *matheval, void *buffer, size_t size )
+{
+    uintptr_t aligned;
+
+    matheval->expression = "";
+    matheval->ownsExpression = false;
+    matheval->ownsProgram = true;
+    matheval->allocated = false;
+
+    matheval->buffer = NULL;
+    matheval->bufferSize = 0;
+    matheval->bufferUsed = 0;
+
+    matheval->allocator.alloc = NULL;
+    matheval->allocator.free = NULL;
+    matheval->allocator.userData = NULL;
+    matheval->arena = NULL;
+
+    memset( &matheval->footprint, 0, sizeof( MathEvaluationFootprint ) );
+
+    if( buffer )
+    {
+        aligned = ( (uintptr_t) buffer + 15 ) & ~(uintptr_t) 15;
+        matheval->buffer = (unsigned char *) aligned;
+        if( aligned - (uintptr_t) buffer < size )
+        {
+            matheval->bufferSize = size - ( aligned - (uintptr_t) buffer );
+        }
+    }
+
+    matheval->params = NULL;
+    matheval->paramsSize = 0;
+    matheval->values = NULL;
+    matheval->valuesCount = 0;
+    matheval->valuesSize = 0;
+    matheval->cursor = NULL;
+    matheval->result = 0.0;
+    matheval->roundBracketsCount = 0;
+    matheval->error = "";
+
+    matheval->param = NULL;
+    matheval->program = NULL;
+    matheval->programCount = 0;
+    matheval->programSize = 0;
+    matheval->compiled = false;
+    matheval->hashed = false;
+    matheval->hash = 0;
+    matheval->integer = false;
+    matheval->bounded = false;
+    matheval->safe = false;
+    matheval->deferred = false;
+    matheval->policy = MathEvaluationStrict;
+    matheval->approximation.tolerance = 0;
+    matheval->fit.coefficients = NULL;
+    matheval->results = NULL;
+    matheval->resultsSize = 0;
+    matheval->resultsStride = 0;
+    matheval->stack = NULL;
+    matheval->stackSize = 0;
+    matheval->memos = NULL;
+    matheval->stackDepth = 0;
+    matheval->stackMaxDepth = 0;
+    matheval->workspace = NULL;
+    matheval->workspaceSize = 0;
+}
+
+
+
+// Sets the expression of an evaluation copying its
+// first `length` characters, or using it as is if
+// `copy` is false (then it must be null terminated).
+// Returns false if memory cannot be allocated.
+
+bool MathEvalSetExpression( MathEvaluation *matheval, const char *expression, size_t length, bool copy )
+{
+    char *copied;
+
+    if( ! copy )
+    {
+        matheval->expression = expression;
+        matheval->ownsExpression = false;
+        return true;
+    }
+
+    copied = MathEvalArenaAlloc( matheval, length + 1 );
+    if( ! copied )
+    {
+        return false;
+    }
+
+    memcpy( copied, expression, length );
+    copied[ length ] = '\0';
+
+    matheval->expression = copied;
+    matheval->ownsExpression = true;
+
+    return true;
+}
+
+
+
+// Allocates `size` bytes for an evaluation: from
+// the heap, from the allocator passed to
+// `MathEvaluationNewWithAllocator` or, if the evaluation
+// has been initialized with `MathEvaluationInit`, from
+// its buffer.
+// Blocks of the buffer and of the allocator are
+// preceded by their size so that they can be grown.
+// Returns NULL if memory cannot be allocated.
+
+void *MathEvalAlloc( MathEvaluation *matheval, size_t size )
+{
+    MathEvalBlock *block;
+
+    if( ! matheval->buffer )
+    {
+        if( ! matheval->allocator.alloc )
+        {
+            return malloc( size );
+        }
+
+        if( size > SIZE_MAX - sizeof( MathEvalBlock ) )
+        {
+            return NULL;
+        }
+
+        block = matheval->allocator.alloc( sizeof( MathEvalBlock ) + size, matheval->allocator.userData );
+        if( ! block )
+        {
+            return NULL;
+        }
+
+        block->size = size;
+        return block + 1;
+    }
+
+    size = ( size + 15 ) & ~(size_t) 15;
+
+    if( size > matheval->bufferSize - matheval->bufferUsed ||
+        sizeof( MathEvalBlock ) > matheval->bufferSize - matheval->bufferUsed - size )
+    {
+        return NULL;
+    }
+
+    block = (MathEvalBlock *)( matheval->buffer + matheval->bufferUsed );
+    block->size = size;
+    matheval->bufferUsed += sizeof( MathEvalBlock ) + size;
+
+    return block + 1;
+}
+
+
+
+// Like `realloc` for the memory of an evaluation:
+// the last block of the buffer grows in place,
+// other blocks are moved.
+
+void *MathEvalRealloc( MathEvaluation *matheval, void *memory, size_t size )
+{
+    MathEvalBlock *block;
+    void          *moved;
+    size_t        aligned;
+
+    if( ! matheval->buffer && ! matheval->allocator.alloc )
+    {
+        return realloc( memory, size );
+    }
+
+    if( ! memory )
+    {
+        return MathEvalAlloc( matheval, size );
+    }
+
+    block = (MathEvalBlock *) memory - 1;
+
+    if( ! matheval->buffer )
+    {
+        if( size <= block->size )
+        {
+            return memory;
+        }
+
+        moved = MathEvalAlloc( matheval, size );
+        if( moved )
+        {
+            memcpy( moved, memory, block->size );
+            matheval->allocator.free( block, matheval->allocator.userData );
+        }
+
+        return moved;
+    }
+    aligned = ( size + 15 ) & ~(size_t) 15;
+
+    if( aligned <= block->size )
+    {
+        return memory;
+    }
+
+    if( (unsigned char *) memory + block->size == matheval->buffer + matheval->bufferUsed )
+    {
+        if( aligned - block->size > matheval->bufferSize - matheval->bufferUsed )
+        {
+            return NULL;
+        }
+
+        matheval->bufferUsed += aligned - block->size;
+        block->size = aligned;
+        return memory;
+    }
+
+    moved = MathEvalAlloc( matheval, size );
+    if( moved )
+    {
+        memcpy( moved, memory, block->size );
+    }
+
+    return moved;
+}
+
+
+
+// Like `calloc` for the memory of an evaluation
+
+void *MathEvalCalloc( MathEvaluation *matheval, size_t count, size_t size )
+{
+    void *memory;
+
+    if( size != 0 && count > SIZE_MAX / size )
+    {
+        return NULL;
+    }
+
+    memory = MathEvalAlloc( matheval, count * size );
+    if( memory )
+    {
+        memset( memory, 0, count * size );
+    }
+
+    return memory;
+}
+
+
+
+// Releases memory of an evaluation; in the buffer
+// only the last block is actually released.
+
+void MathEvalFree( MathEvaluation *matheval, void *memory )
+{
+    MathEvalBlock *block;
+
+    if( ! matheval->buffer && ! matheval->allocator.alloc )
+    {
+        free( memory );
+        return;
+    }
+
+    if( ! memory )
+    {
+        return;
+    }
+
+    block = (MathEvalBlock *) memory - 1;
+
+    if( ! matheval->buffer )
+    {
+        matheval->allocator.free( block, matheval->allocator.userData );
+        return;
+    }
+
+    if( (unsigned char *) memory + block->size == matheval->buffer + matheval->bufferUsed )
+    {
+        matheval->bufferUsed = (unsigned char *) block - matheval->buffer;
+    }
+}
+
+
+
+// Allocates `size` bytes from the arena of an
+// evaluation, where the structures built by the compiler
+// (expression copy, parameters, program) live.
+// Arena blocks are never released one by one: the
+// whole arena is released by `MathEvaluationDispose`.
+
+void *MathEvalArenaAlloc( MathEvaluation *matheval, size_t size )
+{
+    MathEvalChunk *chunk;
+    MathEvalBlock *block;
+    size_t        chunkSize;
+
+    if( matheval->buffer )
+    {
+        return MathEvalAlloc( matheval, size );
+    }
+
+    if( size > SIZE_MAX / 2 - sizeof( MathEvalBlock ) )
+    {
+        return NULL;
+    }
+
+    size = ( size + 15 ) & ~(size_t) 15;
+
+    chunk = matheval->arena;
+
+    if( ! chunk || sizeof( MathEvalBlock ) + size > chunk->size - chunk->used )
+    {
+        chunkSize = chunk ? chunk->size * 2 : MATH_EVAL_ARENA_SIZE;
+        if( chunkSize < sizeof( MathEvalBlock ) + size )
+        {
+            chunkSize = sizeof( MathEvalBlock ) + size;
+        }
+
+        chunk = MathEvalAlloc( matheval, sizeof( MathEvalChunk ) + chunkSize );
+        if( ! chunk )
+        {
+            return NULL;
+        }
+
+        chunk->next = matheval->arena;
+        chunk->size = chunkSize;
+        chunk->used = 0;
+        matheval->arena = chunk;
+    }
+
+    block = (MathEvalBlock *)( chunk->data + chunk->used );
+    block->size = size;
+    chunk->used += sizeof( MathEvalBlock ) + size;
+
+    return block + 1;
+}
+
+
+
+// Like `realloc` for the arena: the last block of the
+// current chunk grows in place, other blocks are copied
+// (the old copy is released with the arena).
+
+void *MathEvalArenaRealloc( MathEvaluation *matheval, void *memory, size_t size )
+{
+    MathEvalChunk *chunk;
+    MathEvalBlock *block;
+    void          *moved;
+    size_t        aligned;
+
+    if( matheval->buffer )
+    {
+        return MathEvalRealloc( matheval, memory, size );
+    }
+
+    if( ! memory )
+    {
+        return MathEvalArenaAlloc( matheval, size );
+    }
+
+    block = (MathEvalBlock *) memory - 1;
+    aligned = ( size + 15 ) & ~(size_t) 15;
+
+    if( aligned <= block->size )
+    {
+        return memory;
+    }
+
+    chunk = matheval->arena;
+
+    if( (unsigned char *) memory + block->size == chunk->data + chunk->used &&
+        aligned - block->size <= chunk->size - chunk->used )
+    {
+        chunk->used += aligned - block->size;
+        block->size = aligned;
+        return memory;
+    }
+
+    moved = MathEvalArenaAlloc( matheval, size );
+    if( moved )
+    {
+        memcpy( moved, memory, block->size );
+    }
+
+    return moved;
+}
+
+
+
+// Releases the whole arena of an evaluation
+
+void MathEvalArenaFree( MathEvaluation *matheval )
+{
+    MathEvalChunk *chunk,
+                  *next;
+
+    chunk = matheval->arena;
+    while( chunk != NULL )
+    {
+        next = chunk->next;
+        MathEvalFree( matheval, chunk );
+        chunk = next;
+    }
+
+    matheval->arena = NULL;
+}
+
+
+
+// Empties the arena of an evaluation keeping
+// its largest (most recent) chunk
+
+void MathEvalArenaReset( MathEvaluation *matheval )
+{
+    MathEvalChunk *chunk;
+
+    if( matheval->buffer )
+    {
+        matheval->bufferUsed = 0;
+        return;
+    }
+
+    chunk = matheval->arena;
+    if( ! chunk )
+    {
+        return;
+    }
+
+    matheval->arena = chunk->next;
+    MathEvalArenaFree( matheval );
+
+    chunk->next = NULL;
+    chunk->used = 0;
+    matheval->arena = chunk;
+}
+
+
+
+// Returns how much of the arena is taken: together
+// with the current chunk it marks the point where
+// `MathEvalArenaRewind` can bring the arena back
+
+size_t MathEvalArenaUsed( MathEvaluation *matheval )
+{
+    if( matheval->buffer )
+    {
+        return matheval->bufferUsed;
+    }
+
+    return matheval->arena ? matheval->arena->used : 0;
+}
+
+
+
+// Gives back to the arena the blocks taken after
+// `chunk` was the current chunk with `used` bytes
+// taken; chunks added in the meantime are kept
+// (empty only the last one)
+
+void MathEvalArenaRewind( MathEvaluation *matheval, MathEvalChunk *chunk, size_t used )
+{
+    if( matheval->buffer )
+    {
+        matheval->bufferUsed = used;
+    }
+    else if( matheval->arena && matheval->arena == chunk )
+    {
+        chunk->used = used;
+    }
+    else if( matheval->arena )
+    {
+        matheval->arena->used = 0;
+    }
+}
+
+
+
+// Computes the memory used by an evaluation
+// (see `MathEvaluationGetFootprint`)
+
+void MathEvalFootprint( MathEvaluation *matheval, MathEvaluationFootprint *footprint )
+{
+    MathEvalChunk *chunk;
+    size_t        header,
+                  used;
+
+    footprint->count = 1;
+    footprint->expression = matheval->ownsExpression ? strlen( matheval->expression ) + 1 : 0;
+    footprint->params = matheval->paramsSize;
+    footprint->program = matheval->programSize * sizeof( MathEvalNode ) +
+                         ( matheval->fit.coefficients ? matheval->fit.pieces * matheval->fit.terms * sizeof( double ) : 0 );
+    footprint->values = matheval->valuesSize * sizeof( double );
+    footprint->stack = matheval->stackSize * sizeof( double ) + matheval->workspaceSize;
+    footprint->results = matheval->results ? matheval->resultsSize * matheval->resultsStride : 0;
+
+    used = footprint->expression + footprint->params + footprint->program +
+           footprint->values + footprint->stack + footprint->results;
+
+    if( matheval->buffer )
+    {
+        footprint->total = matheval->bufferUsed;
+    }
+    else
+    {
+        header = matheval->allocator.alloc ? sizeof( MathEvalBlock ) : 0;
+
+        footprint->total = matheval->allocated ? sizeof( MathEvaluation ) : 0;
+        footprint->total += footprint->values + footprint->stack + footprint->results;
+        footprint->total += matheval->fit.coefficients ? matheval->fit.pieces * MATH_EVAL_FIT_NODES * sizeof( double ) : 0;
+        footprint->total += header * ( ( matheval->values != NULL ) + ( matheval->stack != NULL ) +
+                                       ( matheval->results != NULL ) + ( matheval->workspace != NULL ) +
+                                       ( matheval->fit.coefficients != NULL ) );
+
+        for( chunk = matheval->arena; chunk != NULL; chunk = chunk->next )
+        {
+            footprint->total += header + sizeof( MathEvalChunk ) + chunk->size;
+        }
+    }
+
+    footprint->other = footprint->total > used ? footprint->total - used : 0;
+}
+
+
+
+// Updates the totals of the process with the memory
+// now used by an evaluation; if `disposed` is true
+// the evaluation is removed from the totals.
+// Evaluations in caller provided storage are not
+// counted as they may never be disposed.
+
+void MathEvalAccount( MathEvaluation *matheval, bool disposed )
+{
+    MathEvaluationFootprint
+            footprint,
+            *total;
+
+    if( matheval->buffer )
+    {
+        return;
+    }
+
+    if( disposed )
+    {
+        memset( &footprint, 0, sizeof( footprint ) );
+    }
+    else
+    {
+        MathEvalFootprint( matheval, &footprint );
+    }
+
+    total = &MathEvalTotalFootprint;
+
+    pthread_mutex_lock( &MathEvalTotalFootprintMutex );
+
+    total->count      += footprint.count      - matheval->footprint.count;
+    total->expression += footprint.expression - matheval->footprint.expression;
+    total->params     += footprint.params     - matheval->footprint.params;
+    total->program    += footprint.program    - matheval->footprint.program;
+    total->values     += footprint.values     - matheval->footprint.values;
+    total->stack      += footprint.stack      - matheval->footprint.stack;
+    total->results    += footprint.results    - matheval->footprint.results;
+    total->other      += footprint.other      - matheval->footprint.other;
+    total->total      += footprint.total      - matheval->footprint.total;
+
+    pthread_mutex_unlock( &MathEvalTotalFootprintMutex );
+
+    matheval->footprint = footprint;
+}
+
+
+
+// Creates the key of the per thread
+// pools of evaluations (once)
+
+void MathEvalPoolInit( void )
+{
+    pthread_key_create( &MathEvalPoolKey, MathEvalPoolDispose );
+}
+
+
+
+// Disposes the evaluations of the pool of
+// a thread when it exits
+
+void MathEvalPoolDispose( void *memory )
+{
+    MathEvalPool *pool;
+
+    pool = memory;
+
+    while( pool->count > 0 )
+    {
+        MathEvaluationDispose( pool->evals[ --pool->count ] );
+    }
+
+    free( pool );
+}
+
+
+
+
+// Compiles a single value or expression A0 or
+// sequence of 2 or more addends:
+// A1 - A2 [ + A3 [ - A4 ... ] ]
+// Addends can be a single values or expressions with
+// higher precedence. In the second case the expression is compiled first.
+// "breakOn" parameters define cases where the function must exit.
+
+void MathEvalProcessAddends(
+    MathEvaluation *matheval,
+    int64_t         breakOnRoundBracketsCount, // If open brackets count goes down to this count then exit;
+    bool            breakOnETEof,              // exit if the end of the string '\0' is met;
+    bool            breakOnETcom,              // exit if a comma is met;
+    MathEvalToken  *tokenThatCausedBreak )     // if pointer is not null the token/symbol that caused the function to exit.
+{
+    MathEvalToken
+           leftOp,
+           rightOp;
+
+    bool   first;
+
+
+    // The first addend is left on the stack,
+    // the following ones are summed or subtracted
+
+    first = true;
+    rightOp = MET_Sum;
+
+    do
+    {
+        leftOp = rightOp;
+
+        // [ Each addend A is treated as a (potential and higher-precedence)
+        //   multiplication and compiled with the function below ]
+        MathEvalProcessFactors( matheval, false, &rightOp );
+        if( matheval->error ) return;
+
+        if( ! first )
+        {
+            if( ! MathEvalEmit( matheval, leftOp == MET_Sum ? MEO_Add : MEO_Sub, 0, 0, 0 ) ) return;
+        }
+
+        first = false;
+
+        // ...and go on as long there are sums ands subs.
+    }
+    while( rightOp == MET_Sum || rightOp == MET_Sub );
+
+    // A round close bracket:
+    // check for negative count.
+
+    if( rightOp == MET_rbc )
+    {
+        matheval->roundBracketsCount--;
+        if( matheval->roundBracketsCount < 0 )
+        {
+            matheval->error = "unexpected close round bracket";
+            return;
+        }
+    }
+
+    // Returns the token that caused the function to exit
+
+    if( tokenThatCausedBreak )
+    {
+        *tokenThatCausedBreak = rightOp;
+    }
+
+    // Check if must exit
+
+    if( ( matheval->roundBracketsCount == breakOnRoundBracketsCount ) || ( breakOnETEof && rightOp == MET_Eof ) || ( breakOnETcom && rightOp == MET_com ) )
+    {
+        return;
+    }
+
+    // If not it's an error.
+
+    switch( rightOp )
+    {
+        case MET_Eof:
+            matheval->error = "unexpected end of expression";
+            break;
+
+        case MET_rbc:
+            matheval->error = "unexpected close round bracket";
+            break;
+
+        case MET_com:
+            matheval->error = "unexpeced comma";
+            break;
+
+        default:
+            matheval->error = "unexpeced symbol";
+            break;
+    }
+}
+
+
+
+// Compiles a sequence of 1 or more multiplies or divisions
+// F1 [ * F2  [ / F3 [ * F4 ... ] ] ]
+// Where Fn is a value or a higher precedence expression.
+
+void MathEvalProcessFactors(
+    MathEvaluation *matheval,
+    bool            isExponent,// is an exponent being compiled ?
+    MathEvalToken  *leftOp )  // RETURN: factors are over, this is the next operator (token).
+{
+    MathEvalToken
+           token,
+           nextOp,
+           op;
+
+    double value;
+    bool   negative,
+           first;
+
+    first = true;
+    op = MET_Mul;
+
+    do
+    {
+        value = MathEvalProcessToken( matheval, &token );
+        if( matheval->error ) return;
+
+        // Unary minus or plus ?
+        // store the sign and get the next token
+
+        if( token == MET_Sub )
+        {
+            negative = true;
+            value = MathEvalProcessToken( matheval, &token );
+            if( matheval->error ) return;
+        }
+        else if( token == MET_Sum )
+        {
+            negative = false;
+            value = MathEvalProcessToken( matheval, &token );
+            if( matheval->error ) return;
+        }
+        else
+        {
+            negative = false;
+        }
+
+        // Open round bracket?
+        // The expression between brackets is compiled.
+
+        if( token == MET_rbo )
+        {
+            matheval->roundBracketsCount++;
+
+            MathEvalProcessAddends( matheval, matheval->roundBracketsCount - 1, false, false, NULL );
+            if( matheval->error ) return;
+
+            token = MET_Val;
+        }
+
+        // A function ?
+
+        else if( token == MET_Cos || token == MET_Sin || token == MET_Tan || token == MET_ASi || token == MET_ACo || token == MET_ATa || token == MET_Fac || token == MET_Log || token == MET_Exp || token == MET_Pow || token == MET_Max || token == MET_Min || token == MET_Avg )
+        {
+            MathEvalProcessFunction( matheval, token );
+            if( matheval->error ) return;
+
+            token = MET_Val;
+        }
+
+        // A number or a parameter ?
+
+        else if( token == MET_Val )
+        {
+            if( ! MathEvalEmit( matheval, MEO_Val, 0, value, 0 ) ) return;
+        }
+
+        else if( token == MET_Par )
+        {
+            if( ! MathEvalEmit( matheval, MEO_Par, 0, 0, matheval->param->slot ) ) return;
+
+            token = MET_Val;
+        }
+
+        // Excluded previous cases then
+        // it's an error.
+
+        if( token != MET_Val )
+        {
+            matheval->error = "expected value";
+            return;
+        }
+
+        // Get beforehand the next token
+        // to see if it's an exponential or factorial operator
+
+        MathEvalProcessToken( matheval, &nextOp );
+        if( matheval->error ) return;
+
+        // Unary minus precedence (highest/lowest) affects this section of code
+
+        if( nextOp == MET_Fct )
+        {
+            MathEvalProcessFactorial( matheval, &nextOp );
+            if( matheval->error ) return;
+        }
+
+        if( nextOp == MET_Exc )
+        {
+            MathEvalProcessExponentiation( matheval, &nextOp );
+            if( matheval->error ) return;
+        }
+
+        // The sign is applied to the factor; a negative
+        // constant is folded
+
+        if( negative )
+        {
+            if( matheval->program[ matheval->programCount - 1 ].opcode == MEO_Val )
+            {
+                matheval->program[ matheval->programCount - 1 ].value *= -1;
+            }
+            else
+            {
+                if( ! MathEvalEmit( matheval, MEO_Neg, 0, 0, 0 ) ) return;
+            }
+        }
+
+        // multiplication/division of the
+        // factors computed so far
+
+        if( ! first )
+        {
+            if( ! MathEvalEmit( matheval, op == MET_Mul ? MEO_Mul : MEO_Div, 0, 0, 0 ) ) return;
+        }
+
+        first = false;
+
+        // The next operator has already been fetched.
+
+        op = nextOp;
+
+        // Go on as long multiply or division operators are met...
+        // ...unless an exponent is compiled
+        // (because exponentiation ^ operator have higher precedence)
+    }
+    while( ( op == MET_Mul || op == MET_Div ) && ! isExponent );
+
+    *leftOp = op;
+}
+
+
+
+// Compiles the expession(s) (comma separated if multiple)
+// inside the round brackets then the function
+// specified by the token `func`.
+
+void MathEvalProcessFunction( MathEvaluation *matheval, MathEvalToken func )
+{
+    MathEvalOpcode
+             opcode;
+
+    uint32_t count;
+
+    MathEvalToken
+             tokenThatCausedBreak,
+             token;
+
+    // Eat an open round bracket and count it
+
+    MathEvalProcessToken( matheval, &token );
+    if( matheval->error ) return;
+
+    if( token != MET_rbo )
+    {
+        matheval->error = "expected open round bracket after function name";
+        return;
+    }
+
+    matheval->roundBracketsCount++;
+
+    count = 1;
+
+    switch( func )
+    {
+        case MET_Sin:
+            MathEvalProcessAddends( matheval, matheval->roundBracketsCount - 1, false, false, NULL );
+            opcode = MEO_Sin;
+            break;
+
+        case MET_Cos:
+            MathEvalProcessAddends( matheval, matheval->roundBracketsCount - 1, false, false, NULL );
+            opcode = MEO_Cos;
+            break;
+
+        case MET_Tan:
+            MathEvalProcessAddends( matheval, matheval->roundBracketsCount - 1, false, false, NULL );
+            opcode = MEO_Tan;
+            break;
+
+        case MET_ASi:
+            MathEvalProcessAddends( matheval, matheval->roundBracketsCount - 1, false, false, NULL );
+            opcode = MEO_ASi;
+            break;
+
+        case MET_ACo:
+            MathEvalProcessAddends( matheval, matheval->roundBracketsCount - 1, false, false, NULL );
+            opcode = MEO_ACo;
+            break;
+
+        case MET_ATa:
+            MathEvalProcessAddends( matheval, matheval->roundBracketsCount - 1, false, false, NULL );
+            opcode = MEO_ATa;
+            break;
+
+        case MET_Fac:
+            MathEvalProcessAddends( matheval, matheval->roundBracketsCount - 1, false, false, NULL );
+            opcode = MEO_Fac;
+            break;
+
+        case MET_Exp:
+            MathEvalProcessAddends( matheval, matheval->roundBracketsCount - 1, false, false, NULL );
+            opcode = MEO_Exp;
+            break;
+
+        case MET_Pow:
+            MathEvalProcessAddends( matheval, -1, false, true, NULL );
+            if( matheval->error ) return;
+            MathEvalProcessAddends( matheval, matheval->roundBracketsCount - 1, false, false, NULL );
+            opcode = MEO_Pow;
+            break;
+
+        case MET_Log:
+            MathEvalProcessAddends( matheval, matheval->roundBracketsCount - 1, false, true, &tokenThatCausedBreak );
+            if( matheval->error ) return;
+            if( tokenThatCausedBreak == MET_rbc )
+            {
+                // log(n) with one parameter
+                opcode = MEO_Log;
+            }
+            else
+            {
+                MathEvalProcessAddends( matheval, matheval->roundBracketsCount - 1, false, false, NULL );
+                opcode = MEO_LgB;
+            }
+            break;
+
+        case MET_Max:
+        case MET_Min:
+        case MET_Avg:
+            MathEvalProcessAddends( matheval, matheval->roundBracketsCount - 1, false, true, &tokenThatCausedBreak );
+            if( matheval->error ) return;
+            while( tokenThatCausedBreak == MET_com )
+            {
+                MathEvalProcessAddends( matheval, matheval->roundBracketsCount - 1, false, true, &tokenThatCausedBreak );
+                if( matheval->error ) return;
+
+                count++;
+            }
+            opcode = func == MET_Max ? MEO_Max : ( func == MET_Min ? MEO_Min : MEO_Avg );
+            break;
+
+        default:
+            matheval->error = "unexpected symbol";
+            return;
+    }
+
+    if( matheval->error ) return;
+
+    MathEvalEmit( matheval, opcode, opcode == MEO_Max || opcode == MEO_Min || opcode == MEO_Avg ? count : 0, 0, 0 );
+}
+
+
+
+// Compiles an exponentiation.
+// The base has already been compiled.
+
+void MathEvalProcessExponentiation( MathEvaluation *matheval,
+                                    MathEvalToken  *rightOp ) // RETURN: the token (operator) that follows.
+{
+    MathEvalProcessFactors( matheval, true, rightOp );
+    if( matheval->error ) return;
+
+    MathEvalEmit( matheval, MEO_Pow, 0, 0, 0 );
+}
+
+
+
+// Compiles a factorial (computed using the Gamma function).
+// The value has already been compiled.
+
+void MathEvalProcessFactorial( MathEvaluation *matheval,
+                               MathEvalToken  *rightOp )  // RETURN: the token (operator) that follows.
+{
+    if( ! MathEvalEmit( matheval, MEO_Fac, 0, 0, 0 ) ) return;
+
+    MathEvalProcessToken( matheval, rightOp );
+}
+
+
+
+// Parses the next token and advances the cursor.
+// The function returns a number if the token is a value or a const.
+// If the token is a param then it is stored in `matheval->param`.
 // Whitespace is ignored.
 
-double MathEvalProcessToken( MathEvaluation *matheval,
-                             MathEvalToken  *token ) // RETURN: the token.
+double MathEvalProcessToken( MathEvaluation *matheval,
+                             MathEvalToken  *token ) // RETURN: the token.
+{
+    MathEvalToken
+           t;
+    double v;
+    MathEvalParam
+          *param;
+
+    t = MET_Blk;
+    v = 0;
+
+    while( t == MET_Blk )
+    {
+        // value maybe
+
+        if( ( *matheval->cursor >= '0' && *matheval->cursor <= '9' ) || *matheval->cursor == '.' )
+        {
+            v = MathEvalProcessValue( matheval );
+            if( matheval->error )
+            {
+                t = MET_Err;
+                return t;
+            }
+            else
+            {
+                t = MET_Val;
+            }
+            break;
+        }
+        else
+        {
+            // parameter maybe
+
+            param = matheval->params;
+            while( param != NULL )
+            {
+                if( strncmp( param->name, matheval->cursor, param->len ) == 0 )
+                {
+                    *token = MET_Par;
+                    matheval->param = param;
+                    matheval->cursor += param->len;
+                    return 0;
+                }
+
+                param = param->next;
+            }
+
+            // token maybe
+
+            switch( *matheval->cursor )
+            {
+                case '\n':
+                case '\r':
+                case '\t':
+                case ' ':
+                    t = MET_Blk;
+                    matheval->cursor++;
+                    break;
+
+                case '+':
+                    MathEvalProcessPlusToken( matheval, &t);
+                    break;
+
+                case '-':
+                    t = MET_Sub;
+                    matheval->cursor++;
+                    break;
+
+                case '*':
+                    t = MET_Mul;
+                    matheval->cursor++;
+                    break;
+
+                case '/':
+                    t = MET_Div;
+                    matheval->cursor++;
+                    break;
+
+                case '^':
+                    t = MET_Exc;
+                    matheval->cursor++;
+                    break;
+
+                case '!':
+                    t = MET_Fct;
+                    matheval->cursor++;
+                    break;
+
+                case '(':
+                    t = MET_rbo;
+                    matheval->cursor++;
+                    break;
+
+                case ')':
+                    t = MET_rbc;
+                    matheval->cursor++;
+                    break;
+
+                case '\0':
+                    t = MET_Eof;
+                    matheval->cursor++;
+                    break;
+
+                case ',':
+                    t = MET_com;
+                    matheval->cursor++;
+                    break;
+
+                case 'e':
+                    if( strncmp( matheval->cursor, "exp", 3 ) == 0 )
+                    {
+                        t = MET_Exp;
+                        matheval->cursor += 3;
+                    }
+                    else
+                    {
+                        v = exp( 1 );
+                        t = MET_Val;
+                        matheval->cursor++;
+                    }
+                    break;
+
+                case 'f':
+                    if( strncmp( matheval->cursor, "fact", 4 ) == 0 )
+                    {
+                        t = MET_Fac;
+                        matheval->cursor += 4;
+                    }
+                    else
+                    {
+                        t = MET_Err;
+                    }
+                    break;
+
+                case 'p':
+                    if( strncmp( matheval->cursor, "pi", 2 ) == 0 )
+                    {
+                        v = M_PI;
+                        t = MET_Val;
+                        matheval->cursor += 2;
+                    }
+                    else if( strncmp( matheval->cursor, "pow", 3 ) == 0 )
+                    {
+                        t = MET_Pow;
+                        matheval->cursor += 3;
+                    }
+                    else
+                    {
+                        t = MET_Err;
+                    }
+                    break;
+
+                case 'c':
+                    if( strncmp( matheval->cursor, "cos", 3 ) == 0 )
+                    {
+                        t = MET_Cos;
+                        matheval->cursor += 3;
+                    }
+                    else
+                    {
+                        t = MET_Err;
+                    }
+                    break;
+
+                case 's':
+                    if( strncmp( matheval->cursor, "sin", 3 ) == 0 )
+                    {
+                        t = MET_Sin;
+                        matheval->cursor += 3;
+                    }
+                    else
+                    {
+                        t = MET_Err;
+                    }
+                    break;
+
+                case 't':
+                    if( strncmp( matheval->cursor, "tan", 3 ) == 0 )
+                    {
+                        t = MET_Tan;
+                        matheval->cursor += 3;
+                    }
+                    else
+                    {
+                        t = MET_Err;
+                    }
+                    break;
+
+                case 'l':
+                    if( strncmp( matheval->cursor, "log", 3 ) == 0 )
+                    {
+                        t = MET_Log;
+                        matheval->cursor += 3;
+                    }
+                    else
+                    {
+                        t = MET_Err;
+                    }
+                    break;
+
+                case 'm':
+                    if( strncmp( matheval->cursor, "max", 3 ) == 0 )
+                    {
+                        t = MET_Max;
+                        matheval->cursor += 3;
+                    }
+                    else if( strncmp( matheval->cursor, "min", 3 ) == 0 )
+                    {
+                        t = MET_Min;
+                        matheval->cursor += 3;
+                    }
+                    else
+                    {
+                        t = MET_Err;
+                    }
+                    break;
+
+                case 'a':
+                    if( strncmp( matheval->cursor, "asin", 4 ) == 0 )
+                    {
+                        t = MET_ASi;
+                        matheval->cursor += 4;
+                    }
+                    else if( strncmp( matheval->cursor, "acos", 4 ) == 0 )
+                    {
+                        t = MET_ACo;
+                        matheval->cursor += 4;
+                    }
+                    else if( strncmp( matheval->cursor, "atan", 4 ) == 0 )
+                    {
+                        t = MET_ATa;
+                        matheval->cursor += 4;
+                    }
+                    else if( strncmp( matheval->cursor, "average", 7 ) == 0 )
+                    {
+                        t = MET_Avg;
+                        matheval->cursor += 7;
+                    }
+                    else if( strncmp( matheval->cursor, "avg", 3 ) == 0 )
+                    {
+                        t = MET_Avg;
+                        matheval->cursor += 3;
+                    }
+                    else
+                    {
+                        t = MET_Err;
+                    }
+                    break;
+
+
+                default:
+                    t = MET_Err;
+                    break;
+            }
+        }
+    }
+
+    if( t == MET_Err )
+    {
+        matheval->error = "unexpected symbol";
+    }
+
+    *token = t;
+
+    return v;
+}
+
+
+
+// Parses what follows a (already fetched) plus token
+// ensuring that two consecutive plus are not present.
+// Expressions such as 2++2 (binary plus
+// followed by unitary plus) are not allowed.
+// Advances the cursor.
+// Always returns 0.
+
+double MathEvalProcessPlusToken( MathEvaluation *matheval, MathEvalToken *token )
+{
+    do
+    {
+        matheval->cursor++;
+    } while( *matheval->cursor == ' ' || *matheval->cursor == '\n' || *matheval->cursor == '\r' || *matheval->cursor == '\t' );
+
+    if( *matheval->cursor == '+' )
+    {
+        *token = MET_Err;
+    }
+    else
+    {
+        *token = MET_Sum;
+    }
+
+    return 0;
+}
+
+
+
+// Parses a number and advances the cursor.
+// The cursor is positioned after an eventually
+// `+` or `-` operator that comes before the value.
+
+double MathEvalProcessValue( MathEvaluation *matheval )
+{
+    char   *endptr;
+    double value;
+
+    value = strtod( matheval->cursor, &endptr );
+
+    if( endptr == matheval->cursor )
+    {
+        matheval->error = "expected value";
+        value = 0;
+    }
+    else
+    {
+        matheval->cursor = endptr;
+
+        if( eexception( value ) )
+        {
+            matheval->error = "value is too big";
+            return 0;
+        }
+    }
+
+    return value;
+}
+
+
+// Appends a node to the compiled program
+// and keeps track of the stack depth needed
+// to execute it.
+// Returns false if memory cannot be allocated.
+
+bool MathEvalEmit( MathEvaluation *matheval,
+                   MathEvalOpcode  opcode,
+                   uint32_t        count,   // number of operands of max, min, average
+                   double          value,   // the constant of `MEO_Val`
+                   uint32_t        slot )   // the parameter slot of `MEO_Par`
+{
+    MathEvalNode *program,
+                 *node;
+    size_t       size;
+
+    if( matheval->programCount == matheval->programSize )
+    {
+        size = matheval->programSize ? matheval->programSize * 2 : 16;
+
+        program = MathEvalArenaRealloc( matheval, matheval->program, size * sizeof( MathEvalNode ) );
+        if( ! program )
+        {
+            matheval->error = "cannot allocate memory";
+            return false;
+        }
+
+        matheval->program = program;
+        matheval->programSize = size;
+    }
+
+    if( (uint64_t)( matheval->cursor - matheval->expression ) > UINT32_MAX )
+    {
+        matheval->error = "expression is too long";
+        return false;
+    }
+
+    node = &matheval->program[ matheval->programCount++ ];
+
+    node->opcode = (uint8_t) opcode;
+    node->flags = 0;
+    node->reserved = 0;
+    node->position = (uint32_t)( matheval->cursor - matheval->expression );
+
+    switch( opcode )
+    {
+        case MEO_Val:
+            node->value = value;
+            break;
+
+        case MEO_Par:
+            node->value = 0;
+            node->slot = slot;
+            break;
+
+        default:
+            node->value = 0;
+            node->count = count;
+            break;
+    }
+
+    switch( opcode )
+    {
+        case MEO_Val:
+        case MEO_Par:
+            matheval->stackDepth++;
+            break;
+
+        case MEO_Add:
+        case MEO_Sub:
+        case MEO_Mul:
+        case MEO_Div:
+        case MEO_Pow:
+        case MEO_LgB:
+            matheval->stackDepth--;
+            break;
+
+        case MEO_Max:
+        case MEO_Min:
+        case MEO_Avg:
+            matheval->stackDepth -= count - 1;
+            break;
+
+        default:
+            break;
+    }
+
+    if( matheval->stackDepth > matheval->stackMaxDepth )
+    {
+        matheval->stackMaxDepth = matheval->stackDepth;
+    }
+
+    return true;
+}
+
+
+
+// Computes the structural hash of the program; the
+// program itself is left in source order so that the
+// first error met is the one the expression shows first.
+// The hashes of the operands of commutative nodes are
+// combined in sorted order, so their order does not
+// matter: a + b, a * b, max, min and average of two
+// numbers. Sums and products of more terms are not
+// reassociated as that would change the rounding of
+// the result.
+// Parameters are hashed by name, not by slot.
+// Returns false if memory cannot be allocated.
+
+bool MathEvalHashProgram( MathEvaluation *matheval )
+{
+    MathEvalNode    *node;
+    MathEvalParam   *param;
+    uint64_t        *hashes,
+                    *names,
+                    *first,
+                    hash,
+                    bits;
+    size_t          top,
+                    count,
+                    i,
+                    j;
+    MathEvalChunk   *chunk;
+    size_t          used;
+
+    // temporaries are taken from the arena
+    // and given back at the end
+
+    chunk = matheval->arena;
+    used = MathEvalArenaUsed( matheval );
+
+    hashes = MathEvalArenaAlloc( matheval, ( matheval->stackMaxDepth + 1 ) * sizeof( uint64_t ) );
+    names = MathEvalArenaAlloc( matheval, ( matheval->valuesCount + 1 ) * sizeof( uint64_t ) );
+
+    if( ! hashes || ! names )
+    {
+        MathEvalArenaRewind( matheval, chunk, used );
+        return false;
+    }
+
+    for( param = matheval->params; param != NULL; param = param->next )
+    {
+        names[ param->slot ] = MathEvalHash( 0xcbf29ce484222325ULL, param->name, param->len );
+    }
+
+    top = 0;
+
+    for( i = 0; i < matheval->programCount; i++ )
+    {
+        node = &matheval->program[ i ];
+        count = MathEvalOperandsCount( node );
+
+        top -= count;
+        first = &hashes[ top ];
+
+        // the hashes of the operands are popped
+        // anyway: they can be sorted in place
+
+        if( node->opcode == MEO_Add || node->opcode == MEO_Mul || node->opcode == MEO_Max || node->opcode == MEO_Min ||
+            ( node->opcode == MEO_Avg && node->count == 2 ) )
+        {
+            qsort( first, count, sizeof( uint64_t ), MathEvalHashCompare );
+        }
+
+        hash = MathEvalHash( 0xcbf29ce484222325ULL, &node->opcode, sizeof( node->opcode ) );
+        hash = MathEvalHash( hash, &count, sizeof( count ) );
+
+        if( node->opcode == MEO_Val )
+        {
+            memcpy( &bits, &node->value, sizeof( bits ) );
+            hash = MathEvalHash( hash, &bits, sizeof( bits ) );
+        }
+
+        if( node->opcode == MEO_Par )
+        {
+            hash = MathEvalHash( hash, &names[ node->slot ], sizeof( uint64_t ) );
+        }
+
+        for( j = 0; j < count; j++ )
+        {
+            hash = MathEvalHash( hash, &first[ j ], sizeof( uint64_t ) );
+        }
+
+        hashes[ top++ ] = hash;
+    }
+
+    matheval->hash = hashes[ 0 ];
+    matheval->hashed = true;
+
+    MathEvalArenaRewind( matheval, chunk, used );
+
+    return true;
+}
+
+
+
+// Returns the number of operands
+// popped from the stack by a node
+
+uint32_t MathEvalOperandsCount( const MathEvalNode *node )
+{
+    switch( node->opcode )
+    {
+        case MEO_Val:
+        case MEO_Par:
+            return 0;
+
+        case MEO_Add:
+        case MEO_Sub:
+        case MEO_Mul:
+        case MEO_Div:
+        case MEO_Pow:
+        case MEO_LgB:
+            return 2;
+
+        case MEO_Max:
+        case MEO_Min:
+        case MEO_Avg:
+            return node->count;
+
+        default:
+            return 1;
+    }
+}
+
+
+
+// Orders two hashes
+
+int MathEvalHashCompare( const void *hash1, const void *hash2 )
+{
+    const uint64_t *h1 = hash1,
+                   *h2 = hash2;
+
+    return *h1 < *h2 ? -1 : ( *h1 > *h2 ? 1 : 0 );
+}
+
+
+
+// Empties the result cache: its memory is freed (and the
+// totals of the process updated) while the cache stays
+// enabled with `resultsSize` entries, allocated again
+// on first use.
+
+void MathEvalDropResults( MathEvaluation *matheval )
+{
+    if( ! matheval->results )
+    {
+        return;
+    }
+
+    MathEvalFree( matheval, matheval->results );
+    matheval->results = NULL;
+    matheval->resultsStride = 0;
+
+    MathEvalAccount( matheval, false );
+}
+
+
+
+// Looks the current values of the parameters up in the result
+// cache, allocating the cache on first use.
+// If found `*found` is true and the entry is returned, if not the
+// entry is prepared to store the result of the evaluation (an empty
+// entry or the one to replace). Entries are probed linearly from
+// the hash, at most `MATH_EVAL_RESULTS_PROBES` times.
+// Returns NULL if the cache cannot be allocated.
+
+MathEvalResultEntry *MathEvalResultsFind( MathEvaluation *matheval, bool *found )
+{
+    MathEvalResultEntry *entry;
+    uint64_t            hash,
+                        bits;
+    size_t              size,
+                        mask,
+                        i;
+
+    size = matheval->valuesCount * sizeof( double );
+
+    if( ! matheval->results )
+    {
+        matheval->resultsStride = ( sizeof( MathEvalResultEntry ) + size + 7 ) & ~(size_t) 7;
+        matheval->results = MathEvalCalloc( matheval, matheval->resultsSize, matheval->resultsStride );
+        if( ! matheval->results )
+        {
+            return NULL;
+        }
+
+        MathEvalAccount( matheval, false );
+    }
+
+    hash = 0xcbf29ce484222325ULL;
+    for( i = 0; i < matheval->valuesCount; i++ )
+    {
+        memcpy( &bits, &matheval->values[ i ], sizeof( bits ) );
+        hash = ( hash ^ bits ) * 0x100000001b3ULL;
+        hash ^= hash >> 29;
+    }
+    hash |= 1;
+
+    mask = matheval->resultsSize - 1;
+
+    for( i = 0; i < MATH_EVAL_RESULTS_PROBES; i++ )
+    {
+        entry = (MathEvalResultEntry *)( matheval->results + ( ( hash + i ) & mask ) * matheval->resultsStride );
+
+        if( entry->hash == hash && memcmp( entry->values, matheval->values, size ) == 0 )
+        {
+            *found = true;
+            return entry;
+        }
+
+        if( entry->hash == 0 )
+        {
+            break;
+        }
+    }
+
+    // not found: an empty entry or the
+    // entry at the hash is replaced
+
+    if( i == MATH_EVAL_RESULTS_PROBES )
+    {
+        entry = (MathEvalResultEntry *)( matheval->results + ( hash & mask ) * matheval->resultsStride );
+    }
+
+    entry->hash = hash;
+    memcpy( entry->values, matheval->values, size );
+
+    *found = false;
+    return entry;
+}
+
+
+
+// Sizes the stack for the program, with a memo for each
+// call site of sin, cos, exp, log and factorial after it.
+// The memos start with the argument 0.
+// Returns false if memory cannot be allocated.
+
+bool MathEvalPrepareStack( MathEvaluation *matheval )
+{
+    MathEvalNode *node,
+                 *end;
+    double       *stack;
+    size_t       count,
+                 size,
+                 i;
+
+    count = 0;
+    end = matheval->program + matheval->programCount;
+
+    for( node = matheval->program; node < end; node++ )
+    {
+        count += node->opcode == MEO_Sin || node->opcode == MEO_Cos || node->opcode == MEO_Exp ||
+                 node->opcode == MEO_Log || node->opcode == MEO_Fac;
+    }
+
+    size = matheval->stackMaxDepth + count * sizeof( MathEvalMemo ) / sizeof( double );
+
+    if( size > matheval->stackSize )
+    {
+        stack = MathEvalRealloc( matheval, matheval->stack, size * sizeof( double ) );
+        if( ! stack )
+        {
+            return false;
+        }
+
+        matheval->stack = stack;
+        matheval->stackSize = size;
+    }
+
+    matheval->memos = (MathEvalMemo *)( matheval->stack + matheval->stackMaxDepth );
+
+    for( node = matheval->program, i = 0; node < end; node++ )
+    {
+        if( node->opcode == MEO_Sin || node->opcode == MEO_Cos || node->opcode == MEO_Exp ||
+            node->opcode == MEO_Log || node->opcode == MEO_Fac )
+        {
+            // seeded with an argument whose result is finite
+            // (0, 1 for the logarithm): the bits 1 are not
+            // those of the argument, so the function is computed
+
+            matheval->memos[ i ].argument = 1;
+            MathEvalMemoized( &matheval->memos[ i ], (MathEvalOpcode) node->opcode, node->opcode == MEO_Log ? 1 : 0 );
+            i++;
+        }
+    }
+
+    return true;
+}
+
+
+
+// Returns sin, cos, exp, log or factorial (`opcode`)
+// of `argument`: the call site `memo` keeps the last
+// argument and result so that the function is not
+// computed again while its argument does not change
+// (for example when other parameters change).
+// Results that are not finite are not kept: a hit raises
+// no floating point exception, they are computed again
+// so that deferred checks (see `MathEvalRunDeferred`)
+// see the exception as without the memo.
+
+double MathEvalMemoized( MathEvalMemo *memo, MathEvalOpcode opcode, double argument )
+{
+    uint64_t bits;
+    double   result;
+
+    memcpy( &bits, &argument, sizeof( bits ) );
+
+    if( bits == memo->argument )
+    {
+        return memo->result;
+    }
+
+    switch( opcode )
+    {
+        case MEO_Sin: result = sin( argument ); break;
+        case MEO_Cos: result = cos( argument ); break;
+        case MEO_Exp: result = exp( argument ); break;
+        case MEO_Log: result = log( argument ); break;
+        default:      result = MathEvalFactorial( argument ); break;
+    }
+
+    if( ! isfinite( result ) )
+    {
+        return result;
+    }
+
+    memo->result = result;
+    memo->argument = bits;
+
+    return memo->result;
+}
+
+
+
+// Executes the compiled program.
+// Each node pops its operands from the stack
+// and pushes its result.
+// The call sites of sin, cos, exp, log and factorial
+// are memoized (see `MathEvalMemoized`), the nodes
+// that are `MATH_EVAL_NODE_SAFE` are not checked.
+// On error `matheval->error` is set and the cursor
+// is moved where the error occurred.
+
+double MathEvalRun( MathEvaluation *matheval )
+{
+    MathEvalNode *node,
+                 *end;
+    MathEvalMemo *memo;
+    double       *top,
+                 result;
+    uint32_t     i;
+
+    memo = matheval->memos;
+    top = matheval->stack - 1;
+    node = matheval->program;
+    end = matheval->program + matheval->programCount;
+
+    for( ; node < end; node++ )
+    {
+        switch( node->opcode )
+        {
+            case MEO_Val:
+                *++top = node->value;
+                break;
+
+            case MEO_Par:
+                *++top = matheval->values[ node->slot ];
+                break;
+
+            case MEO_Neg:
+                *top = - *top;
+                break;
+
+            case MEO_Add:
+                top--;
+                *top = top[ 0 ] + top[ 1 ];
+                if( ! ( node->flags & MATH_EVAL_NODE_SAFE ) && eexception( *top ) && ! MathEvalSaturate( matheval, top ) ) return MathEvalRunError( matheval, node, "result is complex or too big" );
+                break;
+
+            case MEO_Sub:
+                top--;
+                *top = top[ 0 ] - top[ 1 ];
+                if( ! ( node->flags & MATH_EVAL_NODE_SAFE ) && eexception( *top ) && ! MathEvalSaturate( matheval, top ) ) return MathEvalRunError( matheval, node, "result is complex or too big" );
+                break;
+
+            case MEO_Mul:
+                top--;
+                *top = top[ 0 ] * top[ 1 ];
+                if( ! ( node->flags & MATH_EVAL_NODE_SAFE ) && eexception( *top ) && ! MathEvalSaturate( matheval, top ) ) return MathEvalRunError( matheval, node, "result is too big" );
+                break;
+
+            case MEO_Div:
+                if( ! ( node->flags & MATH_EVAL_NODE_SAFE ) && *top == 0 && ( matheval->policy != MathEvaluationSaturate || top[ -1 ] == 0 ) ) return MathEvalRunError( matheval, node, "division by zero" );
+                top--;
+                *top = top[ 0 ] / top[ 1 ];
+                if( ! ( node->flags & MATH_EVAL_NODE_SAFE ) && eexception( *top ) && ! MathEvalSaturate( matheval, top ) ) return MathEvalRunError( matheval, node, "result is too big" );
+                break;
+
+            case MEO_Pow:
+                top--;
+                *top = pow( top[ 0 ], top[ 1 ] );
+                if( ! ( node->flags & MATH_EVAL_NODE_SAFE ) && eexception( *top ) && ! MathEvalSaturate( matheval, top ) ) return MathEvalRunError( matheval, node, "result is complex or too big" );
+                break;
+
+            case MEO_Fac:
+                if( ! ( node->flags & MATH_EVAL_NODE_SAFE ) && *top < 0 ) return MathEvalRunError( matheval, node, "attempt to mathevaluate factorial of negative number" );
+                *top = MathEvalMemoized( memo++, MEO_Fac, *top );
+                if( ! ( node->flags & MATH_EVAL_NODE_SAFE ) && eexception( *top ) && ! MathEvalSaturate( matheval, top ) ) return MathEvalRunError( matheval, node, "result is complex or too big" );
+                break;
+
+            case MEO_Sin:
+                *top = MathEvalMemoized( memo++, MEO_Sin, *top );
+                if( ! ( node->flags & MATH_EVAL_NODE_SAFE ) && eexception( *top ) && ! MathEvalSaturate( matheval, top ) ) return MathEvalRunError( matheval, node, "result is complex or too big" );
+                break;
+
+            case MEO_Cos:
+                *top = MathEvalMemoized( memo++, MEO_Cos, *top );
+                if( ! ( node->flags & MATH_EVAL_NODE_SAFE ) && eexception( *top ) && ! MathEvalSaturate( matheval, top ) ) return MathEvalRunError( matheval, node, "result is complex or too big" );
+                break;
+
+            case MEO_Tan:
+                *top = tan( *top );
+                if( ! ( node->flags & MATH_EVAL_NODE_SAFE ) && eexception( *top ) && ! MathEvalSaturate( matheval, top ) ) return MathEvalRunError( matheval, node, "result is complex or too big" );
+                break;
+
+            case MEO_ASi:
+                *top = asin( *top );
+                if( ! ( node->flags & MATH_EVAL_NODE_SAFE ) && eexception( *top ) && ! MathEvalSaturate( matheval, top ) ) return MathEvalRunError( matheval, node, "result is complex or too big" );
+                break;
+
+            case MEO_ACo:
+                *top = acos( *top );
+                if( ! ( node->flags & MATH_EVAL_NODE_SAFE ) && eexception( *top ) && ! MathEvalSaturate( matheval, top ) ) return MathEvalRunError( matheval, node, "result is complex or too big" );
+                break;
+
+            case MEO_ATa:
+                *top = atan( *top );
+                if( ! ( node->flags & MATH_EVAL_NODE_SAFE ) && eexception( *top ) && ! MathEvalSaturate( matheval, top ) ) return MathEvalRunError( matheval, node, "result is complex or too big" );
+                break;
+
+            case MEO_Exp:
+                *top = MathEvalMemoized( memo++, MEO_Exp, *top );
+                if( ! ( node->flags & MATH_EVAL_NODE_SAFE ) && eexception( *top ) && ! MathEvalSaturate( matheval, top ) ) return MathEvalRunError( matheval, node, "result is complex or too big" );
+                break;
+
+            case MEO_Log:
+                *top = MathEvalMemoized( memo++, MEO_Log, *top );
+                if( ! ( node->flags & MATH_EVAL_NODE_SAFE ) && eexception( *top ) && ! MathEvalSaturate( matheval, top ) ) return MathEvalRunError( matheval, node, "result is complex or too big" );
+                break;
+
+            case MEO_LgB:
+                top--;
+                *top = log( top[ 1 ] ) / log( top[ 0 ] );
+                if( ! ( node->flags & MATH_EVAL_NODE_SAFE ) && eexception( *top ) && ! MathEvalSaturate( matheval, top ) ) return MathEvalRunError( matheval, node, "result is complex or too big" );
+                break;
+
+            case MEO_Max:
+                top -= node->count - 1;
+                result = top[ 0 ];
+                for( i = 1; i < node->count; i++ )
+                {
+                    if( top[ i ] > result )
+                    {
+                        result = top[ i ];
+                    }
+                }
+                *top = result;
+                if( ! ( node->flags & MATH_EVAL_NODE_SAFE ) && eexception( *top ) && ! MathEvalSaturate( matheval, top ) ) return MathEvalRunError( matheval, node, "result is complex or too big" );
+                break;
+
+            case MEO_Min:
+                top -= node->count - 1;
+                result = top[ 0 ];
+                for( i = 1; i < node->count; i++ )
+                {
+                    if( top[ i ] < result )
+                    {
+                        result = top[ i ];
+                    }
+                }
+                *top = result;
+                if( ! ( node->flags & MATH_EVAL_NODE_SAFE ) && eexception( *top ) && ! MathEvalSaturate( matheval, top ) ) return MathEvalRunError( matheval, node, "result is complex or too big" );
+                break;
+
+            case MEO_Avg:
+                top -= node->count - 1;
+                result = top[ 0 ];
+                for( i = 1; i < node->count; i++ )
+                {
+                    result += top[ i ];
+                }
+                *top = result / (double)node->count;
+                if( ! ( node->flags & MATH_EVAL_NODE_SAFE ) && eexception( *top ) && ! MathEvalSaturate( matheval, top ) ) return MathEvalRunError( matheval, node, "result is complex or too big" );
+                break;
+        }
+    }
+
+    // parameters are not checked when fetched
+
+    if( eexception( *top ) && ! MathEvalSaturate( matheval, top ) ) return MathEvalRunError( matheval, end - 1, "result is complex or too big" );
+
+    // as a sum of addends the result is never -0
+
+    return *top + 0;
+}
+
+
+
+// Executes the compiled program (see `MathEvalIsInteger`)
+// with 64 bit integers: the result is exact and rounded
+// to double only at the end.
+// Returns false if a parameter is not an integer, an
+// operation overflows or cannot be computed with integers
+// (negative exponents, factorials of negative numbers):
+// then the program must be executed by `MathEvalRun`.
+
+bool MathEvalRunInteger( MathEvaluation *matheval, double *result )
+{
+    MathEvalNode *node,
+                 *end;
+    int64_t      *top,
+                 base,
+                 exponent,
+                 power;
+
+    // the stack has room for as many integers
+
+    top = (int64_t *) matheval->stack - 1;
+    node = matheval->program;
+    end = matheval->program + matheval->programCount;
+
+    for( ; node < end; node++ )
+    {
+        switch( node->opcode )
+        {
+            case MEO_Val:
+                *++top = (int64_t) node->value;
+                break;
+
+            case MEO_Par:
+                if( ! MathEvalToInteger( matheval->values[ node->slot ], ++top ) ) return false;
+                break;
+
+            case MEO_Neg:
+                if( __builtin_sub_overflow( (int64_t) 0, *top, top ) ) return false;
+                break;
+
+            case MEO_Add:
+                top--;
+                if( __builtin_add_overflow( top[ 0 ], top[ 1 ], top ) ) return false;
+                break;
+
+            case MEO_Sub:
+                top--;
+                if( __builtin_sub_overflow( top[ 0 ], top[ 1 ], top ) ) return false;
+                break;
+
+            case MEO_Mul:
+                top--;
+                if( __builtin_mul_overflow( top[ 0 ], top[ 1 ], top ) ) return false;
+                break;
+
+            case MEO_Pow:
+                top--;
+                if( top[ 1 ] < 0 ) return false;
+
+                // exponentiation by squaring
+
+                base = top[ 0 ];
+                exponent = top[ 1 ];
+                power = 1;
+
+                while( exponent )
+                {
+                    if( ( exponent & 1 ) && __builtin_mul_overflow( power, base, &power ) ) return false;
+
+                    exponent >>= 1;
+
+                    if( exponent && __builtin_mul_overflow( base, base, &base ) ) return false;
+                }
+
+                *top = power;
+                break;
+
+            case MEO_Fac:
+                if( *top < 0 || *top > 20 ) return false;   // 21! overflows
+                *top = (int64_t) MathEvalFactorials[ *top ];
+                break;
+
+            default:
+                return false;
+        }
+    }
+
+    *result = (double) *top;
+
+    return true;
+}
+
+
+
+// Returns true if the program can be executed with
+// integers by `MathEvalRunInteger`: all the constants
+// are integers and the only operations are `+`, `-`,
+// `*`, `^` and `!`.
+
+bool MathEvalIsInteger( MathEvaluation *matheval )
+{
+    MathEvalNode *node,
+                 *end;
+    int64_t      integer;
+
+    node = matheval->program;
+    end = matheval->program + matheval->programCount;
+
+    for( ; node < end; node++ )
+    {
+        switch( node->opcode )
+        {
+            case MEO_Val:
+                if( ! MathEvalToInteger( node->value, &integer ) ) return false;
+                break;
+
+            case MEO_Par:
+            case MEO_Neg:
+            case MEO_Add:
+            case MEO_Sub:
+            case MEO_Mul:
+            case MEO_Pow:
+            case MEO_Fac:
+                break;
+
+            default:
+                return false;
+        }
+    }
+
+    return matheval->programCount > 0;
+}
+
+
+
+// Converts `value` to a 64 bit integer.
+// Returns false if it is not an integer or it does not fit.
+
+bool MathEvalToInteger( double value, int64_t *integer )
+{
+    // -2^63 and 2^63 are exact doubles
+
+    if( ! ( value >= -9223372036854775808.0 && value < 9223372036854775808.0 ) )
+    {
+        return false;
+    }
+
+    *integer = (int64_t) value;
+
+    return (double) *integer == value;
+}
+
+
+
+// floating point exception flags are tested by
+// the following functions (gcc does not support the
+// pragma but does not move operations across calls)
+
+#ifdef __clang__
+#pragma STDC FENV_ACCESS ON
+#endif
+
+
+
+// Executes the compiled program like `MathEvalRun`
+// but without any check: IEEE infinities and NaNs
+// propagate to the result. Factorials of negative
+// numbers, which may have a finite result, are
+// reported through `negativeFactorial`.
+
+double MathEvalRunUnchecked( MathEvaluation *matheval, bool *negativeFactorial )
+{
+    MathEvalNode *node,
+                 *end;
+    MathEvalMemo *memo;
+    double       *top,
+                 result;
+    uint32_t     i;
+    bool         negative;
+
+    negative = false;
+    memo = matheval->memos;
+    top = matheval->stack - 1;
+    node = matheval->program;
+    end = matheval->program + matheval->programCount;
+
+    for( ; node < end; node++ )
+    {
+        switch( node->opcode )
+        {
+            case MEO_Val:
+                *++top = node->value;
+                break;
+
+            case MEO_Par:
+                *++top = matheval->values[ node->slot ];
+                break;
+
+            case MEO_Neg:
+                *top = - *top;
+                break;
+
+            case MEO_Add:
+                top--;
+                *top = top[ 0 ] + top[ 1 ];
+                break;
+
+            case MEO_Sub:
+                top--;
+                *top = top[ 0 ] - top[ 1 ];
+                break;
+
+            case MEO_Mul:
+                top--;
+                *top = top[ 0 ] * top[ 1 ];
+                break;
+
+            case MEO_Div:
+                top--;
+                *top = top[ 0 ] / top[ 1 ];
+                break;
+
+            case MEO_Pow:
+                top--;
+                *top = pow( top[ 0 ], top[ 1 ] );
+                break;
+
+            case MEO_Fac:
+                negative |= *top < 0;
+                *top = *top < 0 ? NAN : MathEvalMemoized( memo, MEO_Fac, *top );
+                memo++;
+                break;
+
+            case MEO_Sin:
+                *top = MathEvalMemoized( memo++, MEO_Sin, *top );
+                break;
+
+            case MEO_Cos:
+                *top = MathEvalMemoized( memo++, MEO_Cos, *top );
+                break;
+
+            case MEO_Tan:
+                *top = tan( *top );
+                break;
+
+            case MEO_ASi:
+                *top = asin( *top );
+                break;
+
+            case MEO_ACo:
+                *top = acos( *top );
+                break;
+
+            case MEO_ATa:
+                *top = atan( *top );
+                break;
+
+            case MEO_Exp:
+                *top = MathEvalMemoized( memo++, MEO_Exp, *top );
+                break;
+
+            case MEO_Log:
+                *top = MathEvalMemoized( memo++, MEO_Log, *top );
+                break;
+
+            case MEO_LgB:
+                top--;
+                *top = log( top[ 1 ] ) / log( top[ 0 ] );
+                break;
+
+            case MEO_Max:
+                top -= node->count - 1;
+                result = top[ 0 ];
+                for( i = 1; i < node->count; i++ )
+                {
+                    if( top[ i ] > result )
+                    {
+                        result = top[ i ];
+                    }
+                }
+                *top = result;
+                break;
+
+            case MEO_Min:
+                top -= node->count - 1;
+                result = top[ 0 ];
+                for( i = 1; i < node->count; i++ )
+                {
+                    if( top[ i ] < result )
+                    {
+                        result = top[ i ];
+                    }
+                }
+                *top = result;
+                break;
+
+            case MEO_Avg:
+                top -= node->count - 1;
+                result = top[ 0 ];
+                for( i = 1; i < node->count; i++ )
+                {
+                    result += top[ i ];
+                }
+                *top = result / (double)node->count;
+                break;
+        }
+    }
+
+    *negativeFactorial = negative;
+
+    // as a sum of addends the result is never -0
+
+    return *top + 0;
+}
+
+
+
+// Executes the compiled program with deferred checks:
+// floating point exception flags are cleared, the program
+// runs without checks and the flags (and the result) are
+// tested once at the end. Only if something went wrong
+// the program is executed again by `MathEvalRun` to find
+// the error and its position.
+// Infinite or NaN parameter values, which propagate
+// without raising exceptions, are left to `MathEvalRun`.
+
+double MathEvalRunDeferred( MathEvaluation *matheval )
+{
+    double result;
+    size_t i;
+    bool   negativeFactorial;
+
+    for( i = 0; i < matheval->valuesCount; i++ )
+    {
+        if( ! isfinite( matheval->values[ i ] ) )
+        {
+            return MathEvalRun( matheval );
+        }
+    }
+
+    // clearing the flags is slower than testing them
+    // and they are usually clear already
+
+    if( fetestexcept( FE_INVALID | FE_DIVBYZERO | FE_OVERFLOW ) )
+    {
+        feclearexcept( FE_INVALID | FE_DIVBYZERO | FE_OVERFLOW );
+    }
+
+    result = MathEvalRunUnchecked( matheval, &negativeFactorial );
+
+    if( negativeFactorial || fetestexcept( FE_INVALID | FE_DIVBYZERO | FE_OVERFLOW ) || eexception( result ) )
+    {
+        return MathEvalRun( matheval );
+    }
+
+    return result;
+}
+
+#ifdef __clang__
+#pragma STDC FENV_ACCESS OFF
+#endif
+
+
+
+// Evaluates with the fit (see `MathEvaluationFit`) the
+// rows `first`...`first + count - 1` of the column of
+// its parameter.
+// Returns true if some rows are out of the domain:
+// they are flagged and must be evaluated with the
+// program.
+
+bool MathEvalRunFitColumns( MathEvaluation *matheval, const double *column, size_t first, size_t count, double *results )
+{
+    unsigned char *flags;
+    unsigned char any;
+    size_t        i;
+
+    flags = MathEvalColumnsFlags( matheval );
+    any = 0;
+
+    column += first;
+
+    for( i = 0; i < count; i++ )
+    {
+        flags[ i ] = ! ( column[ i ] >= matheval->fit.min && column[ i ] <= matheval->fit.max );
+        results[ i ] = flags[ i ] ? 0 : MathEvalRunFit( matheval, column[ i ] );
+        any |= flags[ i ];
+    }
+
+    return any != 0;
+}
+
+
+
+// Returns the stack of the column kernel: a block of
+// values for each level, aligned to 64 bytes
+
+double *MathEvalColumnsStack( MathEvaluation *matheval )
+{
+    uintptr_t address;
+
+    address = (uintptr_t) matheval->workspace;
+    address = ( address + MATH_EVAL_COLUMNS_ALIGNMENT - 1 ) & ~(uintptr_t)( MATH_EVAL_COLUMNS_ALIGNMENT - 1 );
+
+    return (double *) address;
+}
+
+
+
+// Returns the scratch blocks (above the stack) used by
+// the approximated functions in the column kernel
+
+double *MathEvalColumnsScratch( MathEvaluation *matheval )
+{
+    return MathEvalColumnsStack( matheval ) + matheval->stackMaxDepth * MATH_EVAL_COLUMNS_BLOCK;
+}
+
+
+
+// Returns the flags of the rows of the last block
+// evaluated by `MathEvalRunColumns` that failed (or
+// may have failed)
+
+unsigned char *MathEvalColumnsFlags( MathEvaluation *matheval )
+{
+    return (unsigned char *)( MathEvalColumnsScratch( matheval ) + MATH_EVAL_COLUMNS_SCRATCH * MATH_EVAL_COLUMNS_BLOCK );
+}
+
+
+
+// Sets all the rows of a column evaluation
+// as failed and returns a failure
+
+MathEvaluationStatus MathEvalFailColumns( size_t rows, double *results, MathEvaluationStatus *statuses )
+{
+    size_t row;
+
+    for( row = 0; row < rows; row++ )
+    {
+        results[ row ] = 0;
+
+        if( statuses )
+        {
+            statuses[ row ] = MathEvaluationFailure;
+        }
+    }
+
+    return MathEvaluationFailure;
+}
+
+
+
+// Makes the workspace (see `MathEvaluationPerformColumns`
+// and `MathEvaluationPerformInterval`) at least `size`
+// bytes large; its content is not kept.
+// Returns false if memory cannot be allocated
+// (`matheval->error` is set).
+
+bool MathEvalReserveWorkspace( MathEvaluation *matheval, size_t size )
+{
+    if( size <= matheval->workspaceSize )
+    {
+        return true;
+    }
+
+    MathEvalFree( matheval, matheval->workspace );
+    matheval->workspaceSize = 0;
+
+    matheval->workspace = MathEvalAlloc( matheval, size );
+    if( ! matheval->workspace )
+    {
+        matheval->error = "cannot allocate memory";
+        return false;
+    }
+
+    matheval->workspaceSize = size;
+    MathEvalAccount( matheval, false );
+
+    return true;
+}
+
+
+
+// Executes the compiled program for `count` rows
+// (at most `MATH_EVAL_COLUMNS_BLOCK`) starting at `first`.
+// Each node is applied to the whole block so that the
+// inner loops can be vectorized. Nothing is checked on
+// the way: the rows where a check of `MathEvalRun` would
+// fail are flagged instead.
+// If `aligned` is true columns and results are aligned
+// to 64 bytes.
+// Returns true if any row has been flagged.
+
+bool MathEvalRunColumns( MathEvaluation *matheval, const double **bySlot, size_t first, size_t count, double *results, bool aligned )
+{
+    MathEvalNode  *node,
+                  *end;
+    double        *top,
+                  *operand,
+                  *level,
+                  *scratch;
+    const double  *column;
+    unsigned char *flags;
+    unsigned char any;
+    double        value;
+    size_t        i;
+    uint32_t      j;
+
+    const MathEvalApproximation
+                  *approximation;
+
+    approximation = matheval->approximation.tolerance ? &matheval->approximation : NULL;
+    scratch = MathEvalColumnsScratch( matheval );
+
+    flags = MathEvalColumnsFlags( matheval );
+    memset( flags, 0, MATH_EVAL_COLUMNS_BLOCK );
+
+    top = MathEvalColumnsStack( matheval ) - MATH_EVAL_COLUMNS_BLOCK;
+    node = matheval->program;
+    end = matheval->program + matheval->programCount;
+
+    for( ; node < end; node++ )
+    {
+        level = __builtin_assume_aligned( top, MATH_EVAL_COLUMNS_ALIGNMENT );
+        operand = level + MATH_EVAL_COLUMNS_BLOCK;
+
+        switch( node->opcode )
+        {
+            case MEO_Val:
+                top += MATH_EVAL_COLUMNS_BLOCK;
+                value = node->value;
+                for( i = 0; i < count; i++ ) operand[ i ] = value;
+                break;
+
+            case MEO_Par:
+                top += MATH_EVAL_COLUMNS_BLOCK;
+                column = bySlot[ node->slot ];
+                if( ! column )
+                {
+                    value = matheval->values[ node->slot ];
+                    for( i = 0; i < count; i++ ) operand[ i ] = value;
+                }
+                else if( aligned )
+                {
+                    column = __builtin_assume_aligned( column + first, MATH_EVAL_COLUMNS_ALIGNMENT );
+                    for( i = 0; i < count; i++ ) operand[ i ] = column[ i ];
+                }
+                else
+                {
+                    column += first;
+                    for( i = 0; i < count; i++ ) operand[ i ] = column[ i ];
+                }
+                break;
+
+            case MEO_Neg:
+                for( i = 0; i < count; i++ ) level[ i ] = - level[ i ];
+                break;
+
+            case MEO_Add:
+                top -= MATH_EVAL_COLUMNS_BLOCK;
+                level -= MATH_EVAL_COLUMNS_BLOCK;
+                operand -= MATH_EVAL_COLUMNS_BLOCK;
+                for( i = 0; i < count; i++ )
+                {
+                    level[ i ] = level[ i ] + operand[ i ];
+                    flags[ i ] |= eexception( level[ i ] );
+                }
+                break;
+
+            case MEO_Sub:
+                top -= MATH_EVAL_COLUMNS_BLOCK;
+                level -= MATH_EVAL_COLUMNS_BLOCK;
+                operand -= MATH_EVAL_COLUMNS_BLOCK;
+                for( i = 0; i < count; i++ )
+                {
+                    level[ i ] = level[ i ] - operand[ i ];
+                    flags[ i ] |= eexception( level[ i ] );
+                }
+                break;
+
+            case MEO_Mul:
+                top -= MATH_EVAL_COLUMNS_BLOCK;
+                level -= MATH_EVAL_COLUMNS_BLOCK;
+                operand -= MATH_EVAL_COLUMNS_BLOCK;
+                for( i = 0; i < count; i++ )
+                {
+                    level[ i ] = level[ i ] * operand[ i ];
+                    flags[ i ] |= eexception( level[ i ] );
+                }
+                break;
+
+            case MEO_Div:
+                top -= MATH_EVAL_COLUMNS_BLOCK;
+                level -= MATH_EVAL_COLUMNS_BLOCK;
+                operand -= MATH_EVAL_COLUMNS_BLOCK;
+                for( i = 0; i < count; i++ )
+                {
+                    flags[ i ] |= operand[ i ] == 0;
+                    level[ i ] = level[ i ] / operand[ i ];
+                    flags[ i ] |= eexception( level[ i ] );
+                }
+                break;
+
+            case MEO_Pow:
+                top -= MATH_EVAL_COLUMNS_BLOCK;
+                level -= MATH_EVAL_COLUMNS_BLOCK;
+                operand -= MATH_EVAL_COLUMNS_BLOCK;
+                if( approximation )
+                {
+                    MathEvalApproxPow( approximation, level, operand, count, scratch );
+                    for( i = 0; i < count; i++ ) flags[ i ] |= eexception( level[ i ] );
+                }
+                else
+                {
+                    for( i = 0; i < count; i++ )
+                    {
+                        level[ i ] = pow( level[ i ], operand[ i ] );
+                        flags[ i ] |= eexception( level[ i ] );
+                    }
+                }
+                break;
+
+            case MEO_Fac:
+                for( i = 0; i < count; i++ )
+                {
+                    value = level[ i ];
+                    level[ i ] = value >= 0 && value < MATH_EVAL_FACTORIALS && value == (int) value ? MathEvalFactorials[ (int) value ] : MathEvalGamma( value );
+                    flags[ i ] |= eexception( level[ i ] );
+                }
+                break;
+
+            case MEO_Sin:
+                if( approximation )
+                {
+                    MathEvalApproxSin( approximation, level, count, false, scratch );
+                    for( i = 0; i < count; i++ ) flags[ i ] |= eexception( level[ i ] );
+                }
+                else
+                {
+                    for( i = 0; i < count; i++ )
+                    {
+                        level[ i ] = sin( level[ i ] );
+                        flags[ i ] |= eexception( level[ i ] );
+                    }
+                }
+                break;
+
+            case MEO_Cos:
+                if( approximation )
+                {
+                    MathEvalApproxSin( approximation, level, count, true, scratch );
+                    for( i = 0; i < count; i++ ) flags[ i ] |= eexception( level[ i ] );
+                }
+                else
+                {
+                    for( i = 0; i < count; i++ )
+                    {
+                        level[ i ] = cos( level[ i ] );
+                        flags[ i ] |= eexception( level[ i ] );
+                    }
+                }
+                break;
+
+            case MEO_Tan:
+                for( i = 0; i < count; i++ )
+                {
+                    level[ i ] = tan( level[ i ] );
+                    flags[ i ] |= eexception( level[ i ] );
+                }
+                break;
+
+            case MEO_ASi:
+                for( i = 0; i < count; i++ )
+                {
+                    level[ i ] = asin( level[ i ] );
+                    flags[ i ] |= eexception( level[ i ] );
+                }
+                break;
+
+            case MEO_ACo:
+                for( i = 0; i < count; i++ )
+                {
+                    level[ i ] = acos( level[ i ] );
+                    flags[ i ] |= eexception( level[ i ] );
+                }
+                break;
+
+            case MEO_ATa:
+                for( i = 0; i < count; i++ )
+                {
+                    level[ i ] = atan( level[ i ] );
+                    flags[ i ] |= eexception( level[ i ] );
+                }
+                break;
+
+            case MEO_Exp:
+                if( approximation )
+                {
+                    MathEvalApproxExp( level, count, approximation->expTerms, scratch );
+                    for( i = 0; i < count; i++ ) flags[ i ] |= eexception( level[ i ] );
+                }
+                else
+                {
+                    for( i = 0; i < count; i++ )
+                    {
+                        level[ i ] = exp( level[ i ] );
+                        flags[ i ] |= eexception( level[ i ] );
+                    }
+                }
+                break;
+
+            case MEO_Log:
+                if( approximation )
+                {
+                    MathEvalApproxLog( level, count, approximation->logTerms, scratch );
+                    for( i = 0; i < count; i++ ) flags[ i ] |= eexception( level[ i ] );
+                }
+                else
+                {
+                    for( i = 0; i < count; i++ )
+                    {
+                        level[ i ] = log( level[ i ] );
+                        flags[ i ] |= eexception( level[ i ] );
+                    }
+                }
+                break;
+
+            case MEO_LgB:
+                top -= MATH_EVAL_COLUMNS_BLOCK;
+                level -= MATH_EVAL_COLUMNS_BLOCK;
+                operand -= MATH_EVAL_COLUMNS_BLOCK;
+                if( approximation )
+                {
+                    MathEvalApproxLog( level, count, approximation->logTerms, scratch );
+                    MathEvalApproxLog( operand, count, approximation->logTerms, scratch );
+                    for( i = 0; i < count; i++ )
+                    {
+                        level[ i ] = operand[ i ] / level[ i ];
+                        flags[ i ] |= eexception( level[ i ] );
+                    }
+                }
+                else
+                {
+                    for( i = 0; i < count; i++ )
+                    {
+                        level[ i ] = log( operand[ i ] ) / log( level[ i ] );
+                        flags[ i ] |= eexception( level[ i ] );
+                    }
+                }
+                break;
+
+            case MEO_Max:
+                top -= ( node->count - 1 ) * MATH_EVAL_COLUMNS_BLOCK;
+                level = top;
+                for( j = 1; j < node->count; j++ )
+                {
+                    operand = level + j * MATH_EVAL_COLUMNS_BLOCK;
+                    for( i = 0; i < count; i++ ) level[ i ] = operand[ i ] > level[ i ] ? operand[ i ] : level[ i ];
+                }
+                for( i = 0; i < count; i++ ) flags[ i ] |= eexception( level[ i ] );
+                break;
+
+            case MEO_Min:
+                top -= ( node->count - 1 ) * MATH_EVAL_COLUMNS_BLOCK;
+                level = top;
+                for( j = 1; j < node->count; j++ )
+                {
+                    operand = level + j * MATH_EVAL_COLUMNS_BLOCK;
+                    for( i = 0; i < count; i++ ) level[ i ] = operand[ i ] < level[ i ] ? operand[ i ] : level[ i ];
+                }
+                for( i = 0; i < count; i++ ) flags[ i ] |= eexception( level[ i ] );
+                break;
+
+            case MEO_Avg:
+                top -= ( node->count - 1 ) * MATH_EVAL_COLUMNS_BLOCK;
+                level = top;
+                for( j = 1; j < node->count; j++ )
+                {
+                    operand = level + j * MATH_EVAL_COLUMNS_BLOCK;
+                    for( i = 0; i < count; i++ ) level[ i ] += operand[ i ];
+                }
+                for( i = 0; i < count; i++ )
+                {
+                    level[ i ] = level[ i ] / (double)node->count;
+                    flags[ i ] |= eexception( level[ i ] );
+                }
+                break;
+        }
+    }
+
+    // parameters are not checked when fetched;
+    // as a sum of addends the result is never -0
+
+    level = top;
+    any = 0;
+
+    if( aligned )
+    {
+        results = __builtin_assume_aligned( results, MATH_EVAL_COLUMNS_ALIGNMENT );
+    }
+
+    for( i = 0; i < count; i++ )
+    {
+        flags[ i ] |= eexception( level[ i ] );
+        results[ i ] = level[ i ] + 0;
+        any |= flags[ i ];
+    }
+
+    return any != 0;
+}
+
+
+
+// Sets the error raised by `node` during
+// the execution of the program.
+// Always returns 0.
+
+double MathEvalRunError( MathEvaluation *matheval, MathEvalNode *node, const char *error )
+{
+    matheval->error = error;
+    matheval->cursor = matheval->expression + node->position;
+
+    return 0;
+}
+
+
+
+
+// With the saturating policy clamps an infinite
+// `*value` to +/-DBL_MAX.
+// Returns true if the value has been clamped,
+// false if it is an error.
+
+bool MathEvalSaturate( MathEvaluation *matheval, double *value )
+{
+    if( matheval->policy != MathEvaluationSaturate || isnan( *value ) )
+    {
+        return false;
+    }
+
+    *value = *value > 0 ? DBL_MAX : -DBL_MAX;
+
+    return true;
+}
+
+
+
+
+// Returns the factorial of `n` (>= 0), that is
+// the gamma function of `n + 1`: integers up to 170
+// are looked up in a table.
+
+double MathEvalFactorial( double n )
+{
+    if( n < MATH_EVAL_FACTORIALS && n == (int) n )
+    {
+        return MathEvalFactorials[ (int) n ];
+    }
+
+    return tgamma( n + 1 );
+}
+
+
+
+// Returns the gamma function of `n + 1` with the
+// Lanczos approximation (g = 7, 9 terms), relative
+// error below 1e-12; NaN if `n` is negative.
+// Unlike `tgamma` it has no branches, so that the
+// column kernel can run it on a block of values.
+
+double MathEvalGamma( double n )
+{
+    double sum,
+           t,
+           half;
+
+    sum = 0.99999999999980993 +
+          676.5203681218851     / ( n + 1 ) -
+          1259.1392167224028    / ( n + 2 ) +
+          771.32342877765313    / ( n + 3 ) -
+          176.61502916214059    / ( n + 4 ) +
+          12.507343278686905    / ( n + 5 ) -
+          0.13857109526572012   / ( n + 6 ) +
+          9.9843695780195716e-6 / ( n + 7 ) +
+          1.5056327351493116e-7 / ( n + 8 );
+
+    // t^(n+1/2) is computed in two halves
+    // to avoid overflows
+
+    t = n + 7.5;
+    half = pow( t, ( n + 0.5 ) * 0.5 );
+
+    sum = 2.5066282746310002 * sum * half * exp( -t ) * half;    // sqrt(2*pi)
+
+    return n < 0 ? NAN : ( n > 172 ? INFINITY : sum );
+}
+
+
+
+// Returns the digamma function of `x` (positive), the
+// derivative of the logarithm of the gamma function:
+// the recurrence digamma( x ) = digamma( x + 1 ) - 1 / x
+// brings x to 10 or more, where the asymptotic series
+// is accurate to about 1e-15.
+
+double MathEvalDigamma( double x )
+{
+    double result,
+           inverse,
+           square;
+
+    result = 0;
+
+    for( ; x < 10; x++ )
+    {
+        result -= 1 / x;
+    }
+
+    inverse = 1 / x;
+    square = inverse * inverse;
+
+    return result + log( x ) - 0.5 * inverse -
+           square * ( 1.0 / 12 - square * ( 1.0 / 120 - square * ( 1.0 / 252 - square * ( 1.0 / 240 - square / 132 ) ) ) );
+}
+
+
+
+
+// Replaces the `count` values with their approximated exp:
+// exp(x) = 2^k * exp(r) with |r| <= log(2)/2 and exp(r)
+// a polynomial of degree `terms`.
+// Each step is a loop over all the values without branches
+// (so that it can be vectorized); 2^k is the product of two
+// powers of 2 so that results too big overflow (raising the
+// exception) as with `exp`.
+// `scratch` has room for 4 * `count` values.
+
+void MathEvalApproxExp( double *values, size_t count, uint32_t terms, double *scratch )
+{
+    double   *r,
+             *p,
+             *k,
+             x,
+             c,
+             scale1,
+             scale2;
+    int64_t  n,
+             half;
+    uint64_t bits;
+    size_t   i;
+    uint32_t j;
+
+    r = scratch;
+    p = scratch + count;
+    k = scratch + 2 * count;
+
+    for( i = 0; i < count; i++ )
+    {
+        x = values[ i ] == values[ i ] ? values[ i ] : 0;
+        x = x > 1400 ? 1400 : ( x < -1400 ? -1400 : x );
+
+        // k rounded to the nearest integer, log(2)
+        // split in two parts so that k * log(2) is exact
+
+        k[ i ] = ( x * M_LOG2E + 6755399441055744.0 ) - 6755399441055744.0;
+        r[ i ] = ( x - k[ i ] * 6.93147180369123816490e-01 ) - k[ i ] * 1.90821492927058770002e-10;
+        p[ i ] = MathEvalInverseFactorials[ terms ];
+    }
+
+    for( j = terms; j > 0; j-- )
+    {
+        c = MathEvalInverseFactorials[ j - 1 ];
+        for( i = 0; i < count; i++ ) p[ i ] = p[ i ] * r[ i ] + c;
+    }
+
+    for( i = 0; i < count; i++ )
+    {
+        // the integer k from the bits of k + 1.5 * 2^52
+
+        x = k[ i ] + 6755399441055744.0;
+        memcpy( &bits, &x, sizeof( double ) );
+        n = (int64_t)( bits & 0x000fffffffffffffULL ) - 0x0008000000000000LL;
+        half = n >> 1;
+
+        bits = (uint64_t)( half + 1023 ) << 52;
+        memcpy( &scale1, &bits, sizeof( double ) );
+
+        bits = (uint64_t)( n - half + 1023 ) << 52;
+        memcpy( &scale2, &bits, sizeof( double ) );
+
+        values[ i ] = values[ i ] == values[ i ] ? p[ i ] * scale1 * scale2 : values[ i ];
+    }
+}
+
+
+
+// Replaces the `count` values with their approximated log:
+// log(m) = 2 * ( s + s^3/3 + s^5/5 ... ) with `terms` terms,
+// s = (m-1)/(m+1), where x = 2^e * m with sqrt(1/2) <= m < sqrt(2)
+// (|s| <= 0.1716).
+// Zero, negative, subnormal, infinite and NaN values are
+// left to `log`.
+// `scratch` has room for 4 * `count` values.
+
+void MathEvalApproxLog( double *values, size_t count, uint32_t terms, double *scratch )
+{
+    double   *s,
+             *p,
+             *e,
+             x,
+             m,
+             c;
+    uint64_t bits;
+    size_t   i;
+    uint32_t j;
+    bool     normal;
+
+    s = scratch;
+    p = scratch + count;
+    e = scratch + 2 * count;
+
+    for( i = 0; i < count; i++ )
+    {
+        normal = values[ i ] >= DBL_MIN && values[ i ] <= DBL_MAX;
+        x = normal ? values[ i ] : 1;
+
+        memcpy( &bits, &x, sizeof( double ) );
+        e[ i ] = (double)( (int64_t)( bits >> 52 ) - 1023 );
+
+        bits = ( bits & 0x000fffffffffffffULL ) | 0x3ff0000000000000ULL;
+        memcpy( &m, &bits, sizeof( double ) );
+
+        e[ i ] = m >= M_SQRT2 ? e[ i ] + 1 : e[ i ];
+        m = m >= M_SQRT2 ? m * 0.5 : m;
+
+        // the exponent of other values is NaN
+
+        e[ i ] = normal ? e[ i ] : NAN;
+        s[ i ] = ( m - 1 ) / ( m + 1 );
+        p[ i ] = MathEvalInverseOdds[ terms - 1 ];
+    }
+
+    for( j = terms - 1; j > 0; j-- )
+    {
+        c = MathEvalInverseOdds[ j - 1 ];
+        for( i = 0; i < count; i++ ) p[ i ] = p[ i ] * ( s[ i ] * s[ i ] ) + c;
+    }
+
+    for( i = 0; i < count; i++ )
+    {
+        x = e[ i ] * 6.93147180369123816490e-01 + ( 2 * s[ i ] * p[ i ] + e[ i ] * 1.90821492927058770002e-10 );
+        values[ i ] = e[ i ] == e[ i ] ? x : values[ i ];
+    }
+
+    for( i = 0; i < count; i++ )
+    {
+        if( e[ i ] != e[ i ] )
+        {
+            values[ i ] = log( values[ i ] );
+        }
+    }
+}
+
+
+
+// Replaces the `count` values with their approximated sin
+// (or cos if `cosine`): x = k * pi/2 + r with |r| <= pi/4,
+// the result is +/-sin(r) or +/-cos(r) depending on the
+// quadrant k.
+// Values greater than 1e5 (as the reduction loses accuracy),
+// infinite and NaN are left to `sin` and `cos`.
+// `scratch` has room for 4 * `count` values.
+
+void MathEvalApproxSin( const MathEvalApproximation *approximation, double *values, size_t count, bool cosine, double *scratch )
+{
+    double   *r,
+             *s,
+             *c,
+             *k,
+             x,
+             coefficient;
+    uint64_t bits;
+    size_t   i;
+    uint32_t j;
+
+    r = scratch;
+    s = scratch + count;
+    c = scratch + 2 * count;
+    k = scratch + 3 * count;
+
+    for( i = 0; i < count; i++ )
+    {
+        x = fabs( values[ i ] ) < 1e5 ? values[ i ] : 0;
+
+        // pi/2 split in two parts so that k * pi/2 is exact,
+        // k of other values is NaN
+
+        k[ i ] = ( x * M_2_PI + 6755399441055744.0 ) - 6755399441055744.0;
+        r[ i ] = ( x - k[ i ] * 1.57079632673412561417e+00 ) - k[ i ] * 6.07710050650619224932e-11;
+        k[ i ] = fabs( values[ i ] ) < 1e5 ? k[ i ] : NAN;
+        s[ i ] = MathEvalInverseFactorials[ 2 * approximation->sinTerms - 1 ];
+        c[ i ] = MathEvalInverseFactorials[ 2 * approximation->cosTerms - 2 ];
+    }
+
+    for( j = approximation->sinTerms - 1; j > 0; j-- )
+    {
+        coefficient = MathEvalInverseFactorials[ 2 * j - 1 ];
+        for( i = 0; i < count; i++ ) s[ i ] = s[ i ] * ( - r[ i ] * r[ i ] ) + coefficient;
+    }
+
+    for( j = approximation->cosTerms - 1; j > 0; j-- )
+    {
+        coefficient = MathEvalInverseFactorials[ 2 * j - 2 ];
+        for( i = 0; i < count; i++ ) c[ i ] = c[ i ] * ( - r[ i ] * r[ i ] ) + coefficient;
+    }
+
+    for( i = 0; i < count; i++ )
+    {
+        // the quadrant from the bits of k + 1.5 * 2^52,
+        // cos(x) = sin(x + pi/2)
+
+        x = k[ i ] + 6755399441055744.0;
+        memcpy( &bits, &x, sizeof( double ) );
+        bits += cosine;
+
+        x = bits & 1 ? c[ i ] : s[ i ] * r[ i ];
+        x = bits & 2 ? -x : x;
+
+        values[ i ] = k[ i ] == k[ i ] ? x : values[ i ];
+    }
+
+    for( i = 0; i < count; i++ )
+    {
+        if( k[ i ] != k[ i ] )
+        {
+            values[ i ] = cosine ? cos( values[ i ] ) : sin( values[ i ] );
+        }
+    }
+}
+
+
+
+// Replaces the `count` bases with the approximated
+// pow(base, exponent) = exp(exponent * log(base)).
+// Not positive or not finite bases and not finite
+// exponents are left to `pow`.
+// `scratch` has room for 4 * `count` values.
+
+void MathEvalApproxPow( const MathEvalApproximation *approximation, double *bases, const double *exponents, size_t count, double *scratch )
+{
+    double *original;
+    size_t i;
+
+    original = scratch + 3 * count;
+
+    for( i = 0; i < count; i++ )
+    {
+        original[ i ] = bases[ i ];
+        bases[ i ] = bases[ i ] >= DBL_MIN && bases[ i ] <= DBL_MAX && isfinite( exponents[ i ] ) ? bases[ i ] : 1;
+    }
+
+    MathEvalApproxLog( bases, count, approximation->powTerms, scratch );
+
+    for( i = 0; i < count; i++ ) bases[ i ] *= isfinite( exponents[ i ] ) ? exponents[ i ] : 0;
+
+    MathEvalApproxExp( bases, count, approximation->expTerms, scratch );
+
+    for( i = 0; i < count; i++ )
+    {
+        if( ! ( original[ i ] >= DBL_MIN && original[ i ] <= DBL_MAX && isfinite( exponents[ i ] ) ) )
+        {
+            bases[ i ] = pow( original[ i ], exponents[ i ] );
+        }
+    }
+}
+
+
+
+
+// Fits the Chebyshev interpolant of the expression at
+// `MATH_EVAL_FIT_NODES` nodes over [min, max] of the
+// parameter in `slot` and checks it between the nodes.
+// Returns true if it is within half the tolerance (the
+// other half is left to the coefficients that may be
+// dropped), false if not or if the expression fails
+// (`matheval->error` is set).
+
+bool MathEvalFitPiece( MathEvaluation *matheval, uint32_t slot, double min, double max, double tolerance, double *coefficients )
+{
+    double   values[ MATH_EVAL_FIT_NODES ],
+             middle,
+             half,
+             x,
+             sum,
+             exact;
+    uint32_t j,
+             k;
+
+    middle = ( min + max ) / 2;
+    half = ( max - min ) / 2;
+
+    for( k = 0; k < MATH_EVAL_FIT_NODES; k++ )
+    {
+        matheval->values[ slot ] = middle + half * cos( M_PI * ( k + 0.5 ) / MATH_EVAL_FIT_NODES );
+        values[ k ] = MathEvalRun( matheval );
+        if( matheval->error ) return false;
+    }
+
+    for( j = 0; j < MATH_EVAL_FIT_NODES; j++ )
+    {
+        sum = 0;
+        for( k = 0; k < MATH_EVAL_FIT_NODES; k++ )
+        {
+            sum += values[ k ] * cos( M_PI * j * ( k + 0.5 ) / MATH_EVAL_FIT_NODES );
+        }
+
+        coefficients[ j ] = sum * ( j ? 2.0 : 1.0 ) / MATH_EVAL_FIT_NODES;
+    }
+
+    // the ends and points between the nodes
+
+    for( k = 0; k <= 2 * MATH_EVAL_FIT_NODES; k++ )
+    {
+        x = min + ( max - min ) * k / ( 2 * MATH_EVAL_FIT_NODES );
+
+        matheval->values[ slot ] = x;
+        exact = MathEvalRun( matheval );
+        if( matheval->error ) return false;
+
+        if( ! ( fabs( MathEvalChebyshev( coefficients, MATH_EVAL_FIT_NODES, ( x - middle ) / half ) - exact ) <= tolerance / 2 * fmax( 1, fabs( exact ) ) ) )
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+
+
+// Returns the Chebyshev series with `terms` coefficients
+// at `t` (-1...1), Clenshaw recurrence.
+
+double MathEvalChebyshev( const double *coefficients, uint32_t terms, double t )
+{
+    double   b1,
+             b2,
+             b;
+    uint32_t j;
+
+    b1 = 0;
+    b2 = 0;
+
+    for( j = terms - 1; j > 0; j-- )
+    {
+        b = 2 * t * b1 - b2 + coefficients[ j ];
+        b2 = b1;
+        b1 = b;
+    }
+
+    return t * b1 - b2 + coefficients[ 0 ];
+}
+
+
+
+// Returns the fit of the expression at `x` (in its domain).
+
+double MathEvalRunFit( MathEvaluation *matheval, double x )
+{
+    MathEvalFit *fit;
+    size_t      piece;
+    double      min;
+
+    fit = &matheval->fit;
+
+    piece = (size_t)( ( x - fit->min ) / fit->width );
+    piece = piece < fit->pieces ? piece : fit->pieces - 1;
+
+    min = fit->min + (double) piece * fit->width;
+
+    return MathEvalChebyshev( fit->coefficients + piece * fit->terms, fit->terms, ( x - min ) * 2 / fit->width - 1 );
+}
+
+
+
+// Drops the fit of the expression (if any) and
+// the cached results, that may have been computed
+// with it.
+
+void MathEvalDropFit( MathEvaluation *matheval )
+{
+    if( ! matheval->fit.coefficients )
+    {
+        return;
+    }
+
+    MathEvalFree( matheval, matheval->fit.coefficients );
+    matheval->fit.coefficients = NULL;
+
+    MathEvalDropResults( matheval );
+
+    MathEvalAccount( matheval, false );
+}
+
+
+
+// Executes the compiled program with intervals (see
+// `MathEvaluationPerformInterval`): each node computes
+// the interval of its results from the intervals of
+// its operands (see `MathEvalIntervalStep`).
+// Returns false on error (`matheval->error` is set
+// and the cursor is moved where the error occurred).
+
+bool MathEvalRunInterval( MathEvaluation *matheval, const MathEvalInterval *bySlot, MathEvalInterval *result )
+{
+    MathEvalNode     *node,
+                     *end;
+    MathEvalInterval *top;
+    const char       *error;
+
+    top = (MathEvalInterval *) matheval->workspace + matheval->valuesCount - 1;
+    node = matheval->program;
+    end = matheval->program + matheval->programCount;
+
+    for( ; node < end; node++ )
+    {
+        if( node->opcode == MEO_Val )
+        {
+            top++;
+            top->low = node->value;
+            top->high = node->value;
+            continue;
+        }
+
+        if( node->opcode == MEO_Par )
+        {
+            *++top = bySlot[ node->slot ];
+            error = NULL;
+        }
+        else
+        {
+            top -= MathEvalOperandsCount( node ) - 1;
+            error = MathEvalIntervalStep( node, top );
+        }
+
+        // parameters are not checked when fetched
+
+        if( ! error && ( ! isfinite( top->low ) || ! isfinite( top->high ) ) )
+        {
+            error = "result is complex or too big";
+        }
+
+        if( error )
+        {
+            MathEvalRunError( matheval, node, error );
+            return false;
+        }
+    }
+
+    *result = *top;
+
+    return true;
+}
+
+
+
+// Computes the interval of the result of the node
+// (not a value nor a parameter) from the intervals of
+// its operands, `operands[0]`... (bounded), into
+// `operands[0]`: the bounds are widened by the rounding
+// errors.
+// Returns the error or NULL.
+
+const char *MathEvalIntervalStep( const MathEvalNode *node, MathEvalInterval *operands )
+{
+    MathEvalInterval divisor;
+    double           swap;
+    uint32_t         i;
+
+    switch( node->opcode )
+    {
+        case MEO_Neg:
+            swap = operands->low;
+            operands->low = - operands->high;
+            operands->high = - swap;
+            break;
+
+        case MEO_Add:
+        case MEO_Sub:
+        case MEO_Mul:
+        case MEO_Div:
+            if( node->opcode == MEO_Div && operands[ 1 ].low <= 0 && operands[ 1 ].high >= 0 )
+            {
+                return "division by zero";
+            }
+
+            MathEvalIntervalArithmetic( operands, operands + 1, (MathEvalOpcode) node->opcode );
+            break;
+
+        case MEO_Pow:
+            return MathEvalIntervalPow( operands, operands + 1 );
+
+        case MEO_Fac:
+            if( operands->low < 0 )
+            {
+                return "attempt to mathevaluate factorial of negative number";
+            }
+
+            MathEvalIntervalFactorial( operands );
+            break;
+
+        case MEO_Sin:
+        case MEO_Cos:
+            MathEvalIntervalPeriodic( operands, (MathEvalOpcode) node->opcode );
+            break;
+
+        case MEO_Tan:
+            // tan grows between its poles (pi/2 + k pi)
+
+            if( operands->low != operands->high &&
+                ( operands->high - operands->low >= M_PI || fabs( operands->low ) > 1e6 || fabs( operands->high ) > 1e6 ||
+                  MathEvalContains( operands, M_PI_2, M_PI ) ) )
+            {
+                return "result is complex or too big";
+            }
+
+            operands->low = tan( operands->low );
+            operands->high = tan( operands->high );
+
+            if( operands->low > operands->high )
+            {
+                return "result is complex or too big";
+            }
+
+            MathEvalWiden( operands, 2 );
+            break;
+
+        case MEO_ASi:
+        case MEO_ACo:
+            if( operands->low < -1 || operands->high > 1 )
+            {
+                return "result is complex or too big";
+            }
+
+            if( node->opcode == MEO_ASi )
+            {
+                operands->low = asin( operands->low );
+                operands->high = asin( operands->high );
+            }
+            else
+            {
+                swap = operands->low;
+                operands->low = acos( operands->high );
+                operands->high = acos( swap );
+            }
+
+            MathEvalWiden( operands, 2 );
+            break;
+
+        case MEO_ATa:
+            operands->low = atan( operands->low );
+            operands->high = atan( operands->high );
+            MathEvalWiden( operands, 2 );
+            break;
+
+        case MEO_Exp:
+            operands->low = exp( operands->low );
+            operands->high = exp( operands->high );
+            MathEvalWiden( operands, 2 );
+            operands->low = fmax( operands->low, 0 );
+            break;
+
+        case MEO_Log:
+        case MEO_LgB:
+            for( i = 0; i < MathEvalOperandsCount( node ); i++ )
+            {
+                if( operands[ i ].low <= 0 )
+                {
+                    return "result is complex or too big";
+                }
+
+                operands[ i ].low = log( operands[ i ].low );
+                operands[ i ].high = log( operands[ i ].high );
+                MathEvalWiden( &operands[ i ], 2 );
+            }
+
+            if( node->opcode == MEO_Log )
+            {
+                break;
+            }
+
+            // log( value ) / log( base ), the base is first
+
+            if( operands->low <= 0 && operands->high >= 0 )
+            {
+                return "result is complex or too big";
+            }
+
+            divisor = operands[ 0 ];
+            operands[ 0 ] = operands[ 1 ];
+            MathEvalIntervalArithmetic( operands, &divisor, MEO_Div );
+            break;
+
+        case MEO_Max:
+        case MEO_Min:
+        case MEO_Avg:
+            for( i = 1; i < node->count; i++ )
+            {
+                if( node->opcode == MEO_Max )
+                {
+                    operands->low = fmax( operands->low, operands[ i ].low );
+                    operands->high = fmax( operands->high, operands[ i ].high );
+                }
+                else if( node->opcode == MEO_Min )
+                {
+                    operands->low = fmin( operands->low, operands[ i ].low );
+                    operands->high = fmin( operands->high, operands[ i ].high );
+                }
+                else
+                {
+                    MathEvalIntervalArithmetic( operands, operands + i, MEO_Add );
+                }
+            }
+
+            if( node->opcode == MEO_Avg )
+            {
+                divisor.low = (double) node->count;
+                divisor.high = (double) node->count;
+                MathEvalIntervalArithmetic( operands, &divisor, MEO_Div );
+            }
+            break;
+    }
+
+    return NULL;
+}
+
+
+
+// Marks the nodes whose checks are not needed for the
+// declared bounds of the parameters (see
+// `MathEvaluationSetBounds`): the intervals of the results
+// are computed from the bounds, a node whose result is
+// always finite and valid is `MATH_EVAL_NODE_SAFE`.
+// If all of them are the program runs without checks
+// (`matheval->safe`).
+// Returns false if memory cannot be allocated.
+
+bool MathEvalAnalyze( MathEvaluation *matheval )
+{
+    MathEvalParam    *param;
+    MathEvalNode     *node,
+                     *end;
+    MathEvalInterval *bySlot,
+                     *top;
+    uint32_t         count,
+                     i;
+    bool             known;
+
+    end = matheval->program + matheval->programCount;
+
+    for( node = matheval->program; node < end; node++ )
+    {
+        node->flags = 0;
+    }
+
+    matheval->safe = false;
+
+    for( param = matheval->params; param && param->min == -INFINITY && param->max == INFINITY; param = param->next );
+
+    if( ! param )
+    {
+        return true;
+    }
+
+    if( ! MathEvalReserveWorkspace( matheval, ( matheval->valuesCount + matheval->stackMaxDepth ) * sizeof( MathEvalInterval ) ) )
+    {
+        return false;
+    }
+
+    bySlot = (MathEvalInterval *) matheval->workspace;
+
+    for( param = matheval->params; param; param = param->next )
+    {
+        bySlot[ param->slot ].low = param->min;
+        bySlot[ param->slot ].high = param->max;
+    }
+
+    // an unknown (unbounded) interval is -inf...inf
+
+    top = bySlot + matheval->valuesCount - 1;
+    matheval->safe = true;
+
+    for( node = matheval->program; node < end; node++ )
+    {
+        if( node->opcode == MEO_Val )
+        {
+            top++;
+            top->low = node->value;
+            top->high = node->value;
+            continue;
+        }
+
+        if( node->opcode == MEO_Par )
+        {
+            *++top = bySlot[ node->slot ];
+            continue;
+        }
+
+        count = MathEvalOperandsCount( node );
+        top -= count - 1;
+
+        for( i = 0, known = true; i < count; i++ )
+        {
+            known = known && isfinite( top[ i ].low ) && isfinite( top[ i ].high );
+        }
+
+        if( known && ! MathEvalIntervalStep( node, top ) && isfinite( top->low ) && isfinite( top->high ) )
+        {
+            node->flags |= MATH_EVAL_NODE_SAFE;
+        }
+        else
+        {
+            top->low = -INFINITY;
+            top->high = INFINITY;
+
+            matheval->safe = matheval->safe && node->opcode == MEO_Neg;
+        }
+    }
+
+    // the result is checked at the end
+
+    matheval->safe = matheval->safe && isfinite( top->low ) && isfinite( top->high );
+
+    return true;
+}
+
+
+
+// Returns true if bounding the result (see `MathEvalRunBounds`)
+// is worth it: the program has sin, cos or inverse
+// trigonometric functions, whose bounds are much cheaper
+// than the functions. Otherwise the bounds cost about as
+// much as the evaluation, that would be done twice when
+// they do not tell.
+
+bool MathEvalIsBounded( MathEvaluation *matheval )
+{
+    size_t i;
+
+    for( i = 0; i < matheval->programCount; i++ )
+    {
+        switch( matheval->program[ i ].opcode )
+        {
+            case MEO_Sin:
+            case MEO_Cos:
+            case MEO_ASi:
+            case MEO_ACo:
+            case MEO_ATa:
+                return true;
+
+            default:
+                break;
+        }
+    }
+
+    return false;
+}
+
+
+
+// Computes bounds of the result for the current values
+// of the parameters (see `MathEvaluationCompare`): the
+// program is executed with balls, values with a bound
+// of their error (rounding errors included), that are
+// cheaper than intervals; sin, cos, exp, log, pow and
+// the inverse trigonometric functions are not computed,
+// their results are bounded cheaply (see `MathEvalBoundStep`).
+// Returns false if the bounds cannot be computed: the
+// expression may fail or they are infinite. Otherwise
+// the evaluation of the expression does not fail.
+
+bool MathEvalRunBounds( MathEvaluation *matheval, MathEvalInterval *result )
+{
+    MathEvalNode *node,
+                 *end;
+    MathEvalBall *top;
+    double       value;
+
+    top = (MathEvalBall *) matheval->workspace - 1;
+    node = matheval->program;
+    end = matheval->program + matheval->programCount;
+
+    for( ; node < end; node++ )
+    {
+        switch( node->opcode )
+        {
+            case MEO_Val:
+                top++;
+                top->value = node->value;
+                top->radius = 0;
+                break;
+
+            case MEO_Par:
+                top++;
+                top->value = matheval->values[ node->slot ];
+                top->radius = 0;
+                break;
+
+            case MEO_Neg:
+                top->value = - top->value;
+                break;
+
+            // the arithmetic is done here, the
+            // radius includes the rounding errors
+            // of the value and of the radius (DBL_MIN
+            // covers the underflows and, unlike the
+            // denormals, is not slow)
+
+            case MEO_Add:
+            case MEO_Sub:
+                top--;
+                value = node->opcode == MEO_Add ? top->value + top[ 1 ].value : top->value - top[ 1 ].value;
+                top->radius = ( top->radius + top[ 1 ].radius ) * ( 1 + 0x1p-48 ) + fabs( value ) * 0x1p-52 + DBL_MIN;
+                top->value = value;
+                break;
+
+            case MEO_Mul:
+                top--;
+                value = top->value * top[ 1 ].value;
+                top->radius = ( fabs( top->value ) * top[ 1 ].radius + fabs( top[ 1 ].value ) * top->radius + top->radius * top[ 1 ].radius ) * ( 1 + 0x1p-48 ) +
+                              fabs( value ) * 0x1p-52 + DBL_MIN;
+                top->value = value;
+                break;
+
+            default:
+                top -= MathEvalOperandsCount( node ) - 1;
+                if( ! MathEvalBoundStep( node, top ) ) return false;
+                break;
+        }
+    }
+
+    // infinities and NaNs propagate
+    // up to here, if not caught before
+
+    result->low = top->value - top->radius;
+    result->high = top->value + top->radius;
+    MathEvalWiden( result, 1 );
+
+    return isfinite( result->low ) && isfinite( result->high );
+}
+
+
+
+// Computes the ball of the result of a division or a
+// function node from the balls of its operands,
+// `operands[0]`..., into `operands[0]`.
+// Sin and cos are within -1...1, exp and log are bounded
+// by powers of 2 and their exponents, pow of a positive
+// base is exp( exponent * log( base ) ), the other
+// functions are computed with intervals.
+// Returns false if the node may fail.
+
+bool MathEvalBoundStep( const MathEvalNode *node, MathEvalBall *operands )
+{
+    MathEvalInterval *intervals;
+    MathEvalBall     *right;
+    double           value,
+                     radius,
+                     low,
+                     high;
+    uint32_t         count,
+                     i;
+
+    right = operands + 1;
+
+    switch( node->opcode )
+    {
+        case MEO_Div:
+            // | a / b - ( a + da ) / ( b + db ) | <= ( |a| |db| + |b| |da| ) / ( |b| ( |b| - |db| ) )
+
+            if( ! ( fabs( right->value ) - right->radius > 0 ) )
+            {
+                return false;
+            }
+
+            value = operands->value / right->value;
+            radius = ( fabs( operands->value ) * right->radius + fabs( right->value ) * operands->radius ) /
+                     ( fabs( right->value ) * ( fabs( right->value ) - right->radius ) );
+            break;
+
+        case MEO_Sin:
+        case MEO_Cos:
+        case MEO_ATa:
+            if( ! isfinite( operands->value ) || ! isfinite( operands->radius ) )
+            {
+                return false;
+            }
+
+            operands->value = 0;
+            operands->radius = node->opcode == MEO_ATa ? M_PI_2 + 1e-15 : 1;
+            return true;
+
+        case MEO_ASi:
+        case MEO_ACo:
+            if( ! ( fabs( operands->value ) + operands->radius < 1 ) )
+            {
+                return false;
+            }
+
+            operands->value = node->opcode == MEO_ASi ? 0 : M_PI_2;
+            operands->radius = M_PI_2 + 1e-15;
+            return true;
+
+        default:
+            // the other nodes are computed with intervals,
+            // the balls are turned into intervals in place
+
+            intervals = (MathEvalInterval *) operands;
+            count = MathEvalOperandsCount( node );
+
+            for( i = 0; i < count; i++ )
+            {
+                if( ! isfinite( operands[ i ].value ) || ! isfinite( operands[ i ].radius ) )
+                {
+                    return false;
+                }
+
+                low = operands[ i ].value - operands[ i ].radius;
+                high = operands[ i ].value + operands[ i ].radius;
+
+                intervals[ i ].low = low;
+                intervals[ i ].high = high;
+                MathEvalWiden( &intervals[ i ], 1 );
+            }
+
+            if( node->opcode == MEO_Exp )
+            {
+                MathEvalBoundExp( intervals );
+            }
+            else if( node->opcode == MEO_Log || ( node->opcode == MEO_Pow && intervals->low > 0 ) )
+            {
+                if( intervals->low <= 0 )
+                {
+                    return false;
+                }
+
+                MathEvalBoundLog( intervals );
+
+                // the rounding errors of the product
+                // are covered by the bound of exp
+
+                if( node->opcode == MEO_Pow )
+                {
+                    low = intervals->low;
+                    high = intervals->high;
+
+                    intervals->low = INFINITY;
+                    intervals->high = -INFINITY;
+
+                    for( i = 0; i < 4; i++ )
+                    {
+                        value = ( i & 2 ? high : low ) * ( i & 1 ? intervals[ 1 ].high : intervals[ 1 ].low );
+
+                        intervals->low = value < intervals->low ? value : intervals->low;
+                        intervals->high = value > intervals->high ? value : intervals->high;
+                    }
+
+                    MathEvalBoundExp( intervals );
+                }
+            }
+            else if( MathEvalIntervalStep( node, intervals ) )
+            {
+                return false;
+            }
+
+            low = intervals->low;
+            high = intervals->high;
+
+            value = low / 2 + high / 2;
+            radius = high / 2 - low / 2;
+            break;
+    }
+
+    // the rounding errors of the value and
+    // of the radius
+
+    operands->value = value;
+    operands->radius = radius * ( 1 + 0x1p-48 ) + fabs( value ) * 0x1p-52 + DBL_MIN;
+
+    return true;
+}
+
+
+
+// Bounds the logarithm of the interval (above 0): a value
+// m 2^e with 1 <= m < 2 has the logarithm between e ln( 2 )
+// and ( e + 1 ) ln( 2 ); the exponents are read from the bits.
+
+void MathEvalBoundLog( MathEvalInterval *interval )
+{
+    uint64_t bits;
+    int64_t  low,
+             high;
+
+    // below the normal values the logarithm
+    // is above ln( 2^-1075 ) = -745.13...
+
+    memcpy( &bits, &interval->low, sizeof( double ) );
+    low = interval->low >= DBL_MIN ? (int64_t)( bits >> 52 ) - 1023 : -1076;
+
+    memcpy( &bits, &interval->high, sizeof( double ) );
+    high = interval->high >= DBL_MIN ? (int64_t)( bits >> 52 ) - 1022 : -1021;
+
+    interval->low = low * M_LN2 * ( low > 0 ? 0.999 : 1.001 );
+    interval->high = high * M_LN2 * ( high > 0 ? 1.001 : 0.999 );
+}
+
+
+
+// Bounds the exponential of the interval: e^value is
+// 2^(value log2( e )), between the powers of 2 of the
+// integers around the exponent (built from the bits,
+// 2^-1023 and 2^1024 are 0 and infinity).
+
+void MathEvalBoundExp( MathEvalInterval *interval )
+{
+    uint64_t bits;
+    double   low,
+             high;
+    int64_t  lowExponent,
+             highExponent;
+
+    low = interval->low * M_LOG2E;
+    high = interval->high * M_LOG2E;
+
+    // the integer parts are truncated, 2 is enough
+    // to cover also the rounding errors
+
+    lowExponent = (int64_t)( low < -1100 ? -1100 : ( low > 1100 ? 1100 : low ) ) - 2;
+    highExponent = (int64_t)( high < -1100 ? -1100 : ( high > 1100 ? 1100 : high ) ) + 2;
+
+    lowExponent = lowExponent < -1023 ? -1023 : ( lowExponent > 1024 ? 1024 : lowExponent );
+    highExponent = highExponent < -1022 ? -1022 : ( highExponent > 1024 ? 1024 : highExponent );
+
+    bits = (uint64_t)( lowExponent + 1023 ) << 52;
+    memcpy( &interval->low, &bits, sizeof( double ) );
+
+    bits = (uint64_t)( highExponent + 1023 ) << 52;
+    memcpy( &interval->high, &bits, sizeof( double ) );
+}
+
+
+
+// Executes the compiled program with derivatives (see
+// `MathEvaluationPerformDerivatives`): each entry of
+// `stack` is a value followed by its derivatives with
+// respect to the parameters in `slots` (`lanes` of them);
+// a parameter has derivative 1 with respect to itself.
+// `partials` has room for the partials of any node.
+// Returns false on error (`matheval->error` is set
+// and the cursor is moved where the error occurred).
+
+bool MathEvalRunDerivatives( MathEvaluation *matheval, const size_t *slots, size_t lanes, double *partials, double *stack,
+                             double *result, double *derivatives )
+{
+    MathEvalNode *node,
+                 *end;
+    double       *top;
+    const char   *error;
+    size_t       width,
+                 i;
+
+    width = lanes + 1;
+    top = stack - width;
+    node = matheval->program;
+    end = matheval->program + matheval->programCount;
+
+    for( ; node < end; node++ )
+    {
+        if( node->opcode == MEO_Val || node->opcode == MEO_Par )
+        {
+            top += width;
+            top[ 0 ] = node->opcode == MEO_Val ? node->value : matheval->values[ node->slot ];
+
+            for( i = 0; i < lanes; i++ )
+            {
+                top[ i + 1 ] = node->opcode == MEO_Par && slots[ i ] == node->slot;
+            }
+
+            // parameters are not checked when fetched
+
+            continue;
+        }
+
+        top -= ( MathEvalOperandsCount( node ) - 1 ) * width;
+        error = MathEvalDerivativeStep( node, top, lanes, partials );
+
+        if( ! error && eexception( top[ 0 ] ) )
+        {
+            error = node->opcode == MEO_Mul || node->opcode == MEO_Div ? "result is too big" : "result is complex or too big";
+        }
+
+        for( i = 0; ! error && i < lanes; i++ )
+        {
+            if( eexception( top[ i + 1 ] ) )
+            {
+                error = "derivative is complex or too big";
+            }
+        }
+
+        if( error )
+        {
+            MathEvalRunError( matheval, node, error );
+            return false;
+        }
+    }
+
+    if( eexception( top[ 0 ] ) )
+    {
+        MathEvalRunError( matheval, end - 1, "result is complex or too big" );
+        return false;
+    }
+
+    // as a sum of addends the result is never -0
+
+    *result = top[ 0 ] + 0;
+
+    for( i = 0; i < lanes; i++ )
+    {
+        derivatives[ i ] = top[ i + 1 ] + 0;
+    }
+
+    return true;
+}
+
+
+
+// Computes the value and the derivatives of the result
+// of the node (not a value nor a parameter) from those
+// of its operands, `operands[0]` with its `lanes`
+// derivatives, then the following one..., into the first:
+// the derivatives of the operands are combined with the
+// partial derivatives of the node (see `MathEvalPartials`,
+// `partials` has room for them). Derivatives that are 0
+// do not count also where the partial is not finite.
+// Returns the error or NULL.
+
+const char *MathEvalDerivativeStep( const MathEvalNode *node, double *operands, size_t lanes, double *partials )
+{
+    const char *error;
+    double     derivative;
+    size_t     width,
+               i;
+    uint32_t   count,
+               j;
+
+    width = lanes + 1;
+    count = MathEvalOperandsCount( node );
+
+    error = MathEvalPartials( node, operands, width, partials );
+    if( error ) return error;
+
+    for( i = 1; i <= lanes; i++ )
+    {
+        derivative = 0;
+
+        for( j = 0; j < count; j++ )
+        {
+            derivative += operands[ j * width + i ] != 0 ? partials[ j ] * operands[ j * width + i ] : 0;
+        }
+
+        operands[ i ] = derivative;
+    }
+
+    return NULL;
+}
+
+
+
+// Computes the result of the node (not a value nor a
+// parameter) from its operands, `operands[0]`,
+// `operands[stride]`..., into `operands[0]` and the
+// partial derivatives of the result with respect to each
+// operand into `partials[0]`...
+// The partial of the factorial uses the digamma function,
+// max and min depend only on the chosen operand (the first
+// as in `MathEvalRun`).
+// Returns the error or NULL.
+
+const char *MathEvalPartials( const MathEvalNode *node, double *operands, size_t stride, double *partials )
+{
+    double   left,
+             right,
+             value;
+    uint32_t chosen,
+             j;
+
+    left = operands[ 0 ];
+    right = MathEvalOperandsCount( node ) > 1 ? operands[ stride ] : 0;
+
+    switch( node->opcode )
+    {
+        case MEO_Neg:
+            value = - left;
+            partials[ 0 ] = -1;
+            break;
+
+        case MEO_Add:
+            value = left + right;
+            partials[ 0 ] = 1;
+            partials[ 1 ] = 1;
+            break;
+
+        case MEO_Sub:
+            value = left - right;
+            partials[ 0 ] = 1;
+            partials[ 1 ] = -1;
+            break;
+
+        case MEO_Mul:
+            value = left * right;
+            partials[ 0 ] = right;
+            partials[ 1 ] = left;
+            break;
+
+        case MEO_Div:
+            if( right == 0 )
+            {
+                return "division by zero";
+            }
+
+            value = left / right;
+            partials[ 0 ] = 1 / right;
+            partials[ 1 ] = - value / right;
+            break;
+
+        case MEO_Pow:
+            // b a^(b-1) and a^b log( a ), that
+            // tends to 0 with a^b
+
+            value = pow( left, right );
+            partials[ 0 ] = right * pow( left, right - 1 );
+            partials[ 1 ] = value != 0 ? value * log( left ) : 0;
+            break;
+
+        case MEO_LgB:
+            // log( b ) / log( a ), the base is first
+
+            if( left <= 0 || right <= 0 )
+            {
+                return "result is complex or too big";
+            }
+
+            value = log( right ) / log( left );
+            partials[ 0 ] = - value / ( left * log( left ) );
+            partials[ 1 ] = 1 / ( right * log( left ) );
+            break;
+
+        case MEO_Max:
+        case MEO_Min:
+            for( j = 1, chosen = 0; j < node->count; j++ )
+            {
+                if( node->opcode == MEO_Max ? operands[ j * stride ] > operands[ chosen * stride ] : operands[ j * stride ] < operands[ chosen * stride ] )
+                {
+                    chosen = j;
+                }
+            }
+
+            for( j = 0; j < node->count; j++ )
+            {
+                partials[ j ] = j == chosen;
+            }
+
+            value = operands[ chosen * stride ];
+            break;
+
+        case MEO_Avg:
+            for( j = 1, value = left; j < node->count; j++ )
+            {
+                value += operands[ j * stride ];
+            }
+
+            for( j = 0; j < node->count; j++ )
+            {
+                partials[ j ] = 1 / (double) node->count;
+            }
+
+            value /= (double) node->count;
+            break;
+
+        case MEO_Fac:
+            // n! = gamma( n + 1 ), gamma' = gamma digamma
+
+            if( left < 0 )
+            {
+                return "attempt to mathevaluate factorial of negative number";
+            }
+
+            value = MathEvalFactorial( left );
+            partials[ 0 ] = value * MathEvalDigamma( left + 1 );
+            break;
+
+        case MEO_Sin:
+            value = sin( left );
+            partials[ 0 ] = cos( left );
+            break;
+
+        case MEO_Cos:
+            value = cos( left );
+            partials[ 0 ] = - sin( left );
+            break;
+
+        case MEO_Tan:
+            value = tan( left );
+            partials[ 0 ] = 1 + value * value;
+            break;
+
+        case MEO_ASi:
+            value = asin( left );
+            partials[ 0 ] = 1 / sqrt( 1 - left * left );
+            break;
+
+        case MEO_ACo:
+            value = acos( left );
+            partials[ 0 ] = -1 / sqrt( 1 - left * left );
+            break;
+
+        case MEO_ATa:
+            value = atan( left );
+            partials[ 0 ] = 1 / ( 1 + left * left );
+            break;
+
+        case MEO_Exp:
+            value = exp( left );
+            partials[ 0 ] = value;
+            break;
+
+        case MEO_Log:
+            value = log( left );
+            partials[ 0 ] = 1 / left;
+            break;
+
+        default:
+            return "unexpected symbol";
+    }
+
+    operands[ 0 ] = value;
+
+    return NULL;
+}
+
+
+
+// Executes the compiled program recording on `tape`
+// the partial derivatives of each node with respect to
+// its operands (see `MathEvalPartials`), then sweeps the
+// program backwards: the adjoint of a node (the derivative
+// of the result with respect to its value) is popped, those
+// of its operands are pushed, the last operand on top as
+// it is the next node met. The adjoints of the parameters
+// are summed into `gradient` (by slot, set to 0).
+// The values on `stack` are not needed by the sweep, that
+// uses it for the adjoints.
+// Returns false on error (`matheval->error` is set
+// and the cursor is moved where the error occurred).
+
+bool MathEvalRunGradient( MathEvaluation *matheval, double *tape, double *stack, double *result, double *gradient )
+{
+    MathEvalNode *node,
+                 *end;
+    double       *top,
+                 *entry,
+                 adjoint;
+    const char   *error;
+    size_t       i;
+    uint32_t     count,
+                 j;
+
+    top = stack - 1;
+    entry = tape;
+    node = matheval->program;
+    end = matheval->program + matheval->programCount;
+
+    for( ; node < end; node++ )
+    {
+        if( node->opcode == MEO_Val || node->opcode == MEO_Par )
+        {
+            *++top = node->opcode == MEO_Val ? node->value : matheval->values[ node->slot ];
+
+            // parameters are not checked when fetched
+
+            continue;
+        }
+
+        count = MathEvalOperandsCount( node );
+        top -= count - 1;
+
+        error = MathEvalPartials( node, top, 1, entry );
+        entry += count;
+
+        if( ! error && eexception( *top ) )
+        {
+            error = node->opcode == MEO_Mul || node->opcode == MEO_Div ? "result is too big" : "result is complex or too big";
+        }
+
+        if( error )
+        {
+            MathEvalRunError( matheval, node, error );
+            return false;
+        }
+    }
+
+    if( eexception( *top ) )
+    {
+        MathEvalRunError( matheval, end - 1, "result is complex or too big" );
+        return false;
+    }
+
+    // as a sum of addends the result is never -0
+
+    *result = *top + 0;
+
+    // the backward sweep: as in forward mode a partial
+    // or an adjoint that is 0 gives nothing
+
+    top = stack;
+    *top = 1;
+
+    for( node = end; node-- > matheval->program; )
+    {
+        adjoint = *top--;
+
+        if( node->opcode == MEO_Val )
+        {
+            continue;
+        }
+
+        if( node->opcode == MEO_Par )
+        {
+            gradient[ node->slot ] += adjoint;
+            continue;
+        }
+
+        count = MathEvalOperandsCount( node );
+        entry -= count;
+
+        for( j = 0; j < count; j++ )
+        {
+            *++top = adjoint != 0 && entry[ j ] != 0 ? adjoint * entry[ j ] : 0;
+        }
+    }
+
+    for( i = 0; i < matheval->valuesCount; i++ )
+    {
+        if( eexception( gradient[ i ] ) )
+        {
+            MathEvalRunError( matheval, end - 1, "derivative is complex or too big" );
+            return false;
+        }
+
+        gradient[ i ] += 0;
+    }
+
+    return true;
+}
+
+
+
+// Computes the interval of the sum, difference, product
+// or quotient (`opcode`) of the intervals `left` and `right`
+// into `left` (the divisor does not contain 0): the extremes
+// are at the corners, each rounded outwards unless the
+// operation is exact (see `MathEvalExtend`).
+
+void MathEvalIntervalArithmetic( MathEvalInterval *left, const MathEvalInterval *right, MathEvalOpcode opcode )
 {
-    MathEvalToken
-           t;
-    double v;
-    MathEvalParam
-          *param;
+    MathEvalInterval result;
+    double           a,
+                     b,
+                     value,
+                     error,
+                     part;
+    int              corners,
+                     corner;
 
-    t = MET_Blk;
-    v = 0;
+    result.low = INFINITY;
+    result.high = -INFINITY;
 
-    while( t == MET_Blk )
+    // single values have a single corner
+
+    corners = left->low == left->high && right->low == right->high ? 1 : 4;
+
+    for( corner = 0; corner < corners; corner++ )
     {
-        // value maybe
+        a = corner & 2 ? left->high : left->low;
+        b = corner & 1 ? right->high : right->low;
+        b = opcode == MEO_Sub ? -b : b;
 
-        if( ( *matheval->cursor >= '0' && *matheval->cursor <= '9' ) || *matheval->cursor == '.' )
+        // the rounding error (or its sign): two-sum for
+        // sums and differences, the exact remainders
+        // given by fma otherwise
+
+        switch( opcode )
         {
-            v = MathEvalProcessValue( matheval );
-            if( matheval->error )
-            {
-                t = MET_Err;
-                return t;
-            }
-            else
+            case MEO_Add:
+            case MEO_Sub:
+                value = a + b;
+                part = value - a;
+                error = ( a - ( value - part ) ) + ( b - part );
+                break;
+
+            case MEO_Mul:
+                value = a * b;
+                error = fma( a, b, -value );
+                break;
+
+            default:
+                value = a / b;
+                error = fma( -value, b, a ) * copysign( 1, b );
+                break;
+        }
+
+        MathEvalExtend( &result, value, error );
+    }
+
+    *left = result;
+}
+
+
+
+// Extends `bounds` to contain the exact result of an
+// operation rounded to `value`, `error` being the sign
+// of the rounding error (exact result - value).
+// Near the underflow the error may be lost, the value
+// is then widened in both directions.
+
+void MathEvalExtend( MathEvalInterval *bounds, double value, double error )
+{
+    double low,
+           high,
+           ulp;
+
+    // at least a unit in the last place
+
+    ulp = fabs( value ) * 0x1p-52 + DBL_MIN;
+
+    low = error < 0 || fabs( value ) < 0x1p-969 ? value - ulp : value;
+    high = error > 0 || fabs( value ) < 0x1p-969 ? value + ulp : value;
+
+    if( low < bounds->low )
+    {
+        bounds->low = low;
+    }
+
+    if( high > bounds->high )
+    {
+        bounds->high = high;
+    }
+}
+
+
+
+// Widens the interval by `ulps` units in the last place
+// on both sides, so that it contains the exact results
+// of rounded operations.
+
+void MathEvalWiden( MathEvalInterval *interval, unsigned int ulps )
+{
+    // |value| 2^-52 is at least a unit in the last place
+
+    interval->low -= ( fabs( interval->low ) * 0x1p-52 + DBL_MIN ) * ulps;
+    interval->high += ( fabs( interval->high ) * 0x1p-52 + DBL_MIN ) * ulps;
+}
+
+
+
+// Returns true if the interval contains a value
+// `phase` + k `period` (k integer).
+
+bool MathEvalContains( const MathEvalInterval *interval, double phase, double period )
+{
+    return phase + ceil( ( interval->low - phase ) / period ) * period <= interval->high;
+}
+
+
+
+// Computes the interval of sin or cos (`opcode`) of
+// the interval: the values at the ends unless it
+// contains a maximum or a minimum of the function.
+// Far from 0 the maxima and minima cannot be located
+// accurately, the interval is then -1...1.
+
+void MathEvalIntervalPeriodic( MathEvalInterval *interval, MathEvalOpcode opcode )
+{
+    MathEvalInterval values;
+    double           peak;
+
+    if( interval->high - interval->low >= 2 * M_PI || fabs( interval->low ) > 1e6 || fabs( interval->high ) > 1e6 )
+    {
+        if( interval->low != interval->high )
+        {
+            interval->low = -1;
+            interval->high = 1;
+            return;
+        }
+    }
+
+    values.low = opcode == MEO_Sin ? sin( interval->low ) : cos( interval->low );
+    values.high = opcode == MEO_Sin ? sin( interval->high ) : cos( interval->high );
+
+    if( values.low > values.high )
+    {
+        peak = values.low;
+        values.low = values.high;
+        values.high = peak;
+    }
+
+    MathEvalWiden( &values, 2 );
+
+    peak = opcode == MEO_Sin ? M_PI_2 : 0;
+
+    if( MathEvalContains( interval, peak, 2 * M_PI ) )
+    {
+        values.high = 1;
+    }
+
+    if( MathEvalContains( interval, peak + M_PI, 2 * M_PI ) )
+    {
+        values.low = -1;
+    }
+
+    interval->low = fmax( values.low, -1 );
+    interval->high = fmin( values.high, 1 );
+}
+
+
+
+// Computes the interval of `base` ^ `exponent` into `base`.
+// With a positive base the extremes are at the corners
+// (base ^ exponent is exp( exponent * log( base ) )),
+// a negative base needs a single integer exponent.
+// Returns the error or NULL.
+
+const char *MathEvalIntervalPow( MathEvalInterval *base, const MathEvalInterval *exponent )
+{
+    double powers[ 4 ],
+           n;
+    bool   positive;
+
+    // powers of positive numbers and even
+    // powers are never negative
+
+    positive = base->low >= 0 || ( exponent->low == exponent->high && fmod( exponent->low, 2 ) == 0 );
+
+    if( base->low < 0 )
+    {
+        n = exponent->low;
+
+        if( exponent->high != n || n != floor( n ) )
+        {
+            return "result is complex or too big";
+        }
+
+        if( n < 0 && base->high >= 0 )
+        {
+            return "result is complex or too big";
+        }
+
+        // the power is monotonic on each side of 0,
+        // an even power has its minimum at 0
+
+        powers[ 0 ] = pow( base->low, n );
+        powers[ 1 ] = pow( base->high, n );
+        powers[ 2 ] = base->high >= 0 && fmod( n, 2 ) == 0 ? 0 : powers[ 0 ];
+
+        base->low = fmin( fmin( powers[ 0 ], powers[ 1 ] ), powers[ 2 ] );
+        base->high = fmax( powers[ 0 ], powers[ 1 ] );
+    }
+    else
+    {
+        if( base->low == 0 && exponent->low < 0 )
+        {
+            return "result is complex or too big";
+        }
+
+        powers[ 0 ] = pow( base->low, exponent->low );
+        powers[ 1 ] = pow( base->low, exponent->high );
+        powers[ 2 ] = pow( base->high, exponent->low );
+        powers[ 3 ] = pow( base->high, exponent->high );
+
+        base->low = fmin( fmin( powers[ 0 ], powers[ 1 ] ), fmin( powers[ 2 ], powers[ 3 ] ) );
+        base->high = fmax( fmax( powers[ 0 ], powers[ 1 ] ), fmax( powers[ 2 ], powers[ 3 ] ) );
+    }
+
+    MathEvalWiden( base, 2 );
+
+    if( positive )
+    {
+        base->low = fmax( base->low, 0 );
+    }
+
+    return NULL;
+}
+
+
+
+// Computes the interval of the factorial of the interval
+// (not negative): Gamma( n + 1 ) decreases down to its
+// minimum at n = 0.4616... then grows.
+
+void MathEvalIntervalFactorial( MathEvalInterval *interval )
+{
+    double minimum;
+
+    minimum = 0.46163214496836234126;
+
+    if( interval->high <= minimum )
+    {
+        minimum = interval->low;
+        interval->low = MathEvalFactorial( interval->high );
+        interval->high = MathEvalFactorial( minimum );
+    }
+    else if( interval->low >= minimum )
+    {
+        interval->low = MathEvalFactorial( interval->low );
+        interval->high = MathEvalFactorial( interval->high );
+    }
+    else
+    {
+        interval->high = fmax( MathEvalFactorial( interval->low ), MathEvalFactorial( interval->high ) );
+        interval->low = 0.88560319441088870027;
+    }
+
+    // tgamma may be a few units in the last place off
+
+    MathEvalWiden( interval, 16 );
+}
+
+
+
+// Thread entry point of `MathEvaluationNewBatch`:
+// creates and compiles the expressions
+// of a slice.
+
+void *MathEvalBatchWorker( void *job )
+{
+    MathEvalBatchJob *batch;
+    MathEvaluation   *matheval;
+    size_t           i,
+                     p;
+
+    batch = job;
+
+    for( i = batch->first; i < batch->count; i += batch->step )
+    {
+        matheval = MathEvaluationNew( batch->expressions[ i ] );
+
+        batch->evals[ i ] = matheval;
+        batch->statuses[ i ] = MathEvaluationFailure;
+
+        if( ! matheval )
+        {
+            continue;
+        }
+
+        for( p = 0; p < batch->paramsCount; p++ )
+        {
+            if( MathEvaluationSetParam( matheval, batch->params[ p ], 0 ) == MathEvaluationFailure )
             {
-                t = MET_Val;
+                break;
             }
-            break;
         }
-        else
+
+        if( p == batch->paramsCount )
         {
-            // parameter maybe
+            batch->statuses[ i ] = MathEvaluationCompile( matheval );
+        }
+    }
 
-            param = matheval->params;
-            while( param != NULL )
-            {
-                if( strncmp( param->name, matheval->cursor, param->len ) == 0 )
-                {
-                    *token = MET_Val;
-                    matheval->cursor += param->len;
-                    return param->value;
-                }
+    return NULL;
+}
 
-                param = param->next;
-            }
 
-            // token maybe
 
-            switch( *matheval->cursor )
-            {
-                case '\n':
-                case '\r':
-                case '\t':
-                case ' ':
-                    t = MET_Blk;
-                    matheval->cursor++;
-                    break;
+// Checks that an image is consistent so that
+// its program can be executed safely:
+// header, bounds of the sections, names,
+// opcodes, parameter slots and stack usage.
+
+bool MathEvalImageVerify( const MathEvalImage *image, size_t size )
+{
+    const MathEvalNode *node;
+    const char         *names,
+                       *end;
+    uint64_t           expressionLength,
+                       depth;
+    uint32_t           i;
+
+    if( ( (uintptr_t) image & 7 ) != 0 || size < sizeof( MathEvalImage ) )
+    {
+        return false;
+    }
+
+    if( memcmp( image->magic, MATH_EVAL_IMAGE_MAGIC, sizeof( image->magic ) ) != 0 ||
+        image->version != MATH_EVAL_IMAGE_VERSION ||
+        image->byteOrder != MATH_EVAL_IMAGE_ORDER ||
+        image->nodeSize != sizeof( MathEvalNode ) )
+    {
+        return false;
+    }
+
+    if( image->size > size || ( image->size & 7 ) != 0 ||
+        image->nodesOffset != sizeof( MathEvalImage ) ||
+        image->nodesCount == 0 ||
+        image->slotsOffset != image->nodesOffset + (uint64_t) image->nodesCount * sizeof( MathEvalNode ) ||
+        image->expressionOffset < image->slotsOffset ||
+        image->expressionOffset >= image->size )
+    {
+        return false;
+    }
+
+    // null terminated names and expression
+
+    names = (const char *) image + image->slotsOffset;
+    end = (const char *) image + image->expressionOffset;
+    for( i = 0; i < image->slotsCount; i++ )
+    {
+        names = memchr( names, '\0', end - names );
+        if( ! names )
+        {
+            return false;
+        }
+        names++;
+    }
+
+    end = memchr( end, '\0', image->size - image->expressionOffset );
+    if( ! end )
+    {
+        return false;
+    }
+
+    expressionLength = end - ( (const char *) image + image->expressionOffset );
+
+    // program: the stack never underflows nor exceeds
+    // the declared size and one value is left at the end
+
+    node = (const MathEvalNode *)( (const char *) image + image->nodesOffset );
+    depth = 0;
+
+    for( i = 0; i < image->nodesCount; i++, node++ )
+    {
+        if( (uint64_t) node->position > expressionLength + 1 || node->flags != 0 )
+        {
+            return false;
+        }
+
+        switch( node->opcode )
+        {
+            case MEO_Val:
+                depth++;
+                break;
+
+            case MEO_Par:
+                if( node->slot >= image->slotsCount ) return false;
+                depth++;
+                break;
+
+            case MEO_Add:
+            case MEO_Sub:
+            case MEO_Mul:
+            case MEO_Div:
+            case MEO_Pow:
+            case MEO_LgB:
+                if( depth < 2 ) return false;
+                depth--;
+                break;
+
+            case MEO_Max:
+            case MEO_Min:
+            case MEO_Avg:
+                if( node->count == 0 || depth < node->count ) return false;
+                depth -= node->count - 1;
+                break;
+
+            case MEO_Neg:
+            case MEO_Fac:
+            case MEO_Sin:
+            case MEO_Cos:
+            case MEO_Tan:
+            case MEO_ASi:
+            case MEO_ACo:
+            case MEO_ATa:
+            case MEO_Exp:
+            case MEO_Log:
+                if( depth < 1 ) return false;
+                break;
+
+            default:
+                return false;
+        }
+
+        if( depth > image->stackSize )
+        {
+            return false;
+        }
+    }
+
+    return depth == 1;
+}
+
+
+
+// FNV-1a hash of `size` bytes at `data`
+// continuing from `hash`
+
+uint64_t MathEvalHash( uint64_t hash, const void *data, size_t size )
+{
+    const unsigned char *bytes = data;
+    size_t              i;
+
+    for( i = 0; i < size; i++ )
+    {
+        hash ^= bytes[ i ];
+        hash *= 0x100000001b3ULL;
+    }
+
+    return hash;
+}
+
+
+
+// Reads the compile cache directory from
+// the environment (once)
+
+void MathEvalCacheInit( void )
+{
+    const char *directory;
+
+    directory = getenv( "MATHEVAL_CACHE_DIR" );
+    if( directory && *directory )
+    {
+        MathEvalCacheDirectory = malloc( strlen( directory ) + 1 );
+        if( MathEvalCacheDirectory )
+        {
+            strcpy( MathEvalCacheDirectory, directory );
+        }
+    }
+}
 
-                case '+':
-                    MathEvalProcessPlusToken( matheval, &t);
-                    break;
 
-                case '-':
-                    t = MET_Sub;
-                    matheval->cursor++;
-                    break;
 
-                case '*':
-                    t = MET_Mul;
-                    matheval->cursor++;
-                    break;
+// Builds the path of the compile cache file of the
+// expression, keyed by library version, image version,
+// expression and parameter names (in slot order).
+// Returns false, with an empty path, if the cache is disabled.
 
-                case '/':
-                    t = MET_Div;
-                    matheval->cursor++;
-                    break;
+bool MathEvalCachePath( MathEvaluation *matheval, char *path, size_t size )
+{
+    MathEvalParam *param;
+    uint64_t      hash;
+    uint32_t      slot,
+                  version;
+    int           length;
 
-                case '^':
-                    t = MET_Exc;
-                    matheval->cursor++;
-                    break;
+    path[ 0 ] = '\0';
 
-                case '!':
-                    t = MET_Fct;
-                    matheval->cursor++;
-                    break;
+    pthread_once( &MathEvalCacheOnce, MathEvalCacheInit );
 
-                case '(':
-                    t = MET_rbo;
-                    matheval->cursor++;
-                    break;
+    if( ! MathEvalCacheDirectory )
+    {
+        return false;
+    }
 
-                case ')':
-                    t = MET_rbc;
-                    matheval->cursor++;
-                    break;
+    version = MATH_EVAL_IMAGE_VERSION;
 
-                case '\0':
-                    t = MET_Eof;
-                    matheval->cursor++;
-                    break;
+    hash = 0xcbf29ce484222325ULL;
+    hash = MathEvalHash( hash, MATH_EVAL_VERSION, sizeof( MATH_EVAL_VERSION ) );
+    hash = MathEvalHash( hash, &version, sizeof( version ) );
+    hash = MathEvalHash( hash, matheval->expression, strlen( matheval->expression ) + 1 );
 
-                case ',':
-                    t = MET_com;
-                    matheval->cursor++;
-                    break;
+    for( slot = 0; slot < matheval->valuesCount; slot++ )
+    {
+        for( param = matheval->params; param->slot != slot; param = param->next );
 
-                case 'e':
-                    if( strncmp( matheval->cursor, "exp", 3 ) == 0 )
-                    {
-                        t = MET_Exp;
-                        matheval->cursor += 3;
-                    }
-                    else
-                    {
-                        v = exp( 1 );
-                        t = MET_Val;
-                        matheval->cursor++;
-                    }
-                    break;
+        hash = MathEvalHash( hash, param->name, param->len + 1 );
+    }
 
-                case 'f':
-                    if( strncmp( matheval->cursor, "fact", 4 ) == 0 )
-                    {
-                        t = MET_Fac;
-                        matheval->cursor += 4;
-                    }
-                    else
-                    {
-                        t = MET_Err;
-                    }
-                    break;
+    length = snprintf( path, size, "%s/%016" PRIx64 ".mec", MathEvalCacheDirectory, hash );
+    if( length < 0 || (size_t) length >= size )
+    {
+        path[ 0 ] = '\0';
+        return false;
+    }
 
-                case 'p':
-                    if( strncmp( matheval->cursor, "pi", 2 ) == 0 )
-                    {
-                        v = M_PI;
-                        t = MET_Val;
-                        matheval->cursor += 2;
-                    }
-                    else if( strncmp( matheval->cursor, "pow", 3 ) == 0 )
-                    {
-                        t = MET_Pow;
-                        matheval->cursor += 3;
-                    }
-                    else
-                    {
-                        t = MET_Err;
-                    }
-                    break;
+    return true;
+}
 
-                case 'c':
-                    if( strncmp( matheval->cursor, "cos", 3 ) == 0 )
-                    {
-                        t = MET_Cos;
-                        matheval->cursor += 3;
-                    }
-                    else
-                    {
-                        t = MET_Err;
-                    }
-                    break;
 
-                case 's':
-                    if( strncmp( matheval->cursor, "sin", 3 ) == 0 )
-                    {
-                        t = MET_Sin;
-                        matheval->cursor += 3;
-                    }
-                    else
-                    {
-                        t = MET_Err;
-                    }
-                    break;
 
-                case 't':
-                    if( strncmp( matheval->cursor, "tan", 3 ) == 0 )
-                    {
-                        t = MET_Tan;
-                        matheval->cursor += 3;
-                    }
-                    else
-                    {
-                        t = MET_Err;
-                    }
-                    break;
+// Loads the program of the expression from the
+// compile cache file `path`.
+// Returns false if the file does not exist, is not
+// valid or belongs to another expression (hash collision).
 
-                case 'l':
-                    if( strncmp( matheval->cursor, "log", 3 ) == 0 )
-                    {
-                        t = MET_Log;
-                        matheval->cursor += 3;
-                    }
-                    else
-                    {
-                        t = MET_Err;
-                    }
-                    break;
+bool MathEvalCacheLoad( MathEvaluation *matheval, const char *path )
+{
+    const MathEvalImage *image;
+    MathEvalNode        *program;
+    MathEvalParam       *param;
+    struct stat         info;
+    const char          *name;
+    void                *buffer;
+    ssize_t             bytes;
+    size_t              done;
+    uint32_t            slot;
+    bool                valid;
+    int                 fd;
+
+    fd = open( path, O_RDONLY );
+    if( fd < 0 )
+    {
+        return false;
+    }
 
-                case 'm':
-                    if( strncmp( matheval->cursor, "max", 3 ) == 0 )
-                    {
-                        t = MET_Max;
-                        matheval->cursor += 3;
-                    }
-                    else if( strncmp( matheval->cursor, "min", 3 ) == 0 )
-                    {
-                        t = MET_Min;
-                        matheval->cursor += 3;
-                    }
-                    else
-                    {
-                        t = MET_Err;
-                    }
-                    break;
+    buffer = NULL;
+    valid = fstat( fd, &info ) == 0 && info.st_size > 0 && ( buffer = MathEvalAlloc( matheval, (size_t) info.st_size ) );
 
-                case 'a':
-                    if( strncmp( matheval->cursor, "asin", 4 ) == 0 )
-                    {
-                        t = MET_ASi;
-                        matheval->cursor += 4;
-                    }
-                    else if( strncmp( matheval->cursor, "acos", 4 ) == 0 )
-                    {
-                        t = MET_ACo;
-                        matheval->cursor += 4;
-                    }
-                    else if( strncmp( matheval->cursor, "atan", 4 ) == 0 )
-                    {
-                        t = MET_ATa;
-                        matheval->cursor += 4;
-                    }
-                    else if( strncmp( matheval->cursor, "average", 7 ) == 0 )
-                    {
-                        t = MET_Avg;
-                        matheval->cursor += 7;
-                    }
-                    else if( strncmp( matheval->cursor, "avg", 3 ) == 0 )
-                    {
-                        t = MET_Avg;
-                        matheval->cursor += 3;
-                    }
-                    else
-                    {
-                        t = MET_Err;
-                    }
-                    break;
+    for( done = 0; valid && done < (size_t) info.st_size; done += bytes )
+    {
+        bytes = read( fd, (char *) buffer + done, (size_t) info.st_size - done );
+        valid = bytes > 0;
+    }
 
+    close( fd );
 
-                default:
-                    t = MET_Err;
-                    break;
-            }
+    image = buffer;
+    valid = valid && MathEvalImageVerify( image, (size_t) info.st_size ) &&
+            image->slotsCount == matheval->valuesCount &&
+            strcmp( (const char *) image + image->expressionOffset, matheval->expression ) == 0;
+
+    name = valid ? (const char *) image + image->slotsOffset : NULL;
+    for( slot = 0; valid && slot < image->slotsCount; slot++ )
+    {
+        for( param = matheval->params; param->slot != slot; param = param->next );
+
+        valid = strcmp( name, param->name ) == 0;
+        name += param->len + 1;
+    }
+
+    if( valid && image->nodesCount > matheval->programSize )
+    {
+        program = MathEvalArenaRealloc( matheval, matheval->program, image->nodesCount * sizeof( MathEvalNode ) );
+        valid = program != NULL;
+        if( valid )
+        {
+            matheval->program = program;
+            matheval->programSize = image->nodesCount;
         }
     }
 
-    if( t == MET_Err )
+    if( valid )
     {
-        matheval->error = "unexpected symbol";
+        memcpy( matheval->program, (const char *) image + image->nodesOffset, image->nodesCount * sizeof( MathEvalNode ) );
+        matheval->programCount = image->nodesCount;
+        matheval->stackMaxDepth = image->stackSize;
     }
 
-    *token = t;
+    MathEvalFree( matheval, buffer );
 
-    return v;
+    return valid;
 }
 
 
 
-// Parses what follows a (already fetched) plus token
-// ensuring that two consecutive plus are not present.
-// Expressions such as 2++2 (binary plus
-// followed by unitary plus) are not allowed.
-// Advances the cursor.
-// Always returns 0.
+// Stores the compiled program into the compile cache
+// file `path`. The image is written to a temporary file
+// then renamed so that readers never see a partial file.
 
-double MathEvalProcessPlusToken( MathEvaluation *matheval, MathEvalToken *token )
+void MathEvalCacheStore( MathEvaluation *matheval, const char *path )
 {
-    do
+    char    temporary[ 4096 + 32 ];
+    void    *image;
+    size_t  size;
+    bool    written;
+    int     fd;
+
+    size = MathEvaluationWriteImage( matheval, NULL, 0 );
+    image = MathEvalAlloc( matheval, size );
+    if( ! image )
     {
-        matheval->cursor++;
-    } while( *matheval->cursor == ' ' || *matheval->cursor == '\n' || *matheval->cursor == '\r' || *matheval->cursor == '\t' );
+        return;
+    }
 
-    if( *matheval->cursor == '+' )
+    MathEvaluationWriteImage( matheval, image, size );
+
+    snprintf( temporary, sizeof( temporary ), "%s.%ld.tmp", path, (long) getpid() );
+
+    fd = open( temporary, O_WRONLY | O_CREAT | O_EXCL, 0644 );
+    if( fd >= 0 )
     {
-        *token = MET_Err;
+        written = write( fd, image, size ) == (ssize_t) size;
+        close( fd );
+
+        if( ! written || rename( temporary, path ) != 0 )
+        {
+            unlink( temporary );
+        }
     }
-    else
+
+    MathEvalFree( matheval, image );
+}
+
+
+
+// Orders the entries of a catalog by name
+
+int MathEvalCatalogCompare( const void *entry1, const void *entry2 )
+{
+    const MathEvalCatalogEntry *e1 = entry1,
+                               *e2 = entry2;
+    int                        order;
+
+    order = memcmp( e1->name, e2->name, e1->nameLength < e2->nameLength ? e1->nameLength : e2->nameLength );
+    if( order != 0 )
     {
-        *token = MET_Sum;
+        return order;
     }
 
-    return 0;
+    return e1->nameLength < e2->nameLength ? -1 : ( e1->nameLength > e2->nameLength ? 1 : 0 );
 }
 
 
 
-// Parses a number and advances the cursor.
-// The cursor is positioned after an eventually
-// `+` or `-` operator that comes before the value.
+// Binary search of a formula by name in a catalog.
+// Returns NULL if not found.
 
-double MathEvalProcessValue( MathEvaluation *matheval )
+MathEvalCatalogEntry *MathEvalCatalogFind( MathEvaluationCatalog *catalog, const char *name, size_t length )
 {
-    char   *endptr;
-    double value;
+    MathEvalCatalogEntry key;
+    size_t               low,
+                         high,
+                         middle;
+    int                  order;
 
-    value = strtod( matheval->cursor, &endptr );
+    key.name = name;
+    key.nameLength = length;
 
-    if( endptr == matheval->cursor )
-    {
-        matheval->error = "expected value";
-        value = 0;
-    }
-    else
+    low = 0;
+    high = catalog->count;
+
+    while( low < high )
     {
-        matheval->cursor = endptr;
+        middle = low + ( high - low ) / 2;
 
-        if( eexception( value ) )
+        order = MathEvalCatalogCompare( &key, &catalog->entries[ middle ] );
+        if( order == 0 )
         {
-            matheval->error = "value is too big";
-            return 0;
+            return &catalog->entries[ middle ];
+        }
+
+        if( order < 0 )
+        {
+            high = middle;
+        }
+        else
+        {
+            low = middle + 1;
         }
     }
 
-    return value;
-}
\ No newline at end of file
+    return NULL;
+}
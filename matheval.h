@@ -14,31 +14,66 @@
 
 
 
+#include <stddef.h>
+
+
+
 //
-// Build settings
+// Enum
 //
 
+enum MathEvaluationStatus
+{
+    MathEvaluationFailure = 0,
+    MathEvaluationSuccess = 1
+};
+typedef enum MathEvaluationStatus MathEvaluationStatus;
 
-// FLOATING POINT EXCEPTIONS CATCHING
+enum MathEvaluationErrorPolicy
+{
+    MathEvaluationStrict    = 0,    // complex or too big results are errors (default)
+    MathEvaluationPropagate = 1,    // no checks, infinities and NaNs propagate to the result
+    MathEvaluationSaturate  = 2     // too big results are clamped, complex results are errors
+};
+typedef enum MathEvaluationErrorPolicy MathEvaluationErrorPolicy;
 
-// leave to true (default) to catch exceptions on math operations (ex. overflows)
-#define math_eval_catch_fp_exceptions true
 
 
-#include "matheval-private.h"
+//
+// Allocator
+//
+
+struct MathEvaluationAllocator
+{
+    void *( *alloc )( size_t size, void *userData );
+    void  ( *free  )( void *memory, void *userData );
+    void  *userData;
+};
+typedef struct MathEvaluationAllocator MathEvaluationAllocator;
 
 
 
 //
-// Enum
+// Memory footprint
 //
 
-enum MathEvaluationStatus
+struct MathEvaluationFootprint
 {
-    MathEvaluationFailure = 0,
-    MathEvaluationSuccess = 1
+    size_t count;           // number of evaluations
+    size_t expression;      // bytes by category
+    size_t params;
+    size_t program;
+    size_t values;
+    size_t stack;
+    size_t results;
+    size_t other;
+    size_t total;
 };
-typedef enum MathEvaluationStatus MathEvaluationStatus;
+typedef struct MathEvaluationFootprint MathEvaluationFootprint;
+
+
+
+#include "matheval-private.h"
 
 
 
@@ -47,11 +82,51 @@ typedef enum MathEvaluationStatus MathEvaluationStatus;
 //
 
 MathEvaluation *     MathEvaluationNew        ( const char *expression );
+MathEvaluationStatus MathEvaluationInit       ( MathEvaluation *eval, const char *expression, void *buffer, size_t size );
+MathEvaluation *     MathEvaluationNewWithAllocator ( const char *expression, const MathEvaluationAllocator *allocator );
 void                 MathEvaluationDispose    ( MathEvaluation *eval );
+MathEvaluationStatus MathEvaluationReset      ( MathEvaluation *eval, const char *expression );
+MathEvaluation *     MathEvaluationAcquire    ( const char *expression );
+void                 MathEvaluationRelease    ( MathEvaluation *eval );
+void                 MathEvaluationGetFootprint      ( MathEvaluation *eval, MathEvaluationFootprint *footprint );
+void                 MathEvaluationGetTotalFootprint ( MathEvaluationFootprint *footprint );
 MathEvaluationStatus MathEvaluationSetParam   ( MathEvaluation *eval, const char *name, double value );
+MathEvaluationStatus MathEvaluationSetBounds  ( MathEvaluation *eval, const char *name, double min, double max );
+MathEvaluationStatus MathEvaluationCompile    ( MathEvaluation *eval );
 MathEvaluationStatus MathEvaluationPerform    ( MathEvaluation *eval, double *result );
+MathEvaluationStatus MathEvaluationPerformColumns ( MathEvaluation *eval, const char **params, const double **columns,
+                                                    size_t paramsCount, size_t rows, double *results,
+                                                    MathEvaluationStatus *statuses );
+MathEvaluationStatus MathEvaluationPerformInterval ( MathEvaluation *eval, const char **params, const double *lows,
+                                                     const double *highs, size_t paramsCount, double *low, double *high );
+MathEvaluationStatus MathEvaluationCompare    ( MathEvaluation *eval, double threshold, bool *above );
+MathEvaluationStatus MathEvaluationPerformDerivatives ( MathEvaluation *eval, const char **params, size_t paramsCount,
+                                                        double *result, double *partials );
+MathEvaluationStatus MathEvaluationPerformGradient ( MathEvaluation *eval, double *result, double *gradient, size_t gradientSize );
+double *             MathEvaluationAllocColumn    ( size_t rows, bool hugePages );
+void                 MathEvaluationFreeColumn     ( double *column );
+MathEvaluationStatus MathEvaluationGetHash    ( MathEvaluation *eval, uint64_t *hash );
+MathEvaluationStatus MathEvaluationSetResultCache ( MathEvaluation *eval, size_t entries );
+void                 MathEvaluationSetDeferredChecks ( MathEvaluation *eval, bool deferred );
+void                 MathEvaluationSetErrorPolicy    ( MathEvaluation *eval, MathEvaluationErrorPolicy policy );
+MathEvaluationStatus MathEvaluationSetApproximation  ( MathEvaluation *eval, double tolerance );
+MathEvaluationStatus MathEvaluationFit               ( MathEvaluation *eval, const char *param, double min, double max,
+                                                       double tolerance );
 double               MathEvaluationGetResult  ( MathEvaluation *eval );
 const char *         MathEvaluationGetError   ( MathEvaluation *eval, int *position );
 void                 MathEvaluationPrintError ( MathEvaluation *eval );
 
+MathEvaluationStatus MathEvaluationNewBatch   ( const char **expressions, size_t count, const char **params, size_t paramsCount,
+                                                unsigned int threads, MathEvaluation **evals, MathEvaluationStatus *statuses );
+
+size_t               MathEvaluationWriteImage   ( MathEvaluation *eval, void *buffer, size_t size );
+MathEvaluation *     MathEvaluationNewFromImage ( const void *image, size_t size, size_t *imageSize );
+
+MathEvaluationStatus MathEvaluationSetCacheDirectory ( const char *path );
+
+MathEvaluationCatalog *MathEvaluationCatalogOpen  ( const char *path );
+void                   MathEvaluationCatalogClose ( MathEvaluationCatalog *catalog );
+size_t                 MathEvaluationCatalogCount ( MathEvaluationCatalog *catalog );
+MathEvaluation *       MathEvaluationCatalogGet   ( MathEvaluationCatalog *catalog, const char *name );
+
 #endif